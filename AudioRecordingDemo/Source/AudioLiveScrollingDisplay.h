@@ -23,6 +23,19 @@
 //==============================================================================
 /* This component scrolls a continuous waveform showing the audio that's
    coming into whatever audio inputs this object is connected to.
+
+   The audio callback works on whole blocks: the inputs are summed with
+   FloatVectorOperations into a preallocated buffer, each run of samplesPerLevel
+   samples is reduced to its min and max with one vectorised findMinAndMax(), and
+   only those pairs are pushed into the visualiser, which is set up to take one
+   pair per level.
+
+   In incremental mode, which is the default, the levels go into a lock-free FIFO
+   instead, and each repaint only draws the columns that have arrived since the
+   last one into a ring-buffered Image, which is then blitted in two pieces. That
+   makes the drawing cost depend on how much new audio there is rather than on
+   how wide the component is, unlike the visualiser's own paint(), which builds
+   and fills a path from every stored level each time.
 */
 class LiveScrollingAudioDisplay  : public AudioVisualiserComponent,
                                    public AudioIODeviceCallback
@@ -30,36 +43,75 @@ class LiveScrollingAudioDisplay  : public AudioVisualiserComponent,
 public:
     LiveScrollingAudioDisplay()  : AudioVisualiserComponent (1)
     {
-        setSamplesPerBlock (256);
-        setBufferSize (1024);
+        setSamplesPerBlock (2); // (each level arrives as a min/max pair)
+        setBufferSize (levelsShown);
+        prepareBuffers (4096);
+        levelQueue.resize ((size_t) levelFifo.getTotalSize());
+    }
+
+    /** Switches between drawing only the newly arrived levels into a scrolling image,
+        and letting AudioVisualiserComponent redraw everything on every repaint.
+    */
+    void setIncrementalRendering (bool shouldBeIncremental)
+    {
+        incremental = shouldBeIncremental;
+        clearRequested = true;
+        repaint();
+    }
+
+    //==============================================================================
+    void paint (Graphics& g) override
+    {
+        if (! incremental)
+        {
+            AudioVisualiserComponent::paint (g);
+            return;
+        }
+
+        renderNewLevels();
+
+        if (ring.isNull())
+            return;
+
+        // The column that gets overwritten next is the oldest, so the ring is shown from there
+        const auto w = ring.getWidth(), h = ring.getHeight();
+        g.drawImage (ring, 0, 0, w - writeColumn, h, writeColumn, 0, w - writeColumn, h);
+
+        if (writeColumn > 0)
+            g.drawImage (ring, w - writeColumn, 0, writeColumn, h, 0, 0, writeColumn, h);
+    }
+
+    void resized() override
+    {
+        ring = getWidth() > 0 && getHeight() > 0 ? Image (Image::RGB, getWidth(), getHeight(), false) : Image();
+        clearRequested = true;
     }
 
     //==============================================================================
-    void audioDeviceAboutToStart (AudioIODevice*) override
+    void audioDeviceAboutToStart (AudioIODevice* device) override
     {
         clear();
+        prepareBuffers (device->getCurrentBufferSizeSamples());
+        clearRequested = true;
     }
 
     void audioDeviceStopped() override
     {
         clear();
+        pendingCount = 0;
+        clearRequested = true;
     }
 
     void audioDeviceIOCallback (const float** inputChannelData, int numInputChannels,
                                 float** outputChannelData, int numOutputChannels,
                                 int numberOfSamples) override
     {
-        for (int i = 0; i < numberOfSamples; ++i)
+        // (the device may deliver more than it said it would, so go through it in chunks that fit)
+        for (int start = 0; start < numberOfSamples; start += mix.getNumSamples())
         {
-            float inputSample = 0;
-
-            for (int chan = 0; chan < numInputChannels; ++chan)
-                if (const float* inputChannel = inputChannelData[chan])
-                    inputSample += inputChannel[i];  // find the sum of all the channels
-
-            inputSample *= 1.0f; // boost the level to make it more easily visible.
-
-            pushSample (&inputSample, 1);
+            const auto num = jmin (mix.getNumSamples(), numberOfSamples - start);
+            sumInputs (inputChannelData, numInputChannels, start, num);
+            pushLevels (mix.getReadPointer (0), num);
         }
 
         // We need to clear the output buffers before returning, in case they're full of junk..
@@ -68,5 +120,144 @@ public:
                 zeromem (outputChannel, (size_t) numberOfSamples * sizeof (float));
     }
 
+private:
+    static constexpr int samplesPerLevel = 256, levelsShown = 1024;
+
+    AudioBuffer<float> mix, levels;
+    Range<float> pending;
+    int pendingCount = 0;
+
+    std::atomic<bool> incremental { true }, clearRequested { true };
+    AbstractFifo levelFifo { 8192 };
+    std::vector<Range<float>> levelQueue;
+
+    // (only used on the message thread)
+    Image ring;
+    int writeColumn = 0, levelsInColumn = 0;
+    Range<float> column;
+
+    void prepareBuffers (int maxBlockSize)
+    {
+        mix.setSize (1, jmax (samplesPerLevel, maxBlockSize));
+        levels.setSize (1, 2 * (mix.getNumSamples() / samplesPerLevel + 1));
+        pendingCount = 0;
+    }
+
+    void sumInputs (const float** inputChannelData, int numInputChannels, int start, int num) noexcept
+    {
+        auto* dest = mix.getWritePointer (0);
+        bool first = true;
+
+        for (int chan = 0; chan < numInputChannels; ++chan)
+        {
+            if (const float* inputChannel = inputChannelData[chan])
+            {
+                if (first)
+                    FloatVectorOperations::copy (dest, inputChannel + start, num);
+                else
+                    FloatVectorOperations::add (dest, inputChannel + start, num);
+
+                first = false;
+            }
+        }
+
+        if (first)
+            FloatVectorOperations::clear (dest, num);
+    }
+
+    void pushLevels (const float* data, int num) noexcept
+    {
+        auto* out = levels.getWritePointer (0);
+        int numOut = 0;
+
+        for (int i = 0; i < num;)
+        {
+            // A level can straddle two callbacks, so its range is carried over in pending
+            const auto n = jmin (num - i, samplesPerLevel - pendingCount);
+            const auto range = FloatVectorOperations::findMinAndMax (data + i, n);
+
+            pending = pendingCount == 0 ? range : pending.getUnionWith (range);
+            pendingCount += n;
+            i += n;
+
+            if (pendingCount == samplesPerLevel)
+            {
+                out[numOut++] = pending.getStart();
+                out[numOut++] = pending.getEnd();
+                pendingCount = 0;
+            }
+        }
+
+        if (numOut == 0)
+            return;
+
+        if (incremental)
+        {
+            // If nothing is painting (e.g. the window is minimised), whatever doesn't fit is dropped
+            const auto scope = levelFifo.write (jmin (numOut / 2, levelFifo.getFreeSpace()));
+
+            for (int i = 0; i < scope.blockSize1; ++i)
+                levelQueue[(size_t) (scope.startIndex1 + i)] = { out[2 * i], out[2 * i + 1] };
+
+            for (int i = 0; i < scope.blockSize2; ++i)
+                levelQueue[(size_t) (scope.startIndex2 + i)] = { out[2 * (scope.blockSize1 + i)], out[2 * (scope.blockSize1 + i) + 1] };
+        }
+        else
+        {
+            const float* channelData[] = { out };
+            pushBuffer (channelData, 1, numOut);
+        }
+    }
+
+    //==============================================================================
+    void renderNewLevels()
+    {
+        const auto scope = levelFifo.read (levelFifo.getNumReady());
+
+        if (clearRequested.exchange (false))
+        {
+            if (ring.isValid())
+                ring.clear (ring.getBounds(), Colours::black);
+
+            writeColumn = 0;
+            levelsInColumn = 0;
+            return; // (and whatever was waiting is thrown away along with the rest)
+        }
+
+        if (ring.isNull())
+            return;
+
+        // Roughly the same time span as the visualiser would show across the same width
+        const auto levelsPerColumn = jmax (1, roundToInt ((float) levelsShown / (float) ring.getWidth()));
+
+        Graphics g (ring);
+        drawLevels (g, levelQueue.data() + scope.startIndex1, scope.blockSize1, levelsPerColumn);
+        drawLevels (g, levelQueue.data() + scope.startIndex2, scope.blockSize2, levelsPerColumn);
+    }
+
+    void drawLevels (Graphics& g, const Range<float>* newLevels, int num, int levelsPerColumn)
+    {
+        for (int i = 0; i < num; ++i)
+        {
+            column = levelsInColumn == 0 ? newLevels[i] : column.getUnionWith (newLevels[i]);
+
+            if (++levelsInColumn < levelsPerColumn)
+                continue;
+
+            // Same colours and scaling as AudioVisualiserComponent's defaults: -1..1 fills the height
+            const auto h = (float) ring.getHeight();
+            const auto top = jlimit (0.0f, h, (1.0f - column.getEnd()) * 0.5f * h);
+            const auto bottom = jlimit (0.0f, h, (1.0f - column.getStart()) * 0.5f * h);
+
+            g.setColour (Colours::black);
+            g.fillRect (writeColumn, 0, 1, ring.getHeight());
+            g.setColour (Colours::white);
+            g.fillRect (Rectangle<float> ((float) writeColumn, top, 1.0f, jmax (1.0f, bottom - top)));
+
+            writeColumn = (writeColumn + 1) % ring.getWidth();
+            levelsInColumn = 0;
+        }
+    }
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LiveScrollingAudioDisplay)
 };
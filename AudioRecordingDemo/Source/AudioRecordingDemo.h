@@ -50,6 +50,15 @@
 
 #include "DemoUtilities.h"
 #include "AudioLiveScrollingDisplay.h"
+#include "MeterWall.h"
+#include "SpectrumAnalyser.h"
+#include "MultichannelRecorder.h"
+#include "ThumbnailFeeder.h"
+#include "MipmappedAudioThumbnail.h"
+#include "PersistentThumbnailCache.h"
+#include "SegmentedAudioFormatWriter.h"
+#include "PreRollBuffer.h"
+#include "MediaClock.h"
 #include <winsock2.h>
 #include <windows.h>
 #include "DanteAudioIODevice.h"
@@ -120,102 +129,212 @@ namespace juce {
     //==============================================================================
     /** A simple class that acts as an AudioIODeviceCallback and writes the
         incoming audio data to a WAV file.
+
+        The audio callback never takes a lock. The active writer is handed over through
+        an atomic pointer, and the callback bumps an epoch counter on the way in and on
+        the way out, so the counter is odd while it's running. A writer that has been
+        swapped out is retired together with the epoch seen at that moment, and the
+        background thread only deletes it (which flushes it to disk) once the epoch was
+        even or has moved on, i.e. once the callback can no longer be holding it.
     */
-    class AudioRecorder : public AudioIODeviceCallback
+    class AudioRecorder : public AudioIODeviceCallback,
+                          private TimeSliceClient
     {
     public:
         AudioRecorder(AudioThumbnail& thumbnailToUpdate)
             : thumbnail(thumbnailToUpdate)
         {
+            backgroundThread.addTimeSliceClient(this);
             backgroundThread.startThread();
         }
 
         ~AudioRecorder() override
         {
             stop();
+            backgroundThread.removeTimeSliceClient(this);
+
+            // Anything still waiting to be retired gets flushed here instead
+            waitForCallbackToFinish();
+            retiredWriters.clear();
         }
 
         //==============================================================================
         void startRecording(const File& file)
+        {
+            startRecordingAt(file, -1);
+        }
+
+        /** Opens the file straight away, but only starts writing to it from the given
+            media-clock sample position. Recorders on separate hosts that are given the
+            same position produce sample-aligned files; the position also sets the BWF
+            time reference, as samples since local midnight. On devices that don't
+            report a media-clock position, or with a negative position, recording
+            starts immediately.
+        */
+        void startRecordingAt(const File& file, int64 mediaClockStartSample)
         {
             stop();
 
+            // The previous writer is gone from the callback, but a block might still be on its way
+            // into the thumbnail, so let that finish before everything gets reset
+            waitForCallbackToFinish();
+
             if (sampleRate > 0)
             {
-                // Create an OutputStream to write to our destination file...
-                file.deleteFile();
+                const auto preRollSamples = claimPreRoll();
 
-                if (auto fileStream = std::unique_ptr<FileOutputStream>(file.createOutputStream()))
-                {
-                    // Now create a WAV writer object that writes to our output stream...
-                    WavAudioFormat wavFormat;
-
-                    if (auto writer = wavFormat.createWriterFor(fileStream.get(), sampleRate, 1, 16, {}, 0))
-                    {
-                        fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+                file.deleteFile();
+                startWriting(createWavWriter(file, sampleRate, mediaClockStartSample >= 0 ? mediaClockStartSample - preRollSamples : -1),
+                             mediaClockStartSample, preRollSamples);
+            }
+        }
 
-                        // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
-                        // write the data to disk on our background thread.
-                        threadedWriter.reset(new AudioFormatWriter::ThreadedWriter(writer, backgroundThread, 32768));
+        /** Records one continuous stream into a series of files of segmentSeconds each,
+            named after the given file with _0000, _0001 etc. appended. The files join up
+            without a gap, opening and closing them all happens on the background thread,
+            and old segments are deleted according to the retention policy.
+        */
+        void startSegmentedRecordingAt(const File& file, int64 mediaClockStartSample, double segmentSeconds,
+                                       SegmentedAudioFormatWriter::Retention retention)
+        {
+            stop();
+            waitForCallbackToFinish();
 
-                        // Reset our recording thumbnail
-                        thumbnail.reset(writer->getNumChannels(), writer->getSampleRate());
-                        nextSampleNum = 0;
+            if (sampleRate > 0)
+            {
+                const auto rate = sampleRate;
+                const auto preRollSamples = claimPreRoll();
+                auto factory = [rate, mediaClockStartSample, preRollSamples](const File& segmentFile, int64 firstSample)
+                {
+                    return createWavWriter(segmentFile, rate,
+                                           mediaClockStartSample >= 0 ? mediaClockStartSample - preRollSamples + firstSample : -1);
+                };
 
-                        // And now, swap over our active writer pointer so that the audio callback will start using it..
-                        const ScopedLock sl(writerLock);
-                        activeWriter = threadedWriter.get();
-                    }
-                }
+                startWriting(SegmentedAudioFormatWriter::create(file, roundToInt(segmentSeconds * rate), factory, retention),
+                             mediaClockStartSample, preRollSamples);
             }
         }
 
+        /** Stops the audio callback from using the writer. The file itself is flushed and
+            closed shortly afterwards on the background thread.
+        */
         void stop()
         {
             // First, clear this pointer to stop the audio callback from using our writer object..
+            if (activeWriter.exchange(nullptr) == nullptr)
+                return;
+
+            thumbnailFeeder.finish();
+
+            // ..then hand the writer over to the background thread, which deletes it once the
+            // callback has provably let go of it. Deleting can take a while as the remaining
+            // data gets flushed to disk, so it's best to keep that away from here too.
             {
-                const ScopedLock sl(writerLock);
-                activeWriter = nullptr;
+                const ScopedLock sl(retiredLock);
+                retiredWriters.push_back({ std::move(threadedWriter), callbackEpoch.load() });
             }
 
-            // Now we can delete the writer object. It's done in this order because the deletion could
-            // take a little time while remaining data gets flushed to disk, so it's best to avoid blocking
-            // the audio callback while this happens.
-            threadedWriter.reset();
+            backgroundThread.moveToFrontOfQueue(this);
+        }
+
+        /** Sets how much audio from before the start of each recording is kept, for all the
+            device's active inputs. Every recording then begins with exactly that much, with
+            silence in front if the device hasn't been running that long. The memory for it is
+            allocated here and when the device starts, never in the audio callback.
+            If a recording is still writing out the previous pre-roll, the new length only
+            takes effect the next time the device starts.
+        */
+        void setPreRollSeconds(double seconds)
+        {
+            preRollSeconds = jmax(0.0, seconds);
+
+            if (sampleRate > 0 && preRoll.claim())
+            {
+                preRoll.freeze(); // (stops the callback filling it while it's reallocated)
+                waitForCallbackToFinish();
+                preparePreRoll();
+            }
         }
 
+        double getPreRollSeconds() const noexcept { return preRollSeconds; }
+
         bool isRecording() const
         {
             return activeWriter.load() != nullptr;
         }
 
+        /** The media-clock position of the first sample in the file, or -1 if nothing has
+            been written yet or the device doesn't report positions. Apart from the pre-roll,
+            this only differs from the requested start if recording was armed too late.
+        */
+        int64 getActualStartPosition() const
+        {
+            return actualStartPosition.load();
+        }
+
         //==============================================================================
         void audioDeviceAboutToStart(AudioIODevice* device) override
         {
             sampleRate = device->getCurrentSampleRate();
+            danteDevice = dynamic_cast<DanteAudioIODevice*>(device);
+
+            if (preRoll.claim())
+                preparePreRoll();
         }
 
         void audioDeviceStopped() override
         {
             sampleRate = 0;
+            danteDevice = nullptr;
         }
 
         void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
             float** outputChannelData, int numOutputChannels,
             int numSamples) override
         {
-            const ScopedLock sl(writerLock);
+            ++callbackEpoch; // (odd from here on, until we're done with the writer)
 
-            if (activeWriter.load() != nullptr && numInputChannels >= thumbnail.getNumChannels())
+            auto* writer = activeWriter.load();
+
+            if (writer == nullptr)
+            {
+                preRoll.push(inputChannelData, numInputChannels, numSamples);
+            }
+            else if (numInputChannels >= thumbnailFeeder.getNumChannels())
             {
-                activeWriter.load()->write(inputChannelData, numSamples);
+                const auto blockPosition = danteDevice != nullptr ? danteDevice->getBlockMediaClockPosition() : (int64)-1;
+                int startOffset = 0;
+
+                if (actualStartPosition.load() < 0 && startPosition >= 0 && blockPosition >= 0)
+                {
+                    // Still waiting for the agreed start sample to come round
+                    if (blockPosition + numSamples <= startPosition)
+                        startOffset = numSamples;
+                    else
+                        startOffset = (int)jmax((int64)0, startPosition - blockPosition);
+                }
+
+                // (the pre-roll keeps filling right up to the first sample that goes to the file)
+                if (startOffset > 0)
+                    preRoll.push(inputChannelData, numInputChannels, startOffset);
 
-                // Create an AudioBuffer to wrap our incoming data, note that this does no allocations or copies, it simply references our input data
-                AudioBuffer<float> buffer(const_cast<float**> (inputChannelData), thumbnail.getNumChannels(), numSamples);
-                thumbnail.addBlock(nextSampleNum, buffer, 0, numSamples);
-                nextSampleNum += numSamples;
+                if (startOffset < numSamples)
+                {
+                    if (recordingPreRoll > 0)
+                        preRoll.freeze();
+
+                    if (actualStartPosition.load() < 0 && blockPosition >= 0)
+                        actualStartPosition = blockPosition + startOffset - recordingPreRoll;
+
+                    // Create an AudioBuffer to wrap our incoming data, note that this does no allocations or copies, it simply references our input data
+                    AudioBuffer<float> buffer(const_cast<float**> (inputChannelData), thumbnailFeeder.getNumChannels(), startOffset, numSamples - startOffset);
+                    writer->write(buffer.getArrayOfReadPointers(), buffer.getNumSamples());
+                    thumbnailFeeder.push(buffer.getArrayOfReadPointers(), buffer.getNumSamples());
+                }
             }
 
+            ++callbackEpoch;
+
             // We need to clear the output buffers, in case they're full of junk..
             for (int i = 0; i < numOutputChannels; ++i)
                 if (outputChannelData[i] != nullptr)
@@ -226,11 +345,143 @@ namespace juce {
         AudioThumbnail& thumbnail;
         TimeSliceThread backgroundThread{ "Audio Recorder Thread" }; // the thread that will write our audio data to disk
         std::unique_ptr<AudioFormatWriter::ThreadedWriter> threadedWriter; // the FIFO used to buffer the incoming data
+        ThumbnailFeeder thumbnailFeeder{ thumbnail, backgroundThread }; // builds the thumbnail on the background thread too
         double sampleRate = 0.0;
-        int64 nextSampleNum = 0;
+        DanteAudioIODevice* danteDevice = nullptr;
+        int64 startPosition = -1;
+        std::atomic<int64> actualStartPosition{ -1 };
+
+        PreRollBuffer preRoll; // the last few seconds of the recorded channels, kept while nothing is being written
+        double preRollSeconds = 0.0;
+        int recordingPreRoll = 0; // how much of it the current recording starts with
 
-        CriticalSection writerLock;
         std::atomic<AudioFormatWriter::ThreadedWriter*> activeWriter{ nullptr };
+        std::atomic<uint64> callbackEpoch{ 0 };
+
+        // Only the first input goes into the file, so that's all the pre-roll keeps
+        static constexpr int numRecordedChannels = 1;
+
+        /** A negative firstSamplePosition leaves out the bext chunk, otherwise it's the
+            media-clock position that the file's time reference is worked out from.
+        */
+        static std::unique_ptr<AudioFormatWriter> createWavWriter(const File& file, double rate, int64 firstSamplePosition)
+        {
+            // Create an OutputStream to write to our destination file...
+            auto fileStream = std::unique_ptr<FileOutputStream>(file.createOutputStream());
+
+            if (fileStream == nullptr)
+                return {};
+
+            // Now create a WAV writer object that writes to our output stream...
+            WavAudioFormat wavFormat;
+            StringPairArray metadata;
+
+            if (firstSamplePosition >= 0)
+                metadata = MediaClock::createBWAVMetadata(firstSamplePosition, rate);
+
+            std::unique_ptr<AudioFormatWriter> writer(wavFormat.createWriterFor(fileStream.get(), rate, numRecordedChannels, 16, metadata, 0));
+
+            if (writer != nullptr)
+                fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+
+            return writer;
+        }
+
+        /** Rounded up to whole thumbnail buckets, so the live audio that follows the pre-roll
+            in the thumbnail still starts on a bucket boundary.
+        */
+        void preparePreRoll()
+        {
+            const auto length = roundToInt(preRollSeconds * sampleRate);
+            preRoll.prepare(numRecordedChannels, (length + 511) / 512 * 512, true);
+        }
+
+        /** Returns the number of pre-roll samples the next recording will start with. */
+        int claimPreRoll()
+        {
+            return preRoll.getLength() > 0 && preRoll.claim() ? preRoll.getLength() : 0;
+        }
+
+        void startWriting(std::unique_ptr<AudioFormatWriter> writer, int64 mediaClockStartSample, int preRollSamples)
+        {
+            if (writer == nullptr)
+            {
+                if (preRollSamples > 0)
+                    preRoll.release();
+
+                return;
+            }
+
+            const auto numChannels = (int)writer->getNumChannels();
+            const auto rate = writer->getSampleRate();
+
+            // The pre-roll is written out ahead of the first live block, on the background thread
+            if (preRollSamples > 0)
+                writer = std::make_unique<PreRollAudioFormatWriter>(std::move(writer), preRoll, &thumbnail);
+
+            // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
+            // write the data to disk on our background thread.
+            threadedWriter.reset(new AudioFormatWriter::ThreadedWriter(writer.release(), backgroundThread, 32768));
+
+            // Reset our recording thumbnail
+            thumbnailFeeder.reset(numChannels, rate, preRollSamples);
+            startPosition = mediaClockStartSample;
+            actualStartPosition = -1;
+            recordingPreRoll = preRollSamples;
+
+            // And now, swap over our active writer pointer so that the audio callback will start using it..
+            activeWriter = threadedWriter.get();
+        }
+
+        struct RetiredWriter
+        {
+            std::unique_ptr<AudioFormatWriter::ThreadedWriter> writer;
+            uint64 epoch;
+        };
+
+        CriticalSection retiredLock; // (only ever taken by the message thread and the background thread)
+        std::vector<RetiredWriter> retiredWriters;
+
+        bool callbackHasLeft(uint64 epoch) const
+        {
+            return (epoch & 1) == 0 || callbackEpoch.load() != epoch;
+        }
+
+        void waitForCallbackToFinish() const
+        {
+            const auto epoch = callbackEpoch.load();
+
+            while (!callbackHasLeft(epoch))
+                Thread::yield();
+        }
+
+        int useTimeSlice() override
+        {
+            std::vector<RetiredWriter> toDelete;
+
+            {
+                const ScopedLock sl(retiredLock);
+
+                for (auto it = retiredWriters.begin(); it != retiredWriters.end();)
+                {
+                    if (callbackHasLeft(it->epoch))
+                    {
+                        toDelete.push_back(std::move(*it));
+                        it = retiredWriters.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+
+                if (toDelete.empty())
+                    return retiredWriters.empty() ? 100 : 1;
+            }
+
+            toDelete.clear(); // (flushes and closes the files, outside the lock)
+            return 1;
+        }
     };
 
     //==============================================================================
@@ -251,6 +502,15 @@ namespace juce {
 
         AudioThumbnail& getAudioThumbnail() { return thumbnail; }
 
+        /** Shows a finished recording, straight from the disk cache if it's been shown before
+            and hasn't changed since.
+        */
+        void setFile(const File& file)
+        {
+            thumbnail.setSource(PersistentThumbnailCache::createSourceFor(file));
+            setDisplayFullThumbnail(true);
+        }
+
         void setDisplayFullThumbnail(bool displayFull)
         {
             displayFullThumb = displayFull;
@@ -279,8 +539,8 @@ namespace juce {
 
     private:
         AudioFormatManager formatManager;
-        AudioThumbnailCache thumbnailCache{ 10 };
-        AudioThumbnail thumbnail{ 512, formatManager, thumbnailCache };
+        PersistentThumbnailCache thumbnailCache{ 10, PersistentThumbnailCache::getDefaultDirectory() };
+        MipmappedAudioThumbnail thumbnail{ 512, formatManager, thumbnailCache }; // (so long recordings zoomed out stay cheap to draw)
 
         bool displayFullThumb = false;
 
@@ -315,6 +575,12 @@ namespace juce {
             explanationLabel.setEditable(false, false, false);
             explanationLabel.setColour(TextEditor::textColourId, Colours::white);
 
+            addAndMakeVisible(meterWall);
+            audioDeviceManager.addAudioCallback(&meterWall);
+
+            addAndMakeVisible(spectrumAnalyser);
+            audioDeviceManager.addAudioCallback(&spectrumAnalyser);
+
 #ifndef JUCE_DEMO_RUNNER
             RuntimePermissions::request(RuntimePermissions::recordAudio,
                 [this](bool granted)
@@ -324,11 +590,13 @@ namespace juce {
                 });
 #endif
 
-            setSize(410, 520);
+            setSize(410, 640);
         }
 
         ~AudioRecordingDemo() override
         {
+            audioDeviceManager.removeAudioCallback(&spectrumAnalyser);
+            audioDeviceManager.removeAudioCallback(&meterWall);
         }
 
         void paint(Graphics& g) override
@@ -343,8 +611,11 @@ namespace juce {
             if (audioSetupComp != nullptr) 
                 audioSetupComp->setBounds(Rectangle<int>(10, 10, 400, 400));
 
+            meterWall.setBounds(Rectangle<int>(10, 415, 400, 70));
+            spectrumAnalyser.setBounds(Rectangle<int>(10, 490, 400, 120));
+
             explanationLabel.setText("",NotificationType::dontSendNotification);
-            explanationLabel.setBounds(Rectangle<int>(10, 490, 400, 20));
+            explanationLabel.setBounds(Rectangle<int>(10, 615, 400, 20));
            
         }
 
@@ -356,6 +627,8 @@ namespace juce {
         AudioDeviceManager& audioDeviceManager{ getSharedAudioDeviceManager(1, 0) };
 #endif
         std::unique_ptr<AudioDeviceSelectorComponent> audioSetupComp;
+        MeterWall meterWall;
+        SpectrumAnalyserComponent spectrumAnalyser;
 
         AudioIODeviceType* deviceType;
         Label explanationLabel{ {}, "Initializing Dante...\n"
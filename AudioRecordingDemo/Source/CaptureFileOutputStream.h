@@ -0,0 +1,547 @@
+#pragma once
+#include <JuceHeader.h>
+
+#if JUCE_WINDOWS
+ #include <winsock2.h>
+ #include <windows.h>
+#else
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <cerrno>
+#endif
+
+//==============================================================================
+/*  Counts how long a thread spent in calls that are supposed to be quick, in
+    buckets from 0.1ms up to 50ms and over. Any number of threads can record,
+    and getSnapshot() can be called from anywhere.
+*/
+class StallHistogram
+{
+public:
+    static constexpr int numBuckets = 10;
+
+    /** The upper limit of each bucket but the last, which has no limit. */
+    static double getBucketLimitMs(int bucket) noexcept
+    {
+        static const double limits[numBuckets - 1] = { 0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 50.0 };
+        return limits[bucket];
+    }
+
+    struct Snapshot
+    {
+        std::array<int64, numBuckets> counts{};
+        int64 total = 0;
+        double maxMs = 0.0;
+
+        /** The number of calls that took at least the given time, rounded down to a bucket limit. */
+        int64 countAtLeast(double ms) const
+        {
+            int64 n = 0;
+
+            for (int i = numBuckets - 1; i >= 0 && (i == 0 || getBucketLimitMs(i - 1) >= ms); --i)
+                n += counts[(size_t)i];
+
+            return n;
+        }
+
+        void add(const Snapshot& other)
+        {
+            for (size_t i = 0; i < counts.size(); ++i)
+                counts[i] += other.counts[i];
+
+            total += other.total;
+            maxMs = jmax(maxMs, other.maxMs);
+        }
+
+        String toString() const
+        {
+            StringArray parts;
+
+            for (int i = 0; i < numBuckets; ++i)
+                parts.add((i < numBuckets - 1 ? "<" + String(getBucketLimitMs(i)) : ">=" + String(getBucketLimitMs(numBuckets - 2)))
+                          + "ms: " + String(counts[(size_t)i]));
+
+            return parts.joinIntoString(", ") + " (max " + String(maxMs, 2) + "ms)";
+        }
+    };
+
+    StallHistogram() { reset(); }
+
+    void record(double ms) noexcept
+    {
+        int bucket = 0;
+
+        while (bucket < numBuckets - 1 && ms >= getBucketLimitMs(bucket))
+            ++bucket;
+
+        counts[(size_t)bucket].fetch_add(1, std::memory_order_relaxed);
+
+        const auto us = (int64)(ms * 1000.0);
+        auto previous = maxMicroseconds.load(std::memory_order_relaxed);
+
+        while (us > previous && !maxMicroseconds.compare_exchange_weak(previous, us, std::memory_order_relaxed)) {}
+    }
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot s;
+
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            s.counts[i] = counts[i].load(std::memory_order_relaxed);
+            s.total += s.counts[i];
+        }
+
+        s.maxMs = (double)maxMicroseconds.load(std::memory_order_relaxed) / 1000.0;
+        return s;
+    }
+
+    void reset()
+    {
+        for (auto& c : counts)
+            c = 0;
+
+        maxMicroseconds = 0;
+    }
+
+private:
+    std::array<std::atomic<int64>, numBuckets> counts;
+    std::atomic<int64> maxMicroseconds;
+
+    JUCE_DECLARE_NON_COPYABLE(StallHistogram)
+};
+
+//==============================================================================
+/*  A seekable OutputStream for long captures, meant to sit underneath an
+    AudioFormatWriter in place of a FileOutputStream.
+
+    Disk space is reserved ahead of the data in large chunks (fallocate on Linux,
+    the allocation size on Windows), so extending the file doesn't keep going back
+    to the filesystem for new extents. Everything is written with positional I/O
+    from one aligned buffer, in whole multiples of the alignment, which also makes
+    it possible to bypass the page cache altogether with directIO (O_DIRECT, or
+    FILE_FLAG_NO_BUFFERING on Windows).
+
+    Seeking back, as the writer does to fix up the header sizes when it is closed,
+    reads the affected blocks back into the buffer first, so partial blocks are
+    never clobbered. On close the file is cut back to the length that was actually
+    written, which also gives back any space that was reserved but not used.
+
+    Every call that goes to the OS is timed into a StallHistogram.
+*/
+class CaptureFileOutputStream : public OutputStream
+{
+public:
+    struct Options
+    {
+        int64 preallocateBytes = 256 << 20; // reserved ahead of the data each time it runs out, 0 to disable
+        int bufferBytes = 1 << 20;          // rounded up to a multiple of the alignment
+        int alignment = 4096;               // a power of two, at least the device's sector size if using directIO
+        bool directIO = false;              // bypass the page cache, if the filesystem allows it
+    };
+
+    struct Stats
+    {
+        int64 bytesWritten = 0;             // as issued to the OS, including padding that gets overwritten later
+        int64 numWrites = 0;
+        int64 numPreallocations = 0;
+        bool preallocating = false;         // false if preallocation is disabled or not supported here
+        bool directIO = false;              // false if it was asked for but the filesystem refused
+        StallHistogram::Snapshot ioStalls;
+    };
+
+    /** Creates (or truncates) the file. If a histogram is passed in, stalls are
+        recorded there instead of in this stream's own one, so several streams
+        written from the same thread can share it. It must outlive the stream.
+    */
+    CaptureFileOutputStream(const File& fileToWriteTo, const Options& optionsToUse,
+                            StallHistogram* sharedStallHistogram = nullptr)
+        : file(fileToWriteTo),
+          options(optionsToUse),
+          stalls(sharedStallHistogram != nullptr ? *sharedStallHistogram : ownStalls)
+    {
+        jassert(isPowerOfTwo(options.alignment));
+
+        bufferSize = roundUp((int64)jmax(options.bufferBytes, options.alignment));
+        rawBuffer.calloc((size_t)(bufferSize + options.alignment));
+        buffer = reinterpret_cast<char*>((reinterpret_cast<pointer_sized_uint>(rawBuffer.get()) + (pointer_sized_uint)(options.alignment - 1))
+                                         & ~(pointer_sized_uint)(options.alignment - 1));
+
+        status = openHandle();
+        preallocating = status.wasOk() && options.preallocateBytes > 0; // (the first chunk is reserved by the first write)
+    }
+
+    ~CaptureFileOutputStream() override
+    {
+        close();
+    }
+
+    const File& getFile() const noexcept { return file; }
+    const Result& getStatus() const noexcept { return status; }
+    bool openedOk() const noexcept { return status.wasOk(); }
+    bool failedToOpen() const noexcept { return status.failed(); }
+
+    Stats getStats() const
+    {
+        Stats s;
+        s.bytesWritten = bytesWritten.load();
+        s.numWrites = numWrites.load();
+        s.numPreallocations = numPreallocations.load();
+        s.preallocating = preallocating.load();
+        s.directIO = usingDirectIO;
+        s.ioStalls = stalls.getSnapshot();
+        return s;
+    }
+
+    /** Writes out the buffer, trims the file to its real length and closes it.
+        Called by the destructor, so it's only needed to find out whether it worked.
+    */
+    bool close()
+    {
+        if (!isOpen())
+            return status.wasOk();
+
+        auto ok = flushBuffer();
+
+        if (ok && (physicalEnd > fileLength || reservedEnd > fileLength))
+            ok = truncateTo(fileLength);
+
+        closeHandle();
+
+        if (!ok && status.wasOk())
+            status = Result::fail("Failed to finish writing " + file.getFullPathName());
+
+        return ok;
+    }
+
+    //==============================================================================
+    int64 getPosition() override
+    {
+        return bufferStart + cursor;
+    }
+
+    /** Seeking is allowed anywhere up to the current end of the file. */
+    bool setPosition(int64 newPosition) override
+    {
+        if (!isOpen() || newPosition < 0 || newPosition > fileLength)
+            return false;
+
+        if (newPosition < bufferStart || newPosition > bufferStart + bufferSize)
+            if (!moveBuffer(newPosition & ~(int64)(options.alignment - 1)))
+                return false;
+
+        cursor = newPosition - bufferStart;
+        return true;
+    }
+
+    bool write(const void* data, size_t numBytes) override
+    {
+        if (!isOpen())
+            return false;
+
+        auto* source = static_cast<const char*>(data);
+
+        while (numBytes > 0)
+        {
+            if (cursor == bufferSize && !moveBuffer(bufferStart + bufferSize))
+                return false;
+
+            const auto num = (int64)jmin((int64)numBytes, bufferSize - cursor);
+            memcpy(buffer + cursor, source, (size_t)num);
+
+            dirtyStart = jmin(dirtyStart, cursor);
+            dirtyEnd = jmax(dirtyEnd, cursor + num);
+            cursor += num;
+            validBytes = jmax(validBytes, cursor);
+            fileLength = jmax(fileLength, bufferStart + validBytes);
+
+            source += num;
+            numBytes -= (size_t)num;
+        }
+
+        return true;
+    }
+
+    /** Hands the buffered data to the OS. This doesn't wait for it to reach the disk
+        unless directIO is in use.
+    */
+    void flush() override
+    {
+        if (isOpen())
+            flushBuffer();
+    }
+
+private:
+    File file;
+    Options options;
+    Result status{ Result::ok() };
+    StallHistogram ownStalls;
+    StallHistogram& stalls;
+
+    HeapBlock<char> rawBuffer;
+    char* buffer = nullptr;
+
+    // The buffer holds the aligned stretch of file starting at bufferStart; everything
+    // in it below validBytes matches what the file holds (or will, once it's flushed)
+    int64 bufferSize = 0, bufferStart = 0, cursor = 0, validBytes = 0;
+    int64 dirtyStart = std::numeric_limits<int64>::max(), dirtyEnd = 0;
+    int64 fileLength = 0, physicalEnd = 0, reservedEnd = 0;
+    bool usingDirectIO = false;
+
+    std::atomic<int64> bytesWritten{ 0 }, numWrites{ 0 }, numPreallocations{ 0 };
+    std::atomic<bool> preallocating{ false };
+
+   #if JUCE_WINDOWS
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    bool isOpen() const noexcept { return handle != INVALID_HANDLE_VALUE; }
+   #else
+    int fd = -1;
+    bool isOpen() const noexcept { return fd >= 0; }
+   #endif
+
+    int64 roundUp(int64 n) const noexcept
+    {
+        return (n + options.alignment - 1) & ~(int64)(options.alignment - 1);
+    }
+
+    double msSince(int64 startTicks) const
+    {
+        return Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - startTicks) * 1000.0;
+    }
+
+    bool flushBuffer()
+    {
+        if (dirtyEnd <= dirtyStart)
+            return true;
+
+        const auto from = dirtyStart & ~(int64)(options.alignment - 1);
+        const auto to = roundUp(dirtyEnd);
+
+        if (validBytes < to)
+            zeromem(buffer + validBytes, (size_t)(to - validBytes)); // (cut off again when the file is closed)
+
+        ensureReserved(bufferStart + to);
+
+        const auto start = Time::getHighResolutionTicks();
+        const auto ok = writeAt(bufferStart + from, buffer + from, (size_t)(to - from));
+        stalls.record(msSince(start));
+
+        if (!ok)
+            return false;
+
+        bytesWritten += to - from;
+        ++numWrites;
+        physicalEnd = jmax(physicalEnd, bufferStart + to);
+        dirtyStart = std::numeric_limits<int64>::max();
+        dirtyEnd = 0;
+        return true;
+    }
+
+    bool moveBuffer(int64 newStart)
+    {
+        if (!flushBuffer())
+            return false;
+
+        bufferStart = newStart;
+        cursor = 0;
+        validBytes = jmin(bufferSize, jmax((int64)0, fileLength - newStart));
+
+        if (validBytes == 0)
+            return true;
+
+        // Some of this stretch has been written before, so read it back in first
+        const auto start = Time::getHighResolutionTicks();
+        const auto ok = readAt(newStart, buffer, (size_t)roundUp(validBytes));
+        stalls.record(msSince(start));
+        return ok;
+    }
+
+    void ensureReserved(int64 end)
+    {
+        if (!preallocating.load() || end <= reservedEnd)
+            return;
+
+        const auto newEnd = end + options.preallocateBytes;
+        const auto start = Time::getHighResolutionTicks();
+
+        if (reserve(reservedEnd, newEnd))
+        {
+            reservedEnd = newEnd;
+            ++numPreallocations;
+        }
+        else
+        {
+            preallocating = false; // (the filesystem can't do it, so stop asking)
+        }
+
+        stalls.record(msSince(start));
+    }
+
+    //==============================================================================
+   #if JUCE_WINDOWS
+    Result openHandle()
+    {
+        const auto flags = FILE_ATTRIBUTE_NORMAL | (options.directIO ? FILE_FLAG_NO_BUFFERING : 0);
+
+        handle = CreateFileW(file.getFullPathName().toWideCharPointer(), GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ, nullptr, CREATE_ALWAYS, flags, nullptr);
+
+        if (handle == INVALID_HANDLE_VALUE)
+            return Result::fail("Couldn't open " + file.getFullPathName() + " (error " + String((int)GetLastError()) + ")");
+
+        usingDirectIO = options.directIO;
+        return Result::ok();
+    }
+
+    void closeHandle()
+    {
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+    }
+
+    static OVERLAPPED overlappedFor(int64 position)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)position;
+        overlapped.OffsetHigh = (DWORD)(position >> 32);
+        return overlapped;
+    }
+
+    bool writeAt(int64 position, const char* data, size_t numBytes)
+    {
+        auto overlapped = overlappedFor(position);
+        DWORD written = 0;
+        return WriteFile(handle, data, (DWORD)numBytes, &written, &overlapped) && written == (DWORD)numBytes;
+    }
+
+    /** Anything past the end of the file comes back as zeros, so a short read can't leave
+        stale bytes in the buffer to be written back later.
+    */
+    bool readAt(int64 position, char* data, size_t numBytes)
+    {
+        auto overlapped = overlappedFor(position);
+        DWORD numRead = 0;
+
+        if (!ReadFile(handle, data, (DWORD)numBytes, &numRead, &overlapped) && GetLastError() != ERROR_HANDLE_EOF)
+            return false;
+
+        if ((size_t)numRead < numBytes)
+            zeromem(data + numRead, numBytes - (size_t)numRead);
+
+        return true;
+    }
+
+    bool reserve(int64, int64 end)
+    {
+        FILE_ALLOCATION_INFO info = {};
+        info.AllocationSize.QuadPart = end;
+        return SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info)) != 0;
+    }
+
+    bool truncateTo(int64 length)
+    {
+        // Whatever is still allocated beyond the end gets released when the handle is closed
+        FILE_END_OF_FILE_INFO info = {};
+        info.EndOfFile.QuadPart = length;
+        return SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info)) != 0;
+    }
+   #else
+    Result openHandle()
+    {
+        const auto path = file.getFullPathName().toRawUTF8();
+        const auto flags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+       #ifdef O_DIRECT
+        if (options.directIO)
+        {
+            fd = open(path, flags | O_DIRECT, 0644);
+            usingDirectIO = fd >= 0;
+        }
+       #endif
+
+        if (fd < 0)
+            fd = open(path, flags, 0644);
+
+        if (fd < 0)
+            return Result::fail("Couldn't open " + file.getFullPathName() + ": " + String(strerror(errno)));
+
+        return Result::ok();
+    }
+
+    void closeHandle()
+    {
+        ::close(fd);
+        fd = -1;
+    }
+
+    bool writeAt(int64 position, const char* data, size_t numBytes)
+    {
+        while (numBytes > 0)
+        {
+            const auto n = pwrite(fd, data, numBytes, (off_t)position);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n <= 0)
+                return false;
+
+            data += n;
+            position += n;
+            numBytes -= (size_t)n;
+        }
+
+        return true;
+    }
+
+    bool readAt(int64 position, char* data, size_t numBytes)
+    {
+        while (numBytes > 0)
+        {
+            const auto n = pread(fd, data, numBytes, (off_t)position);
+
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            if (n < 0)
+                return false;
+
+            if (n == 0)
+            {
+                zeromem(data, numBytes); // (the rest is past the end of the file)
+                break;
+            }
+
+            data += n;
+            position += n;
+            numBytes -= (size_t)n;
+        }
+
+        return true;
+    }
+
+    bool reserve(int64 start, int64 end)
+    {
+       #if JUCE_LINUX
+        // KEEP_SIZE allocates the extents without moving the end of the file, so a crash
+        // leaves nothing after the data
+        return fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)start, (off_t)(end - start)) == 0;
+       #else
+        ignoreUnused(start, end);
+        return false;
+       #endif
+    }
+
+    bool truncateTo(int64 length)
+    {
+        // Shrinking the file is what gives back extents reserved past the end, so if the size
+        // hasn't actually changed, grow it to cover them first
+        if (reservedEnd > jmax(length, physicalEnd) && ftruncate(fd, (off_t)reservedEnd) != 0)
+            return false;
+
+        return ftruncate(fd, (off_t)length) == 0;
+    }
+   #endif
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CaptureFileOutputStream)
+};
@@ -1,4 +1,6 @@
 #include "DanteAudioIODevice.h"
+#include "DanteTransfer.h"
+#include "MediaClock.h"
 #include "juce_audio_devices/juce_audio_devices.h"   
 #include <functional>
 #include <iostream>
@@ -11,27 +13,8 @@ const Audinate::DAL::Id64 APP_MODEL_ID('D', 'A', 'L', 'J', 'U', 'C', 'E','D');
 
 #define DEFAULT_BITS_PER_SAMPLE 16
 #include "access_token.c"
-static bool bufferAllocated = false;
-static bool bufferReady = false;
-static int samplesInBuffers = 0;
-static float** inputBuffers;
-static float** outputBuffers;
-static CriticalSection bufferLock;
+static DanteTransfer transfer;
 static std::ofstream mt("myTransfer.txt", std::ios::out | std::ios::app);
-static AudioIODeviceCallback* callback = nullptr;
-static void convert24BitSignedtoFloat(const uint32_t* from, float* to) 
-{
-    unsigned char* f = (unsigned char*)from;
-    int32_t it;
-    unsigned char* t = (unsigned char*)&it;
-    t[3] = 0x00;
-    char tc = f[3] >> 7;
-    if (tc == 0x01) t[3] = 0xff;
-    t[0] = f[1];
-    t[1] = f[2];
-    t[2] = f[3];
-    *to = (float)it / 8388607.0f;
-}
 static void printStatus(std::ofstream& mt, String sa, int a)
 {
     mt << sa << "=" << String(a) << std::endl << std::flush;
@@ -40,48 +23,13 @@ static void myTransfer(const Audinate::DAL::AudioProperties& properties,
     const Audinate::DAL::AudioTransferParameters& params,
     unsigned int numChannels, unsigned int latencySamples)
 {
-
-    if (!bufferAllocated) return;
-
     try 
     {
-        unsigned int positionSamples =
-            (params.mAvailableDataOffsetInPeriods * properties.mSamplesPerPeriod)
-            % properties.mSamplesPerBuffer;
-        unsigned int numSamples = params.mNumPeriodsAvailable * properties.mSamplesPerPeriod;
-      
-        //printStatus(mt, "numSamples", numSamples);
-
-        uint32_t samplesLeft = numSamples;
-        int i = samplesInBuffers;
-
-        while (i < numSamples)
-        {
-            for (size_t chan = 0; chan < numChannels; chan++)
-            {
-                const uint32_t* bufferPtr = reinterpret_cast<const uint32_t*>(properties.mRxChannelBuffers[chan] +
-                    (positionSamples % properties.mSamplesPerBuffer) * 4);
-                convert24BitSignedtoFloat(bufferPtr,&inputBuffers[chan][i]);
-            }
-            positionSamples++;
-            i++;
-        }
-        samplesInBuffers += numSamples;
-        if ((callback != nullptr))
-        {
-            callback->audioDeviceIOCallbackWithContext(const_cast<const float**> (inputBuffers),
-                properties.mRxActivatedChannelCount,
-                outputBuffers,
-                properties.mTxActivatedChannelCount,
-                samplesInBuffers,
-                {});
-            samplesInBuffers = 0;
-        }
-        
+        transfer.process(properties, params);
     }
     catch (const std::exception& exception)
     {
-        bufferAllocated = false;
+        transfer.release();
     }
     return;
 }
@@ -208,6 +156,8 @@ void DanteAudioIODevice::close()
     signalThreadShouldExit();
 
     stopThread(5000);
+    transfer.release();
+    transfer.setCoarseClock(nullptr);
 
     isOpen_ = false;
 };
@@ -226,8 +176,8 @@ void DanteAudioIODevice::start(AudioIODeviceCallback* call)
 
         call->audioDeviceAboutToStart(this);
 
-        const ScopedLock sl(bufferLock);
-        callback = call;
+        currentCallback = call;
+        transfer.setCallback(call);
         isStarted = true;
     }
 };
@@ -235,12 +185,11 @@ void DanteAudioIODevice::stop()
 {
     if (isStarted)
     {
-        auto* callbackLocal = callback;
+        auto* callbackLocal = currentCallback;
 
-        {
-            const ScopedLock sl(bufferLock);
-            isStarted = false;
-        }
+        transfer.setCallback(nullptr);
+        currentCallback = nullptr;
+        isStarted = false;
 
         if (callbackLocal != nullptr)
             callbackLocal->audioDeviceStopped();
@@ -267,22 +216,16 @@ void DanteAudioIODevice::run()
         mOutputChannels.setBit(i);
     }
 
-    inputBuffers = new float* [properties.mRxActivatedChannelCount];
-    for (int i = 0; i < properties.mRxActivatedChannelCount; i++)
-    {
-        inputBuffers[i] = new float[(mBufferSizeSamples * properties.mPeriodsPerBuffer) + 32];
-    }
-    outputBuffers = new float* [properties.mTxActivatedChannelCount];
-    for (int i = 0; i < properties.mTxActivatedChannelCount; i++)
-    {
-        outputBuffers[i] = new float[(mBufferSizeSamples * properties.mPeriodsPerBuffer) + 32];
-    }
-    bufferAllocated = true;
-    bufferReady = false;
-    samplesInBuffers = 0;
+    transfer.setCoarseClock([this] { return getMediaClockPositionForTime(Time::getCurrentTime()); });
+    transfer.prepare(properties.mRxActivatedChannelCount, properties.mTxActivatedChannelCount, mBufferSizeSamples);
     return;
 }
 
+int64 DanteAudioIODevice::getBlockMediaClockPosition() const { return transfer.getBlockPosition(); };
+int64 DanteAudioIODevice::getMediaClockPositionForTime(Time time) const
+{
+    return MediaClock::getPositionForTime(time, mSampleRate);
+};
 String DanteAudioIODevice::getLastError() { return ""; };
 int DanteAudioIODevice::getCurrentBufferSizeSamples() { return mBufferSizeSamples; };
 double DanteAudioIODevice::getCurrentSampleRate() { return mSampleRate; };
@@ -295,6 +238,6 @@ bool DanteAudioIODevice::setAudioPreprocessingEnabled(bool shouldBeEnabled) {
     return false;
 };
 int DanteAudioIODevice::getXRunCount() const noexcept {
-    return 0;
+    return transfer.getStats().xruns;
 };
 
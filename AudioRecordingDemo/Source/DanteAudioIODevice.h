@@ -40,6 +40,18 @@ class DanteAudioIODevice : public AudioIODevice, public Thread {
 public:
     DanteAudioIODevice(const String& deviceName);
     ~DanteAudioIODevice();
+
+    /** Media-clock sample position of the first sample in the block that is currently
+        being passed to the callback. Only valid from inside the audio callback.
+    */
+    int64 getBlockMediaClockPosition() const;
+
+    /** Converts a wall-clock time to a media-clock sample position. Dante's media clock
+        runs on PTP time, so hosts whose system clocks are disciplined by the same PTP
+        (or NTP) source agree on this, which is how separate machines pick a common
+        sample index to start recording at.
+    */
+    int64 getMediaClockPositionForTime(Time time) const;
 private:
     int actualNumChannels = 0;
     BigInteger mInputChannels;
@@ -51,6 +63,7 @@ private:
     DAL::DalAppBase* inputDevice = nullptr;
     DAL::DalAppBase* outputDevice = nullptr;
     bool isOpen_ = false, isStarted = false;
+    AudioIODeviceCallback* currentCallback = nullptr;
     int currentBufferSizeSamples = 0;
     double currentSampleRate = 0;
     std::atomic<bool> shouldShutdown{ false }, deviceSampleRateChanged{ false };
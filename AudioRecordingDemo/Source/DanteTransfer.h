@@ -0,0 +1,333 @@
+#pragma once
+#include <JuceHeader.h>
+
+//==============================================================================
+/*  Moves received audio out of the DAL rx ring and into float blocks for an
+    AudioIODeviceCallback.
+
+    Nothing in here depends on the DAL SDK: process() is a template over anything
+    that has the same members as Audinate::DAL::AudioProperties and
+    Audinate::DAL::AudioTransferParameters, so the same code runs against a live
+    DAL instance or against the fake rings in DanteTransferFaultInjector.h.
+
+    The ring offset handed over by DAL is tracked from one transfer to the next.
+    Periods that are offered twice are skipped, holes are counted as xruns and
+    reported in getStats(), and anything that can't be explained either way
+    re-anchors the stream and is counted as a resync.
+
+    Every block also gets an absolute media-clock sample position. The ring index
+    only gives that position modulo the ring length, so whenever the stream is
+    anchored the wrap is chosen to be the one nearest to a coarse clock (see
+    setCoarseClock()). From then on the position just counts samples and holes.
+
+    process() runs on the DAL audio thread and never takes a lock. The callback,
+    the buffers and the coarse clock are published to it together through an
+    atomic pointer, and a transfer counter is odd while process() is running. So
+    the message thread swaps a new setup in and, if a transfer is under way, waits
+    for just that one to finish before freeing the old setup. Once prepare(),
+    release(), setCallback() or setCoarseClock() returns, nothing from before it
+    is used any more.
+*/
+class DanteTransfer
+{
+public:
+    struct Stats
+    {
+        int64 deliveredSamples = 0; // samples passed on to the callback
+        int64 droppedSamples = 0;   // samples skipped over by a hole in the ring offset
+        int64 repeatedSamples = 0;  // samples offered again by DAL and ignored
+        int xruns = 0;              // holes plus resyncs
+        int resyncs = 0;            // times the ring position had to be re-anchored
+    };
+
+    DanteTransfer() = default;
+
+    ~DanteTransfer()
+    {
+        release();
+    }
+
+    void prepare(int numInputChannels, int numOutputChannels, int maxBlockSizeSamples)
+    {
+        numInputs = numInputChannels;
+        numOutputs = numOutputChannels;
+        blockSize = maxBlockSizeSamples;
+        prepared = true;
+        resyncRequested = true;
+        publish();
+    }
+
+    void release()
+    {
+        prepared = false;
+        publish();
+    }
+
+    /** Forgets the current ring position, e.g. after the DAL instance has been
+        restarted. The next transfer re-anchors and is counted as a resync.
+    */
+    void reset()
+    {
+        resyncRequested = true;
+    }
+
+    void setCallback(AudioIODeviceCallback* newCallback)
+    {
+        callback = newCallback;
+        publish();
+    }
+
+    Stats getStats() const
+    {
+        Stats s;
+        s.deliveredSamples = deliveredSamples.load();
+        s.droppedSamples = droppedSamples.load();
+        s.repeatedSamples = repeatedSamples.load();
+        s.xruns = xruns.load();
+        s.resyncs = resyncs.load();
+        return s;
+    }
+
+    /** Supplies a rough estimate of the current media-clock sample, e.g. from a
+        PTP-disciplined system clock. It only needs to be right to within half the
+        ring (about 85ms for 64 periods of 128 samples at 48kHz) and is only called
+        when the stream is anchored. Without one, positions start at the ring index.
+    */
+    void setCoarseClock(std::function<int64()> clockToUse)
+    {
+        coarseClock = std::move(clockToUse);
+        publish();
+    }
+
+    /** The media-clock position of the first sample of the block currently being
+        passed to the callback. Only meaningful when called from inside the callback.
+    */
+    int64 getBlockPosition() const noexcept { return blockPosition.load(); }
+
+    /** DAL delivers 24-bit samples left-justified in a 32-bit little-endian word. */
+    static float dante24ToFloat(uint32 word) noexcept
+    {
+        return (float)((int32)word >> 8) / 8388607.0f;
+    }
+
+    //==============================================================================
+    template <typename Properties, typename Params>
+    void process(const Properties& properties, const Params& params)
+    {
+        const ScopedTransfer transfer(transferCount);
+        auto* setup = current.load();
+
+        if (setup == nullptr || properties.mSamplesPerPeriod == 0)
+            return;
+
+        if (resyncRequested.load() && resyncRequested.exchange(false))
+            needsResync = true;
+
+        const auto samplesPerPeriod = (uint32)properties.mSamplesPerPeriod;
+        const auto periodsPerBuffer = (uint32)properties.mSamplesPerBuffer / samplesPerPeriod;
+
+        if (periodsPerBuffer == 0)
+            return;
+
+        auto offset = (uint32)(params.mAvailableDataOffsetInPeriods % periodsPerBuffer);
+        auto numPeriods = (uint32)params.mNumPeriodsAvailable;
+
+        // More than a whole ring's worth means the oldest periods were already overwritten,
+        // so start at the oldest one still there and let the check below count the hole
+        if (numPeriods > periodsPerBuffer)
+        {
+            offset = (offset + numPeriods - periodsPerBuffer) % periodsPerBuffer;
+            numPeriods = periodsPerBuffer;
+        }
+
+        if (needsResync)
+        {
+            if (hasAnchor)
+            {
+                ++resyncs;
+                ++xruns;
+            }
+
+            anchor(*setup, offset * samplesPerPeriod, (uint32)properties.mSamplesPerBuffer);
+            needsResync = false;
+        }
+        else if (offset != nextPeriod)
+        {
+            const auto ahead = (offset + periodsPerBuffer - nextPeriod) % periodsPerBuffer;
+            const auto behind = periodsPerBuffer - ahead;
+
+            if (ahead <= periodsPerBuffer / 2)
+            {
+                noteHole(ahead * samplesPerPeriod);
+            }
+            else if (behind < numPeriods)
+            {
+                // DAL re-offered some periods we've already passed on, skip those
+                repeatedSamples += (int64)behind * samplesPerPeriod;
+                offset = nextPeriod;
+                numPeriods -= behind;
+            }
+            else if (behind == numPeriods)
+            {
+                // Nothing new in this transfer, only the periods we've just seen
+                repeatedSamples += (int64)numPeriods * samplesPerPeriod;
+                return;
+            }
+            else
+            {
+                // Jumped back into data that can't be a repeat: start again from here
+                ++resyncs;
+                ++xruns;
+                anchor(*setup, offset * samplesPerPeriod, (uint32)properties.mSamplesPerBuffer);
+            }
+        }
+
+        deliver(*setup, properties, offset * samplesPerPeriod, (int)(numPeriods * samplesPerPeriod));
+        nextPeriod = (offset + numPeriods) % periodsPerBuffer;
+    }
+
+private:
+    /** Everything process() needs from the message thread, swapped in as a whole. */
+    struct Setup
+    {
+        AudioIODeviceCallback* callback = nullptr;
+        std::function<int64()> coarseClock;
+        AudioBuffer<float> inputBuffer, outputBuffer;
+        int numInputs = 0, numOutputs = 0, blockSize = 0;
+    };
+
+    /** Keeps transferCount odd for as long as process() is running, even if it throws. */
+    struct ScopedTransfer
+    {
+        explicit ScopedTransfer(std::atomic<uint32>& c) noexcept : count(c)    { ++count; }
+        ~ScopedTransfer()                                                       { ++count; }
+
+        std::atomic<uint32>& count;
+    };
+
+    // Owned by the message thread
+    AudioIODeviceCallback* callback = nullptr;
+    std::function<int64()> coarseClock;
+    int numInputs = 0, numOutputs = 0, blockSize = 0;
+    bool prepared = false;
+    std::unique_ptr<Setup> owned;
+
+    // Shared with the audio thread
+    std::atomic<Setup*> current{ nullptr };
+    std::atomic<uint32> transferCount{ 0 };
+    std::atomic<bool> resyncRequested{ true };
+    std::atomic<int64> blockPosition{ -1 };
+
+    // Owned by the audio thread
+    bool hasAnchor = false, needsResync = true;
+    uint32 nextPeriod = 0;
+    int64 nextSamplePosition = 0;
+
+    std::atomic<int64> deliveredSamples{ 0 }, droppedSamples{ 0 }, repeatedSamples{ 0 };
+    std::atomic<int> xruns{ 0 }, resyncs{ 0 };
+
+    /** Swaps in a setup made from the current settings, or none if not prepared, and frees
+        the old one once no transfer can still be using it.
+    */
+    void publish()
+    {
+        std::unique_ptr<Setup> setup;
+
+        if (prepared)
+        {
+            setup = std::make_unique<Setup>();
+            setup->callback = callback;
+            setup->coarseClock = coarseClock;
+            setup->inputBuffer.setSize(jmax(1, numInputs), blockSize);
+            setup->outputBuffer.setSize(jmax(1, numOutputs), blockSize);
+            setup->numInputs = numInputs;
+            setup->numOutputs = numOutputs;
+            setup->blockSize = blockSize;
+        }
+
+        current = setup.get();
+        std::swap(owned, setup);
+
+        // (a transfer that started after the swap can only see the new setup)
+        const auto count = transferCount.load();
+
+        if ((count & 1) != 0)
+            while (transferCount.load() == count)
+                Thread::yield();
+    }
+
+    void noteHole(uint32 numSamples)
+    {
+        droppedSamples += numSamples;
+        nextSamplePosition += numSamples;
+        ++xruns;
+    }
+
+    void anchor(const Setup& setup, uint32 ringSample, uint32 samplesPerBuffer)
+    {
+        const auto estimate = setup.coarseClock != nullptr ? setup.coarseClock()
+                                                     : (hasAnchor ? nextSamplePosition : (int64)ringSample);
+        const auto ringLength = (int64)samplesPerBuffer;
+        const auto distance = estimate - (int64)ringSample + ringLength / 2;
+        const auto wrap = distance >= 0 ? distance / ringLength
+                                        : -((ringLength - 1 - distance) / ringLength);
+
+        nextSamplePosition = wrap * ringLength + (int64)ringSample;
+        hasAnchor = true;
+    }
+
+    template <typename Properties>
+    void deliver(Setup& setup, const Properties& properties, uint32 ringPosition, int numSamples)
+    {
+        auto& inputBuffer = setup.inputBuffer;
+        auto& outputBuffer = setup.outputBuffer;
+        const auto numInputs = setup.numInputs;
+        const auto numOutputs = setup.numOutputs;
+        const auto blockSize = setup.blockSize;
+        const auto samplesPerBuffer = (uint32)properties.mSamplesPerBuffer;
+        const auto numActive = jmin(numInputs, (int)properties.mRxActivatedChannelCount);
+
+        for (int done = 0; done < numSamples;)
+        {
+            const auto num = jmin(blockSize, numSamples - done);
+
+            for (int chan = 0; chan < numInputs; ++chan)
+            {
+                auto* dest = inputBuffer.getWritePointer(chan);
+
+                if (chan >= numActive)
+                {
+                    FloatVectorOperations::clear(dest, num);
+                    continue;
+                }
+
+                auto* ring = reinterpret_cast<const uint32*>(properties.mRxChannelBuffers[chan]);
+                auto pos = ringPosition;
+
+                for (int i = 0; i < num; ++i)
+                {
+                    dest[i] = dante24ToFloat(ring[pos]);
+
+                    if (++pos == samplesPerBuffer)
+                        pos = 0;
+                }
+            }
+
+            outputBuffer.clear(0, num);
+
+            blockPosition = nextSamplePosition;
+
+            if (setup.callback != nullptr)
+                setup.callback->audioDeviceIOCallbackWithContext(inputBuffer.getArrayOfReadPointers(), numInputs,
+                                                           outputBuffer.getArrayOfWritePointers(), numOutputs,
+                                                           num, {});
+
+            deliveredSamples += num;
+            nextSamplePosition += num;
+            ringPosition = (ringPosition + (uint32)num) % samplesPerBuffer;
+            done += num;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DanteTransfer)
+};
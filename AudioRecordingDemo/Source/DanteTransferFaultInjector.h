@@ -0,0 +1,412 @@
+#pragma once
+#include "DanteTransfer.h"
+
+//==============================================================================
+/*  Fault-injection harness for DanteTransfer.
+
+    A FakeRxRing stands in for the DAL receive buffers: it fills every channel with
+    a known pattern, one period at a time, and hands out AudioProperties-shaped
+    descriptions of itself. The FaultInjector plays the part of the DAL audio
+    thread, calling the transfer function once per period and, at a chosen point,
+    drops, repeats, jumps or bunches up the periods it offers, or stops calling
+    for a while the way a deactivated device would.
+
+    A StreamVerifier sits on the other end as the AudioIODeviceCallback. Channel 0
+    of the pattern is a ramp, so every block can be located in the original stream;
+    any jump must match the gap DanteTransfer accounted for in its stats (or a
+    resync it reported), and every sample of every channel must match the pattern.
+    The transfer is given a deliberately wrong coarse clock, and the media-clock
+    position it reports for each block must still be the exact sample index.
+
+    None of this needs the DAL SDK, so it runs anywhere JUCE does. FaultInjectorTests
+    runs every scenario as a UnitTest and fails on any mismatched sample, position
+    or unaccounted gap; the app runs it and exits when it's started with
+    --run-unit-tests, and it joins UnitTestRunner::runAllTests() in builds with
+    JUCE_UNIT_TESTS set.
+*/
+namespace DanteFaults
+{
+    struct FakeAudioProperties
+    {
+        uint32 mSamplesPerPeriod = 0;
+        uint32 mPeriodsPerBuffer = 0;
+        uint32 mSamplesPerBuffer = 0;
+        uint16 mRxActivatedChannelCount = 0;
+        uint16 mTxActivatedChannelCount = 0;
+        std::vector<uint8*> mRxChannelBuffers;
+    };
+
+    struct FakeTransferParameters
+    {
+        uint32 mAvailableDataOffsetInPeriods = 0;
+        uint32 mNumPeriodsAvailable = 0;
+    };
+
+    //==============================================================================
+    class FakeRxRing
+    {
+    public:
+        FakeRxRing(int numChannels, int samplesPerPeriod, int periodsPerBuffer)
+            : storage((size_t)(numChannels * samplesPerPeriod * periodsPerBuffer))
+        {
+            properties.mSamplesPerPeriod = (uint32)samplesPerPeriod;
+            properties.mPeriodsPerBuffer = (uint32)periodsPerBuffer;
+            properties.mSamplesPerBuffer = (uint32)(samplesPerPeriod * periodsPerBuffer);
+            properties.mRxActivatedChannelCount = (uint16)numChannels;
+            properties.mTxActivatedChannelCount = (uint16)numChannels;
+
+            for (int chan = 0; chan < numChannels; ++chan)
+                properties.mRxChannelBuffers.push_back(reinterpret_cast<uint8*>(storage.data() + chan * (int)properties.mSamplesPerBuffer));
+        }
+
+        /** The 24-bit value that sample n of a channel should hold. Channel 0 is a
+            ramp so a receiver can tell where it is in the stream.
+        */
+        static int32 patternFor(int64 sampleIndex, int chan) noexcept
+        {
+            if (chan == 0)
+                return (int32)(sampleIndex & 0x7fffff) - 0x400000;
+
+            auto h = (uint32)(sampleIndex * 2654435761u) ^ (uint32)(chan * 40503u);
+            h ^= h >> 13;
+            return (int32)(h & 0xffffff) - 0x800000;
+        }
+
+        static int64 ramp(float sample) noexcept
+        {
+            return (int64)roundToInt(sample * 8388607.0f) + 0x400000;
+        }
+
+        /** Writes the next period into the ring. Skipping moves the media clock on
+            without the samples in between ever having existed.
+        */
+        void writePeriod(int periodsToSkip = 0)
+        {
+            writePeriodIndex += periodsToSkip;
+            nextSampleIndex += (int64)periodsToSkip * properties.mSamplesPerPeriod;
+
+            const auto spp = (int)properties.mSamplesPerPeriod;
+            const auto ringPos = (int)(writePeriodIndex % properties.mPeriodsPerBuffer) * spp;
+
+            for (int chan = 0; chan < (int)properties.mRxChannelBuffers.size(); ++chan)
+            {
+                auto* dest = reinterpret_cast<uint32*>(properties.mRxChannelBuffers[(size_t)chan]) + ringPos;
+
+                for (int i = 0; i < spp; ++i)
+                    dest[i] = (uint32)patternFor(nextSampleIndex + i, chan) << 8;
+            }
+
+            nextSampleIndex += spp;
+            ++writePeriodIndex;
+        }
+
+        /** Parameters that offer the last numPeriods written, ending olderBy periods ago. */
+        FakeTransferParameters latest(uint32 numPeriods, uint32 olderBy = 0) const
+        {
+            FakeTransferParameters p;
+            p.mAvailableDataOffsetInPeriods = (uint32)((writePeriodIndex - numPeriods - olderBy) % properties.mPeriodsPerBuffer);
+            p.mNumPeriodsAvailable = numPeriods;
+            return p;
+        }
+
+        const FakeAudioProperties& getProperties() const noexcept { return properties; }
+        int64 getNextSampleIndex() const noexcept { return nextSampleIndex; }
+        int64 getPeriodsWritten() const noexcept { return writePeriodIndex; }
+
+    private:
+        std::vector<uint32> storage;
+        FakeAudioProperties properties;
+        int64 writePeriodIndex = 0, nextSampleIndex = 0;
+
+        JUCE_DECLARE_NON_COPYABLE(FakeRxRing)
+    };
+
+    //==============================================================================
+    class StreamVerifier : public AudioIODeviceCallback
+    {
+    public:
+        StreamVerifier(const DanteTransfer& transferToWatch, int numChannelsToCheck)
+            : transfer(transferToWatch), numChannels(numChannelsToCheck) {}
+
+        void audioDeviceAboutToStart(AudioIODevice*) override {}
+        void audioDeviceStopped() override {}
+
+        void audioDeviceIOCallbackWithContext(const float** inputChannelData, int numInputChannels,
+                                              float**, int, int numSamples,
+                                              const AudioIODeviceCallbackContext&) override
+        {
+            const auto stats = transfer.getStats();
+            const auto newlyDropped = stats.droppedSamples - lastStats.droppedSamples;
+            const auto newResyncs = stats.resyncs - lastStats.resyncs;
+            lastStats = stats;
+
+            const auto found = FakeRxRing::ramp(inputChannelData[0][0]);
+            bool blockOk = true;
+
+            if (!started)
+            {
+                started = true;
+                expected = found;
+            }
+            else
+            {
+                const auto jump = (found - (expected & 0x7fffff) + 0x800000) & 0x7fffff;
+
+                if (jump != 0 || newlyDropped != 0)
+                {
+                    if (jump == newlyDropped && newResyncs == 0)
+                        accountedGapSamples += jump;
+                    else if (newResyncs > 0)
+                        resyncGapSamples += jump;
+                    else
+                    {
+                        ++unaccountedJumps;
+                        blockOk = false;
+                    }
+
+                    expected += jump;
+                    continuousBlocks = 0;
+                }
+            }
+
+            if (transfer.getBlockPosition() != expected)
+            {
+                ++positionErrors;
+                blockOk = false;
+            }
+
+            for (int chan = 0; chan < jmin(numChannels, numInputChannels); ++chan)
+            {
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    const auto want = (float)FakeRxRing::patternFor(expected + i, chan) / 8388607.0f;
+
+                    if (inputChannelData[chan][i] != want)
+                    {
+                        ++mismatches;
+                        blockOk = false;
+                    }
+                }
+            }
+
+            samplesChecked += numSamples;
+            expected += numSamples;
+            ++blocksReceived;
+
+            if (blockOk)
+                ++continuousBlocks;
+            else
+                continuousBlocks = 0;
+        }
+
+        const DanteTransfer& transfer;
+        const int numChannels;
+        DanteTransfer::Stats lastStats;
+        bool started = false;
+        int64 expected = 0, samplesChecked = 0, mismatches = 0, unaccountedJumps = 0, positionErrors = 0;
+        int64 accountedGapSamples = 0, resyncGapSamples = 0, blocksReceived = 0;
+        int continuousBlocks = 0;
+    };
+
+    //==============================================================================
+    enum class Fault
+    {
+        none,
+        dropPeriods,       // DAL never offers some periods that were in the ring
+        duplicatePeriods,  // the last few periods are offered again, alone and then with a new one
+        offsetJump,        // mAvailableDataOffsetInPeriods steps forward with the media clock
+        burst,             // periods pile up and arrive in one mNumPeriodsAvailable burst
+        activationFlap     // transfers stop, the instance restarts and the position is reset
+    };
+
+    struct ScenarioResult
+    {
+        String name;
+        bool passed = false;
+        int64 samplesChecked = 0, mismatches = 0, unaccountedJumps = 0, positionErrors = 0;
+        int64 accountedGapSamples = 0, resyncGapSamples = 0, repeatedSamples = 0;
+        int recoveryPeriods = -1;     // periods from the fault until audio is continuous again
+        double recoveryMs = 0.0;      // the same in media time
+        double transferCpuUs = 0.0;   // CPU spent in the transfer while recovering
+
+        String toString() const
+        {
+            return name.paddedRight(' ', 24)
+                 + (passed ? "ok  " : "FAIL")
+                 + " checked=" + String(samplesChecked)
+                 + " mismatches=" + String(mismatches)
+                 + " unaccounted=" + String(unaccountedJumps)
+                 + " badPositions=" + String(positionErrors)
+                 + " gap=" + String(accountedGapSamples)
+                 + " resyncGap=" + String(resyncGapSamples)
+                 + " repeated=" + String(repeatedSamples)
+                 + " recovery=" + String(recoveryPeriods) + " periods (" + String(recoveryMs, 2) + " ms, "
+                 + String(transferCpuUs, 1) + " us cpu)";
+        }
+    };
+
+    //==============================================================================
+    struct InjectorConfig
+    {
+        int numChannels = 8;
+        int samplesPerPeriod = 128;
+        int periodsPerBuffer = 64;
+        int blockSize = 128;
+        double sampleRate = 48000.0;
+        int warmUpPeriods = 64;
+        int periodsAfterFault = 256;
+        int blocksToRecover = 8;
+        int coarseClockErrorSamples = -1500;
+    };
+
+    class FaultInjector
+    {
+    public:
+        explicit FaultInjector(InjectorConfig c = {}) : config(c) {}
+
+        ScenarioResult run(const String& name, Fault fault, int size)
+        {
+            FakeRxRing ring(config.numChannels, config.samplesPerPeriod, config.periodsPerBuffer);
+            DanteTransfer transfer;
+            StreamVerifier verifier(transfer, config.numChannels);
+
+            transfer.prepare(config.numChannels, config.numChannels, config.blockSize);
+            transfer.setCallback(&verifier);
+            transfer.setCoarseClock([&ring, this] { return ring.getNextSampleIndex() + config.coarseClockErrorSamples; });
+
+            auto tick = [&](const FakeTransferParameters& params)
+            {
+                transfer.process(ring.getProperties(), params);
+            };
+
+            for (int i = 0; i < config.warmUpPeriods; ++i)
+            {
+                ring.writePeriod();
+                tick(ring.latest(1));
+            }
+
+            const auto faultPeriod = ring.getPeriodsWritten();
+            const auto blocksBeforeFault = verifier.blocksReceived;
+
+            switch (fault)
+            {
+                case Fault::none:
+                    break;
+
+                case Fault::dropPeriods:
+                    for (int i = 0; i < size; ++i)
+                        ring.writePeriod();
+                    break;
+
+                case Fault::duplicatePeriods:
+                    tick(ring.latest((uint32)size));
+                    ring.writePeriod();
+                    tick(ring.latest((uint32)size + 1));
+                    break;
+
+                case Fault::offsetJump:
+                    ring.writePeriod(size);
+                    tick(ring.latest(1));
+                    break;
+
+                case Fault::burst:
+                    for (int i = 0; i < size; ++i)
+                        ring.writePeriod();
+                    tick(ring.latest((uint32)size));
+                    break;
+
+                case Fault::activationFlap:
+                    transfer.release();
+
+                    for (int i = 0; i < size; ++i)
+                        ring.writePeriod();
+
+                    transfer.prepare(config.numChannels, config.numChannels, config.blockSize);
+                    transfer.reset();
+                    break;
+            }
+
+            int recoveredAt = -1;
+            double cpuUs = 0.0;
+
+            for (int i = 0; i < config.periodsAfterFault; ++i)
+            {
+                ring.writePeriod();
+
+                const auto start = Time::getHighResolutionTicks();
+                tick(ring.latest(1));
+
+                if (recoveredAt < 0)
+                {
+                    cpuUs += Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1.0e6;
+
+                    if (verifier.blocksReceived > blocksBeforeFault && verifier.continuousBlocks >= config.blocksToRecover)
+                        recoveredAt = (int)(ring.getPeriodsWritten() - faultPeriod) - config.blocksToRecover * config.blockSize / config.samplesPerPeriod;
+                }
+            }
+
+            transfer.setCallback(nullptr);
+
+            ScenarioResult r;
+            r.name = name;
+            r.samplesChecked = verifier.samplesChecked;
+            r.mismatches = verifier.mismatches;
+            r.unaccountedJumps = verifier.unaccountedJumps;
+            r.positionErrors = verifier.positionErrors;
+            r.accountedGapSamples = verifier.accountedGapSamples;
+            r.resyncGapSamples = verifier.resyncGapSamples;
+            r.repeatedSamples = transfer.getStats().repeatedSamples;
+            r.recoveryPeriods = recoveredAt;
+            r.recoveryMs = recoveredAt >= 0 ? recoveredAt * config.samplesPerPeriod * 1000.0 / config.sampleRate : 0.0;
+            r.transferCpuUs = cpuUs;
+            r.passed = r.mismatches == 0 && r.unaccountedJumps == 0 && r.positionErrors == 0 && recoveredAt >= 0;
+            return r;
+        }
+
+        static Array<ScenarioResult> runAllScenarios(InjectorConfig c = {})
+        {
+            FaultInjector injector(c);
+            const auto ring = c.periodsPerBuffer;
+
+            return { injector.run("baseline", Fault::none, 0),
+                     injector.run("drop 1 period", Fault::dropPeriods, 1),
+                     injector.run("drop 5 periods", Fault::dropPeriods, 5),
+                     injector.run("duplicate 1 period", Fault::duplicatePeriods, 1),
+                     injector.run("re-offer 3 periods", Fault::duplicatePeriods, 3),
+                     injector.run("offset jump +3", Fault::offsetJump, 3),
+                     injector.run("offset jump +3/4 ring", Fault::offsetJump, ring * 3 / 4),
+                     injector.run("burst of 8", Fault::burst, 8),
+                     injector.run("burst past ring end", Fault::burst, ring + 8),
+                     injector.run("activation flap short", Fault::activationFlap, 10),
+                     injector.run("activation flap long", Fault::activationFlap, ring * 2) };
+        }
+
+    private:
+        InjectorConfig config;
+    };
+
+    //==============================================================================
+    class FaultInjectorTests : public UnitTest
+    {
+    public:
+        FaultInjectorTests() : UnitTest("Dante transfer faults", "Dante") {}
+
+        void runTest() override
+        {
+            for (auto& r : FaultInjector::runAllScenarios())
+            {
+                beginTest(r.name);
+                logMessage(r.toString());
+
+                expectEquals(r.mismatches, (int64)0, "samples that don't match the stream");
+                expectEquals(r.positionErrors, (int64)0, "media-clock positions that aren't the sample index");
+                expectEquals(r.unaccountedJumps, (int64)0, "jumps that don't match the accounted gap");
+                expect(r.recoveryPeriods >= 0, "never became continuous again");
+            }
+        }
+    };
+
+   #if JUCE_UNIT_TESTS
+    static FaultInjectorTests faultInjectorTests;
+   #endif
+}
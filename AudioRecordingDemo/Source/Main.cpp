@@ -8,6 +8,7 @@
 
 #include <JuceHeader.h>
 #include "AudioRecordingDemo.h"
+#include "DanteTransferFaultInjector.h"
 namespace juce {
     class Application : public juce::JUCEApplication
     {
@@ -18,14 +19,39 @@ namespace juce {
         const juce::String getApplicationName() override { return "AudioRecordingDemo"; }
         const juce::String getApplicationVersion() override { return "1.0.0"; }
 
-        void initialise(const juce::String&) override
+        void initialise(const juce::String& commandLine) override
         {
+            if (commandLine.contains("--run-unit-tests"))
+            {
+                runUnitTests();
+                return;
+            }
+
             mainWindow.reset(new MainWindow("AudioRecordingDemo", new AudioRecordingDemo, *this));
         }
 
         void shutdown() override { mainWindow = nullptr; }
 
     private:
+        /** Runs the app's tests without a window and quits, with a non-zero exit code
+            if any of them failed.
+        */
+        void runUnitTests()
+        {
+            DanteFaults::FaultInjectorTests faultTests;
+            MipmappedAudioThumbnailTests thumbnailTests;
+            UnitTestRunner runner;
+            runner.runTests({ &faultTests, &thumbnailTests });
+
+            int numFailures = 0;
+
+            for (int i = 0; i < runner.getNumResults(); ++i)
+                numFailures += runner.getResult(i)->failures;
+
+            setApplicationReturnValue(numFailures > 0 ? 1 : 0);
+            quit();
+        }
+
         class MainWindow : public juce::DocumentWindow
         {
         public:
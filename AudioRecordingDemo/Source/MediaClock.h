@@ -0,0 +1,49 @@
+#pragma once
+#include <JuceHeader.h>
+
+//==============================================================================
+/*  Conversions between Dante media-clock sample positions and wall-clock time.
+
+    The media clock counts samples since the PTP epoch, and PTP time is TAI, while
+    Time works in UTC. A position is only turned into a date when it has to be
+    written somewhere, e.g. into a BWF bext chunk, whose time reference counts
+    samples since local midnight rather than since the epoch.
+*/
+struct MediaClock
+{
+    /** How far TAI is ahead of UTC: the 10s it started with plus every leap second
+        since 1972. It has been 37s since the start of 2017 and only changes when
+        the IERS announces another leap second.
+    */
+    static constexpr int64 taiOffsetMs = 37000;
+
+    static int64 getPositionForTime(Time time, double sampleRate)
+    {
+        return (time.toMilliseconds() + taiOffsetMs) * (int64)sampleRate / 1000;
+    }
+
+    static Time getTimeForPosition(int64 position, double sampleRate)
+    {
+        return Time(position * 1000 / (int64)sampleRate - taiOffsetMs);
+    }
+
+    /** The BWF time reference for a position: samples since the local midnight before it.
+        This is taken from the sample position itself rather than from the rounded time, so
+        machines that agree on the position also agree on the time reference.
+    */
+    static int64 getSamplesSinceLocalMidnight(int64 position, double sampleRate)
+    {
+        const auto time = getTimeForPosition(position, sampleRate);
+        const Time midnight(time.getYear(), time.getMonth(), time.getDayOfMonth(), 0, 0, 0, 0, true);
+
+        return jmax((int64)0, position - getPositionForTime(midnight, sampleRate));
+    }
+
+    /** bext metadata for a file whose first sample is at the given position. */
+    static StringPairArray createBWAVMetadata(int64 position, double sampleRate)
+    {
+        return WavAudioFormat::createBWAVMetadata("Dante capture", "DanteJUCEDemo", {},
+                                                  getTimeForPosition(position, sampleRate),
+                                                  getSamplesSinceLocalMidnight(position, sampleRate), {});
+    }
+};
@@ -0,0 +1,398 @@
+#pragma once
+
+//==============================================================================
+/*  Per-channel peak, RMS and clip levels, measured on the audio thread and read
+    on the message thread without either side ever waiting for the other.
+
+    The audio thread accumulates each channel's peak, sum of squares and clip flag
+    over however many blocks go by between two reads. After every block it copies
+    the result into the spare one of three snapshot slots and swaps that with the
+    shared middle slot; the reader swaps the middle slot with its own whenever a
+    new one has been published. So the writer always has a slot of its own to
+    fill, the reader always has a complete snapshot, and neither takes a lock.
+    Once the reader has taken a snapshot, the writer starts a new measurement.
+*/
+class LevelSnapshots
+{
+public:
+    struct Level
+    {
+        float peak = 0.0f, rms = 0.0f;
+        bool clipped = false;
+    };
+
+    /** Allocates for the given number of channels. Must not be called while process()
+        or update() can run.
+    */
+    void prepare(int newNumChannels)
+    {
+        numChannels = jmax(0, newNumChannels);
+        slots.calloc((size_t)(3 * numChannels + 1));
+        peaks.calloc((size_t)(numChannels + 1));
+        sumsOfSquares.calloc((size_t)(numChannels + 1));
+        clips.calloc((size_t)(numChannels + 1));
+        accumulatedSamples = 0;
+        back = 0;
+        front = 2;
+        middle = 1;
+    }
+
+    int getNumChannels() const noexcept { return numChannels; }
+
+    /** Audio thread. Channels beyond numInputChannels, or null ones, read as silence. */
+    void process(const float* const* channelData, int numInputChannels, int numSamples) noexcept
+    {
+        if (numChannels == 0 || numSamples <= 0)
+            return;
+
+        // If the reader has taken the last snapshot, what it saw is done with
+        if ((middle.load() & newData) == 0 && accumulatedSamples > 0)
+        {
+            FloatVectorOperations::clear(peaks, numChannels);
+            zeromem(sumsOfSquares, sizeof(double) * (size_t)numChannels);
+            zeromem(clips, sizeof(bool) * (size_t)numChannels);
+            accumulatedSamples = 0;
+        }
+
+        for (int chan = 0; chan < jmin(numChannels, numInputChannels); ++chan)
+        {
+            if (const auto* src = channelData[chan])
+            {
+                const auto range = FloatVectorOperations::findMinAndMax(src, numSamples);
+                const auto peak = jmax(-range.getStart(), range.getEnd());
+
+                peaks[chan] = jmax(peaks[chan], peak);
+                sumsOfSquares[chan] += sumOfSquares(src, numSamples);
+                clips[chan] = clips[chan] || peak >= clipLevel;
+            }
+        }
+
+        accumulatedSamples += numSamples;
+
+        auto* slot = slots + back * numChannels;
+
+        for (int chan = 0; chan < numChannels; ++chan)
+            slot[chan] = { peaks[chan], (float)std::sqrt(sumsOfSquares[chan] / (double)accumulatedSamples), clips[chan] };
+
+        back = middle.exchange(back | newData) & indexMask;
+    }
+
+    /** Message thread. Takes the latest snapshot if there's a new one, and returns
+        whether there was.
+    */
+    bool update() noexcept
+    {
+        if ((middle.load() & newData) == 0)
+            return false;
+
+        front = middle.exchange(front) & indexMask;
+        return true;
+    }
+
+    /** The levels in the snapshot that update() last took. */
+    const Level& getLevel(int channel) const noexcept
+    {
+        jassert(isPositiveAndBelow(channel, numChannels));
+        return slots[front * numChannels + channel];
+    }
+
+    static constexpr float clipLevel = 0.999f; // (a sample this loud was most likely clipped on the way in)
+
+private:
+    static constexpr int indexMask = 3, newData = 4;
+
+    int numChannels = 0;
+    HeapBlock<Level> slots; // three slots of numChannels each
+    int back = 0, front = 2; // (each only ever touched by its own side)
+    std::atomic<int> middle{ 1 };
+
+    HeapBlock<float> peaks;
+    HeapBlock<double> sumsOfSquares;
+    HeapBlock<bool> clips;
+    int64 accumulatedSamples = 0;
+
+    static float sumOfSquares(const float* data, int num) noexcept
+    {
+        // FloatVectorOperations has nothing for this, but four independent running sums
+        // are something the compiler can keep in one vector register
+        float sums[4] = {};
+        int i = 0;
+
+        for (; i + 4 <= num; i += 4)
+            for (int j = 0; j < 4; ++j)
+                sums[j] += data[i + j] * data[i + j];
+
+        auto total = sums[0] + sums[1] + sums[2] + sums[3];
+
+        for (; i < num; ++i)
+            total += data[i] * data[i];
+
+        return total;
+    }
+};
+
+//==============================================================================
+/*  A wall of peak/RMS meters, one per active input of the device it's attached
+    to, for devices with dozens or hundreds of channels.
+
+    The audio callback only feeds a LevelSnapshots. A timer picks up the latest
+    snapshot at a limited rate, applies the peak decay, and repaints just the
+    meters whose bars have moved by at least a pixel. Everything that doesn't
+    change (the slots, scale marks and channel numbers) is drawn once into a
+    background image whenever the layout changes, so painting a meter is just
+    a blit and a couple of rectangles.
+
+    Clip indicators stay lit until the wall is clicked.
+*/
+class MeterWall : public Component,
+                  public AudioIODeviceCallback,
+                  private Timer
+{
+public:
+    MeterWall()
+    {
+        setOpaque(true);
+        setRefreshRate(30);
+    }
+
+    ~MeterWall() override
+    {
+        stopTimer();
+    }
+
+    /** How often the meters are updated. */
+    void setRefreshRate(int frequencyInHz)
+    {
+        refreshRate = jmax(1, frequencyInHz);
+        decayPerTick = Decibels::decibelsToGain(-peakDecayDbPerSecond / (float)refreshRate);
+        startTimerHz(refreshRate);
+    }
+
+    void resetClipIndicators()
+    {
+        for (auto& meter : meters)
+        {
+            if (meter.clipped)
+            {
+                meter.clipped = false;
+                repaint(meter.area);
+            }
+        }
+    }
+
+    //==============================================================================
+    void audioDeviceAboutToStart(AudioIODevice* device) override
+    {
+        const ScopedLock sl(snapshotLock);
+        snapshots.prepare(device->getActiveInputChannels().countNumberOfSetBits());
+        layoutChanged = true;
+    }
+
+    void audioDeviceStopped() override
+    {
+        const ScopedLock sl(snapshotLock);
+        snapshots.prepare(0);
+        layoutChanged = true;
+    }
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels,
+                               int numSamples) override
+    {
+        snapshots.process(inputChannelData, numInputChannels, numSamples);
+
+        // We need to clear the output buffers, in case they're full of junk..
+        for (int i = 0; i < numOutputChannels; ++i)
+            if (outputChannelData[i] != nullptr)
+                FloatVectorOperations::clear(outputChannelData[i], numSamples);
+    }
+
+    //==============================================================================
+    void paint(Graphics& g) override
+    {
+        g.drawImageAt(background, 0, 0);
+
+        const auto clip = g.getClipBounds();
+
+        for (auto& meter : meters)
+            if (meter.area.intersects(clip))
+                paintMeter(g, meter);
+    }
+
+    void resized() override
+    {
+        updateLayout();
+    }
+
+    void mouseDown(const MouseEvent&) override
+    {
+        resetClipIndicators();
+    }
+
+private:
+    struct Meter
+    {
+        Rectangle<int> area, bar, led, label;
+        float peak = 0.0f, rms = 0.0f;
+        bool clipped = false;
+        int peakPixels = 0, rmsPixels = 0; // (what's on screen now)
+    };
+
+    static constexpr float minDecibels = -60.0f, peakDecayDbPerSecond = 24.0f;
+    static constexpr int minMeterWidth = 10;
+
+    CriticalSection snapshotLock; // (the message thread and the device starting or stopping, never the audio callback)
+    LevelSnapshots snapshots;
+    std::atomic<bool> layoutChanged{ true };
+
+    std::vector<Meter> meters;
+    Image background;
+    int refreshRate = 30;
+    float decayPerTick = 1.0f;
+
+    void timerCallback() override
+    {
+        if (layoutChanged.exchange(false))
+            updateLayout();
+
+        const ScopedLock sl(snapshotLock);
+        const auto isNew = snapshots.update();
+        const auto num = jmin((int)meters.size(), snapshots.getNumChannels());
+
+        for (int i = 0; i < num; ++i)
+        {
+            auto& meter = meters[(size_t)i];
+            const auto& level = snapshots.getLevel(i);
+
+            meter.peak = jmax(isNew ? level.peak : 0.0f, meter.peak * decayPerTick);
+            meter.rms = isNew ? level.rms : meter.rms * decayPerTick;
+
+            const auto peakPixels = toPixels(meter.peak, meter.bar);
+            const auto rmsPixels = toPixels(meter.rms, meter.bar);
+            const auto clipped = meter.clipped || (isNew && level.clipped);
+
+            if (peakPixels != meter.peakPixels || rmsPixels != meter.rmsPixels || clipped != meter.clipped)
+            {
+                meter.peakPixels = peakPixels;
+                meter.rmsPixels = rmsPixels;
+                meter.clipped = clipped;
+                repaint(meter.area);
+            }
+        }
+    }
+
+    static int toPixels(float gain, Rectangle<int> bar) noexcept
+    {
+        const auto db = Decibels::gainToDecibels(gain, minDecibels);
+        return roundToInt(jmap(db, minDecibels, 0.0f, 0.0f, (float)bar.getHeight()));
+    }
+
+    void updateLayout()
+    {
+        int num = 0;
+
+        {
+            const ScopedLock sl(snapshotLock);
+            num = snapshots.getNumChannels();
+        }
+
+        meters.assign((size_t)num, {});
+
+        const auto area = getLocalBounds().reduced(2);
+
+        if (num > 0 && !area.isEmpty())
+        {
+            const auto columns = jlimit(1, num, area.getWidth() / minMeterWidth);
+            const auto rows = (num + columns - 1) / columns;
+            const auto cellWidth = area.getWidth() / columns;
+            const auto cellHeight = area.getHeight() / rows;
+            const auto labelHeight = cellHeight >= 48 && cellWidth >= 14 ? 10 : 0;
+
+            for (int i = 0; i < num; ++i)
+            {
+                auto& meter = meters[(size_t)i];
+                auto cell = Rectangle<int>(area.getX() + (i % columns) * cellWidth, area.getY() + (i / columns) * cellHeight,
+                                           cellWidth, cellHeight).reduced(1);
+
+                meter.label = cell.removeFromBottom(labelHeight);
+                meter.area = cell;
+                meter.led = cell.removeFromTop(jmin(4, cell.getHeight() / 8));
+                cell.removeFromTop(1);
+                meter.bar = cell;
+            }
+        }
+
+        renderBackground();
+        repaint();
+    }
+
+    void renderBackground()
+    {
+        if (getWidth() <= 0 || getHeight() <= 0)
+        {
+            background = {};
+            return;
+        }
+
+        background = Image(Image::RGB, getWidth(), getHeight(), true);
+        Graphics g(background);
+
+        g.fillAll(Colour(0xff1a1a1a));
+
+        if (meters.empty())
+        {
+            g.setColour(Colours::grey);
+            g.setFont(14.0f);
+            g.drawFittedText("(No active inputs)", getLocalBounds(), Justification::centred, 1);
+            return;
+        }
+
+        g.setFont(9.0f);
+
+        for (size_t i = 0; i < meters.size(); ++i)
+        {
+            const auto& meter = meters[i];
+
+            g.setColour(Colour(0xff000000));
+            g.fillRect(meter.bar);
+            g.setColour(Colour(0xff3a0000));
+            g.fillRect(meter.led);
+
+            // Scale marks at -6 and -18 dB
+            g.setColour(Colour(0xff303030));
+
+            for (auto db : { -6.0f, -18.0f })
+                g.fillRect(meter.bar.getX(), meter.bar.getBottom() - toPixels(Decibels::decibelsToGain(db), meter.bar),
+                           meter.bar.getWidth(), 1);
+
+            if (!meter.label.isEmpty())
+            {
+                g.setColour(Colours::grey);
+                g.drawFittedText(String((int)i + 1), meter.label, Justification::centred, 1, 0.6f);
+            }
+        }
+    }
+
+    void paintMeter(Graphics& g, const Meter& meter) const
+    {
+        const auto& bar = meter.bar;
+        const auto rmsDb = Decibels::gainToDecibels(meter.rms, minDecibels);
+
+        g.setColour(rmsDb > -6.0f ? Colours::orange : rmsDb > -18.0f ? Colours::yellow : Colours::limegreen);
+        g.fillRect(bar.withTop(bar.getBottom() - meter.rmsPixels));
+
+        if (meter.peakPixels > 0)
+        {
+            g.setColour(Colours::white);
+            g.fillRect(bar.getX(), jmax(bar.getY(), bar.getBottom() - meter.peakPixels), bar.getWidth(), 1);
+        }
+
+        if (meter.clipped)
+        {
+            g.setColour(Colours::red);
+            g.fillRect(meter.led);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MeterWall)
+};
@@ -0,0 +1,393 @@
+#pragma once
+
+//==============================================================================
+/*  An AudioThumbnail that also keeps a pyramid of coarser levels for the data
+    that's added to it with addBlock(), e.g. while recording.
+
+    Each entry of level 0 covers four of the thumbnail's own, and each level above
+    it covers four times as many samples per entry again, so drawing picks the
+    level that has between one and four entries per pixel and never looks at more
+    than a few entries per pixel, however long the recording is or however far out
+    it's zoomed. The levels are extended and updated as blocks arrive, only along
+    the path from each new entry up to the top.
+
+    Closer in than level 0, AudioThumbnail's own data has at most four entries per
+    pixel, so drawing is left to it. The pyramid doesn't copy that data: entries
+    are 8-bit min/max pairs like AudioThumbnail's, level 0 is a quarter the size of
+    its data, and all the levels together add about a third to what it keeps.
+
+    A thumbnail that's loaded from a file or a cache with setSource() or loadFrom()
+    never sees addBlock(), so once it has finished loading, its levels are built
+    from AudioThumbnail's data instead, the first time they're needed.
+*/
+class MipmappedAudioThumbnail : public AudioThumbnail
+{
+public:
+    MipmappedAudioThumbnail(int sourceSamplesPerThumbnailSample, AudioFormatManager& formatManager,
+                            AudioThumbnailCache& cacheToUse)
+        : AudioThumbnail(sourceSamplesPerThumbnailSample, formatManager, cacheToUse),
+          samplesPerEntry(sourceSamplesPerThumbnailSample)
+    {
+    }
+
+    //==============================================================================
+    void clear() override
+    {
+        AudioThumbnail::clear();
+
+        const ScopedLock sl(pyramidLock);
+        levels.clear();
+        numChannels = 0;
+        numSamples = 0;
+        needsLoadedLevels = true;
+    }
+
+    bool loadFrom(InputStream& input) override
+    {
+        const auto loaded = AudioThumbnail::loadFrom(input);
+
+        const ScopedLock sl(pyramidLock);
+        levels.clear();
+        needsLoadedLevels = true;
+        return loaded;
+    }
+
+    void reset(int newNumChannels, double newSampleRate, int64 totalSamplesInSource = 0) override
+    {
+        AudioThumbnail::reset(newNumChannels, newSampleRate, totalSamplesInSource);
+
+        const ScopedLock sl(pyramidLock);
+        levels.clear();
+        numChannels = newNumChannels;
+        sampleRate = newSampleRate;
+        numSamples = 0;
+        needsLoadedLevels = false;
+    }
+
+    void addBlock(int64 startSample, const AudioBuffer<float>& incoming, int startOffsetInBuffer, int numSamplesToAdd) override
+    {
+        AudioThumbnail::addBlock(startSample, incoming, startOffsetInBuffer, numSamplesToAdd);
+
+        const auto entrySize = getSamplesPerEntry(0);
+        const auto endSample = startSample + numSamplesToAdd;
+        const auto firstEntry = (int)(startSample / entrySize);
+        const auto endEntry = (int)((endSample + entrySize - 1) / entrySize);
+        const auto numChans = jmin(numChannels, incoming.getNumChannels());
+
+        if (numSamplesToAdd <= 0 || numChans <= 0)
+            return;
+
+        const ScopedLock sl(pyramidLock);
+        ensureSize(endEntry);
+
+        for (int chan = 0; chan < numChans; ++chan)
+        {
+            auto* src = incoming.getReadPointer(chan, startOffsetInBuffer);
+            auto* dest = levels[0].channels[(size_t)chan].data();
+
+            for (int i = firstEntry; i < endEntry; ++i)
+            {
+                const auto start = jmax(startSample, i * entrySize);
+                const auto end = jmin(endSample, (i + 1) * entrySize);
+                const auto value = MinMax::fromRange(FloatVectorOperations::findMinAndMax(src + (start - startSample), (int)(end - start)));
+
+                // (a block that starts partway through an entry adds to what the one before it left there)
+                dest[i] = start > i * entrySize ? dest[i].unionWith(value) : value;
+            }
+        }
+
+        updateParents(firstEntry, endEntry);
+        numSamples = jmax(numSamples, endSample);
+    }
+
+    //==============================================================================
+    void drawChannel(Graphics& g, const Rectangle<int>& area, double startTimeSeconds, double endTimeSeconds,
+                     int channelNum, float verticalZoomFactor) override
+    {
+        RectangleList<float> waveform;
+
+        {
+            const ScopedLock sl(pyramidLock);
+            buildLoadedLevelsIfNeeded();
+
+            const auto samplesPerPixel = (endTimeSeconds - startTimeSeconds) * sampleRate / jmax(1, area.getWidth());
+
+            if (levels.empty() || samplesPerPixel < getSamplesPerEntry(0) || !isPositiveAndBelow(channelNum, numChannels))
+            {
+                AudioThumbnail::drawChannel(g, area, startTimeSeconds, endTimeSeconds, channelNum, verticalZoomFactor);
+                return;
+            }
+
+            // The coarsest level that still has at least one entry per pixel
+            size_t levelIndex = 0;
+
+            while (levelIndex + 1 < levels.size() && getSamplesPerEntry(levelIndex + 1) <= samplesPerPixel)
+                ++levelIndex;
+
+            const auto& entries = levels[levelIndex].channels[(size_t)channelNum];
+            const auto entrySize = (double)getSamplesPerEntry(levelIndex);
+            const auto firstSample = startTimeSeconds * sampleRate;
+            const auto lastEntry = (int)jmin((int64)entries.size(), (numSamples + (int64)entrySize - 1) / (int64)entrySize);
+
+            const auto clip = g.getClipBounds().getIntersection(area);
+            const auto topY = (float)area.getY();
+            const auto bottomY = (float)area.getBottom();
+            const auto midY = (topY + bottomY) * 0.5f;
+            const auto vscale = verticalZoomFactor * (bottomY - topY) / 256.0f;
+
+            waveform.ensureStorageAllocated(clip.getWidth());
+
+            for (int x = clip.getX(); x < clip.getRight(); ++x)
+            {
+                const auto s0 = firstSample + (x - area.getX()) * samplesPerPixel;
+                const auto begin = jmax(0, (int)(s0 / entrySize));
+                const auto end = jmin(lastEntry, jmax(begin + 1, (int)std::ceil((s0 + samplesPerPixel) / entrySize)));
+
+                MinMax value;
+
+                for (int i = begin; i < end; ++i)
+                    value = value.unionWith(entries[(size_t)i]);
+
+                if (value.isNonZero())
+                {
+                    const auto top = jmax(midY - value.max * vscale - 0.3f, topY);
+                    const auto bottom = jmin(midY - value.min * vscale + 0.3f, bottomY);
+
+                    waveform.addWithoutMerging(Rectangle<float>((float)x, top, 1.0f, bottom - top));
+                }
+            }
+        }
+
+        g.fillRectList(waveform);
+    }
+
+    int getNumLevels()
+    {
+        const ScopedLock sl(pyramidLock);
+        buildLoadedLevelsIfNeeded();
+        return (int)levels.size();
+    }
+
+private:
+    struct MinMax
+    {
+        int8 min = 0, max = 0;
+
+        static MinMax fromRange(Range<float> range) noexcept
+        {
+            MinMax m;
+            m.min = (int8)jlimit(-128, 127, roundToInt(range.getStart() * 127.0f));
+            m.max = (int8)jlimit(-128, 127, roundToInt(range.getEnd() * 127.0f));
+
+            // (an empty range means "no data", so even silence gets a minimal height)
+            if (m.min == m.max)
+            {
+                if (m.max == 127)
+                    --m.min;
+                else
+                    ++m.max;
+            }
+
+            return m;
+        }
+
+        /** From AudioThumbnail::getApproximateMinMax(), which divides its own 8-bit values by 128. */
+        static MinMax fromThumbnail(float low, float high) noexcept
+        {
+            MinMax m;
+            m.min = (int8)jlimit(-128, 127, roundToInt(low * 128.0f));
+            m.max = (int8)jlimit(-128, 127, roundToInt(high * 128.0f));
+            return m;
+        }
+
+        bool isNonZero() const noexcept { return max > min; }
+
+        MinMax unionWith(MinMax other) const noexcept
+        {
+            if (!other.isNonZero())
+                return *this;
+
+            if (!isNonZero())
+                return other;
+
+            return { jmin(min, other.min), jmax(max, other.max) };
+        }
+    };
+
+    struct Level
+    {
+        std::vector<std::vector<MinMax>> channels;
+    };
+
+    static constexpr int branching = 4;
+
+    const int samplesPerEntry; // (AudioThumbnail's, which level 0 has four times as many as)
+    CriticalSection pyramidLock; // (the thread adding blocks and the message thread drawing)
+    std::vector<Level> levels;
+    int numChannels = 0;
+    double sampleRate = 0.0;
+    int64 numSamples = 0;
+    bool needsLoadedLevels = false; // (set when the data came from somewhere other than addBlock())
+
+    int64 getSamplesPerEntry(size_t levelIndex) const noexcept
+    {
+        return (int64)samplesPerEntry << (2 * (levelIndex + 1));
+    }
+
+    /** Makes level 0 at least this long, and adds levels on top until there's one with
+        a single entry.
+    */
+    void ensureSize(int numEntries)
+    {
+        for (size_t levelIndex = 0;; ++levelIndex)
+        {
+            if (levelIndex == levels.size())
+                levels.push_back({ std::vector<std::vector<MinMax>>((size_t)numChannels) });
+
+            for (auto& entries : levels[levelIndex].channels)
+            {
+                if ((int)entries.size() < numEntries)
+                {
+                    // (grows geometrically, so a long recording doesn't keep copying the whole level)
+                    if ((int)entries.capacity() < numEntries)
+                        entries.reserve((size_t)jmax(numEntries, (int)entries.capacity() * 2));
+
+                    entries.resize((size_t)numEntries);
+                }
+            }
+
+            if (numEntries <= 1)
+                break;
+
+            numEntries = (numEntries + branching - 1) / branching;
+        }
+    }
+
+    /** Once a loaded thumbnail has all its data, fills level 0 from it a few of AudioThumbnail's
+        entries at a time and builds the rest on top.
+    */
+    void buildLoadedLevelsIfNeeded()
+    {
+        if (!needsLoadedLevels || !isFullyLoaded())
+            return;
+
+        const auto numLoaded = getNumSamplesFinished();
+        const auto length = getTotalLength();
+
+        if (numLoaded <= 0 || length <= 0.0)
+            return;
+
+        needsLoadedLevels = false;
+
+        // (AudioThumbnail doesn't give its rate, but once it's loaded its length is exactly the
+        //  samples it has read, rounded up to whole entries, so the rate follows from that)
+        sampleRate = std::round((double)numLoaded / length);
+        numChannels = AudioThumbnail::getNumChannels();
+        numSamples = numLoaded;
+
+        const auto entrySize = getSamplesPerEntry(0);
+        const auto numEntries = (int)((numSamples + entrySize - 1) / entrySize);
+        ensureSize(numEntries);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            auto& entries = levels[0].channels[(size_t)chan];
+
+            for (int i = 0; i < numEntries; ++i)
+            {
+                // (getApproximateMinMax() rounds the end up to an entry and includes that one too,
+                //  so both ends go halfway into an entry to take in exactly this one's four)
+                const auto start = ((double)(i * entrySize) + 0.5 * samplesPerEntry) / sampleRate;
+                const auto end = ((double)((i + 1) * entrySize) - 1.5 * samplesPerEntry) / sampleRate;
+
+                float low = 0.0f, high = 0.0f;
+                getApproximateMinMax(start, end, chan, low, high);
+                entries[(size_t)i] = MinMax::fromThumbnail(low, high);
+            }
+        }
+
+        updateParents(0, numEntries);
+    }
+
+    /** Recomputes everything above level 0 that covers entries [begin, end). */
+    void updateParents(int begin, int end)
+    {
+        for (size_t levelIndex = 1; levelIndex < levels.size(); ++levelIndex)
+        {
+            begin /= branching;
+            end = (end + branching - 1) / branching;
+
+            for (int chan = 0; chan < numChannels; ++chan)
+            {
+                const auto& children = levels[levelIndex - 1].channels[(size_t)chan];
+                auto& parents = levels[levelIndex].channels[(size_t)chan];
+
+                for (int i = begin; i < end; ++i)
+                {
+                    MinMax value;
+
+                    for (int c = i * branching; c < jmin((i + 1) * branching, (int)children.size()); ++c)
+                        value = value.unionWith(children[(size_t)c]);
+
+                    parents[(size_t)i] = value;
+                }
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MipmappedAudioThumbnail)
+};
+
+//==============================================================================
+/*  Loads a recording through setSource(), as the demo does once a take is finished,
+    and checks that it gets the same levels as one built up with addBlock().
+*/
+class MipmappedAudioThumbnailTests : public UnitTest
+{
+public:
+    MipmappedAudioThumbnailTests() : UnitTest("Mipmapped audio thumbnail", "Thumbnails") {}
+
+    void runTest() override
+    {
+        beginTest("Levels for a loaded file");
+
+        const auto sampleRate = 48000.0;
+        const auto numSamples = (int)(sampleRate * 60.0);
+        AudioBuffer<float> audio(2, numSamples);
+
+        for (int chan = 0; chan < audio.getNumChannels(); ++chan)
+            for (int i = 0; i < numSamples; ++i)
+                audio.setSample(chan, i, (float)std::sin(i * 0.01 * (chan + 1)) * ((i / 100000) % 2 == 0 ? 0.25f : 0.75f));
+
+        const TemporaryFile temp(".wav");
+        WavAudioFormat wav;
+
+        if (auto writer = std::unique_ptr<AudioFormatWriter>(wav.createWriterFor(new FileOutputStream(temp.getFile()), sampleRate,
+                                                                                 (unsigned int)audio.getNumChannels(), 24, {}, 0)))
+            expect(writer->writeFromAudioSampleBuffer(audio, 0, numSamples));
+
+        AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        AudioThumbnailCache cache(1);
+
+        MipmappedAudioThumbnail built(512, formatManager, cache);
+        built.reset(audio.getNumChannels(), sampleRate);
+
+        for (int start = 0; start < numSamples; start += 4096)
+            built.addBlock(start, audio, start, jmin(4096, numSamples - start));
+
+        MipmappedAudioThumbnail loaded(512, formatManager, cache);
+        expect(loaded.setSource(new FileInputSource(temp.getFile())));
+
+        for (int i = 0; i < 1000 && !loaded.isFullyLoaded(); ++i)
+            Thread::sleep(10);
+
+        expect(loaded.isFullyLoaded());
+        expectGreaterThan(loaded.getNumLevels(), 1);
+        expectEquals(loaded.getNumLevels(), built.getNumLevels());
+    }
+};
+
+#if JUCE_UNIT_TESTS
+static MipmappedAudioThumbnailTests mipmappedAudioThumbnailTests;
+#endif
@@ -0,0 +1,382 @@
+#pragma once
+#include "CaptureFileOutputStream.h"
+#include "ParallelFlacEncoder.h"
+#include "MediaClock.h"
+
+//==============================================================================
+/*  Records every active input channel at full resolution.
+
+    The audio callback does nothing but copy the incoming block into a large ring
+    that is allocated up front; it never locks, allocates or touches a file. A
+    dedicated writer thread drains the ring in large chunks and hands them to one
+    polyphonic AudioFormatWriter, or to one mono writer per channel, writing either
+    24-bit integer or 32-bit float WAV. If the disk ever falls so far behind that
+    the ring fills up, whole blocks are dropped and counted rather than blocking
+    the audio thread.
+
+    In FLAC mode the chunks go to a ParallelFlacEncoder instead, which spreads the
+    encoding over several cores and roughly halves what the disk has to sustain.
+
+    The files are written through CaptureFileOutputStream, so disk space is
+    reserved well ahead of the data and direct I/O can be switched on for
+    captures that run for days.
+*/
+class MultichannelRecorder : public AudioIODeviceCallback,
+                             private Thread
+{
+public:
+    enum class SampleFormat { int24, float32, flac24 };
+    enum class FileLayout { polyphonic, filePerChannel };
+
+    struct Options
+    {
+        SampleFormat format = SampleFormat::int24;
+        FileLayout layout = FileLayout::polyphonic;     // (not used for FLAC, see flac.channelsPerFile)
+        double ringSeconds = 4.0;             // how much the disk may fall behind before audio is dropped
+        int writeBlockSamples = 32768;        // frames handed to the writers in one go
+        CaptureFileOutputStream::Options captureFile; // buffering and direct I/O per file, preallocation shared by all the files
+        int64 mediaClockStartSample = -1;     // media-clock position of the first frame, written to the bext chunk if not negative
+        ParallelFlacEncoder::Options flac;    // grouping, quality and threads for the FLAC format
+    };
+
+    struct Stats
+    {
+        int64 framesWritten = 0;
+        int64 bytesWritten = 0;
+        int64 droppedFrames = 0;
+        int64 spilledFrames = 0;              // FLAC only: frames that went through a spill file because an encoder fell behind
+        int64 spillBacklogFrames = 0;         // FLAC only: frames waiting in spill files right now
+        double sustainedMBPerSecond = 0.0;    // bytes written over the time spent recording
+        double writeMBPerSecond = 0.0;        // bytes written over the time spent inside the writers
+        float peakRingFill = 0.0f;            // 0..1, how close the ring has come to overflowing
+        StallHistogram::Snapshot writeStalls; // each chunk handed to the writers, on the writer thread
+        StallHistogram::Snapshot ioStalls;    // each call the files made to the OS
+    };
+
+    MultichannelRecorder() : Thread("Multichannel Recorder Thread") {}
+
+    ~MultichannelRecorder() override
+    {
+        stop();
+    }
+
+    //==============================================================================
+    /** Starts recording all active inputs. In polyphonic mode the file is used as is,
+        otherwise one file per channel is created next to it with a _chNN suffix. FLAC
+        files always get a _chNN or _chNN-MM suffix and a .flac extension.
+    */
+    bool startRecording(const File& file)
+    {
+        return startRecording(file, Options());
+    }
+
+    bool startRecording(const File& file, const Options& newOptions)
+    {
+        stop();
+
+        if (sampleRate <= 0 || numChannels <= 0)
+            return false;
+
+        options = newOptions;
+        writers.clear();
+        flacEncoder.reset();
+        writeStalls.reset();
+        ioStalls.reset();
+
+        if (options.format == SampleFormat::flac24)
+        {
+            const auto perFile = jlimit(1, 8, options.flac.channelsPerFile);
+            flacEncoder = ParallelFlacEncoder::create(file, sampleRate, numChannels, options.writeBlockSamples, options.flac,
+                                                      shareCaptureFileOptions(options.captureFile, (numChannels + perFile - 1) / perFile),
+                                                      ioStalls, writeStalls);
+
+            if (flacEncoder == nullptr)
+                return false;
+        }
+
+        const auto bits = options.format == SampleFormat::float32 ? 32 : 24;
+        const auto perChannel = options.layout == FileLayout::filePerChannel;
+        const auto captureFile = shareCaptureFileOptions(options.captureFile, perChannel ? numChannels : 1);
+        StringPairArray metadata;
+
+        if (options.mediaClockStartSample >= 0)
+            metadata = MediaClock::createBWAVMetadata(options.mediaClockStartSample, sampleRate);
+
+        for (int i = 0; flacEncoder == nullptr && i < (perChannel ? numChannels : 1); ++i)
+        {
+            const auto target = perChannel ? file.getSiblingFile(file.getFileNameWithoutExtension()
+                                                                 + "_ch" + String(i + 1).paddedLeft('0', 2)
+                                                                 + file.getFileExtension())
+                                           : file;
+            target.deleteFile();
+
+            auto stream = std::make_unique<CaptureFileOutputStream>(target, captureFile, &ioStalls);
+
+            if (stream->failedToOpen())
+            {
+                writers.clear();
+                return false;
+            }
+
+            WavAudioFormat wavFormat;
+            std::unique_ptr<AudioFormatWriter> writer(wavFormat.createWriterFor(stream.get(), sampleRate,
+                                                                                 (unsigned int)(perChannel ? 1 : numChannels),
+                                                                                 bits, metadata, 0));
+            if (writer == nullptr)
+            {
+                writers.clear();
+                return false;
+            }
+
+            stream.release(); // (the writer owns it now)
+            writers.push_back(std::move(writer));
+        }
+
+        const auto ringSamples = jmax(options.writeBlockSamples * 2, roundToInt(options.ringSeconds * sampleRate));
+        ring.setSize(numChannels, ringSamples, false, true, true);
+
+        // Touch every page now so the audio thread never takes the first-use page faults
+        for (int chan = 0; chan < numChannels; ++chan)
+            FloatVectorOperations::clear(ring.getWritePointer(chan), ringSamples);
+
+        fifo.setTotalSize(ringSamples);
+        fifo.reset();
+        channelPointers.calloc((size_t)numChannels);
+
+        bytesPerFrame = numChannels * bits / 8;
+        framesWritten = 0;
+        droppedFrames = 0;
+        peakFill = 0;
+        busyTicks = 0;
+        startTicks = Time::getHighResolutionTicks();
+        stopTicks = 0;
+
+        startThread(6);
+        recording = true;
+        return true;
+    }
+
+    /** Stops taking audio, lets the writer thread flush what's left and closes the files. */
+    void stop()
+    {
+        recording = false;
+
+        // Wait until the audio thread is definitely not in the middle of a copy into the ring
+        while (callbacksInProgress.load() > 0)
+            Thread::yield();
+
+        if (isThreadRunning())
+        {
+            signalThreadShouldExit();
+            stopThread(-1);
+        }
+    }
+
+    bool isRecording() const { return recording.load(); }
+
+    Stats getStats() const
+    {
+        Stats s;
+        s.framesWritten = framesWritten.load();
+        s.bytesWritten = s.framesWritten * bytesPerFrame;
+        s.droppedFrames = droppedFrames.load();
+
+        if (flacEncoder != nullptr)
+        {
+            const auto flac = flacEncoder->getStats();
+            s.framesWritten = flac.framesEncoded;
+            s.bytesWritten = flac.bytesWritten;
+            s.droppedFrames += flac.lostFrames;
+            s.spilledFrames = flac.spilledFrames;
+            s.spillBacklogFrames = flac.spillBacklogFrames;
+        }
+        s.peakRingFill = fifo.getTotalSize() > 0 ? (float)peakFill.load() / (float)fifo.getTotalSize() : 0.0f;
+
+        const auto endTicks = stopTicks.load() != 0 ? stopTicks.load() : Time::getHighResolutionTicks();
+        const auto elapsed = Time::highResolutionTicksToSeconds(endTicks - startTicks);
+        const auto busy = Time::highResolutionTicksToSeconds(busyTicks.load());
+
+        if (elapsed > 0)
+            s.sustainedMBPerSecond = (double)s.bytesWritten / (elapsed * 1024.0 * 1024.0);
+
+        if (busy > 0)
+            s.writeMBPerSecond = (double)s.bytesWritten / (busy * 1024.0 * 1024.0);
+
+        s.writeStalls = writeStalls.getSnapshot();
+        s.ioStalls = ioStalls.getSnapshot();
+
+        return s;
+    }
+
+    //==============================================================================
+    void audioDeviceAboutToStart(AudioIODevice* device) override
+    {
+        stop();
+        sampleRate = device->getCurrentSampleRate();
+        numChannels = device->getActiveInputChannels().countNumberOfSetBits();
+    }
+
+    void audioDeviceStopped() override
+    {
+        stop();
+        sampleRate = 0;
+    }
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels,
+                               int numSamples) override
+    {
+        ++callbacksInProgress;
+
+        if (recording.load())
+        {
+            if (fifo.getFreeSpace() < numSamples)
+            {
+                droppedFrames += numSamples;
+            }
+            else
+            {
+                const auto scope = fifo.write(numSamples);
+
+                for (int chan = 0; chan < ring.getNumChannels(); ++chan)
+                {
+                    const auto* src = chan < numInputChannels ? inputChannelData[chan] : nullptr;
+                    auto* dest = ring.getWritePointer(chan);
+
+                    if (src == nullptr)
+                    {
+                        FloatVectorOperations::clear(dest + scope.startIndex1, scope.blockSize1);
+                        FloatVectorOperations::clear(dest + scope.startIndex2, scope.blockSize2);
+                        continue;
+                    }
+
+                    FloatVectorOperations::copy(dest + scope.startIndex1, src, scope.blockSize1);
+                    FloatVectorOperations::copy(dest + scope.startIndex2, src + scope.blockSize1, scope.blockSize2);
+                }
+
+                const auto fill = fifo.getNumReady() + numSamples;
+
+                if (fill > peakFill.load())
+                    peakFill = fill;
+            }
+        }
+
+        --callbacksInProgress;
+
+        // We need to clear the output buffers, in case they're full of junk..
+        for (int i = 0; i < numOutputChannels; ++i)
+            if (outputChannelData[i] != nullptr)
+                FloatVectorOperations::clear(outputChannelData[i], numSamples);
+    }
+
+private:
+    Options options;
+    double sampleRate = 0.0;
+    int numChannels = 0, bytesPerFrame = 0;
+
+    AudioBuffer<float> ring;
+    AbstractFifo fifo{ 1 };
+    HeapBlock<const float*> channelPointers;
+    std::vector<std::unique_ptr<AudioFormatWriter>> writers;
+    std::unique_ptr<ParallelFlacEncoder> flacEncoder;
+
+    std::atomic<bool> recording{ false };
+    std::atomic<int> callbacksInProgress{ 0 };
+    std::atomic<int64> framesWritten{ 0 }, droppedFrames{ 0 }, busyTicks{ 0 }, stopTicks{ 0 };
+    std::atomic<int> peakFill{ 0 };
+    int64 startTicks = 0;
+    StallHistogram writeStalls, ioStalls;
+
+    void run() override
+    {
+        for (;;)
+        {
+            const auto ready = fifo.getNumReady();
+            const auto finishing = threadShouldExit();
+
+            if (ready == 0 && finishing)
+                break;
+
+            if (ready < options.writeBlockSamples && !finishing)
+            {
+                if (flacEncoder != nullptr)
+                    flacEncoder->scheduleEncoders();
+
+                wait(10);
+                continue;
+            }
+
+            const auto scope = fifo.read(jmin(ready, options.writeBlockSamples));
+            const auto start = Time::getHighResolutionTicks();
+
+            writeFromRing(scope.startIndex1, scope.blockSize1);
+            writeFromRing(scope.startIndex2, scope.blockSize2);
+
+            const auto ticks = Time::getHighResolutionTicks() - start;
+            busyTicks += ticks;
+            framesWritten += scope.blockSize1 + scope.blockSize2;
+
+            // (with FLAC, it's the encoder jobs that record how long each chunk took)
+            if (flacEncoder == nullptr)
+                writeStalls.record(Time::highResolutionTicksToSeconds(ticks) * 1000.0);
+        }
+
+        if (flacEncoder != nullptr)
+        {
+            // Everything is queued or spilled by now, so just wait for the encoders to get through it
+            while (!flacEncoder->isIdle())
+            {
+                flacEncoder->scheduleEncoders();
+                wait(5);
+            }
+        }
+
+        // Closing the writers flushes them and fixes up the headers
+        const auto start = Time::getHighResolutionTicks();
+        writers.clear();
+
+        if (flacEncoder != nullptr)
+            flacEncoder->close();
+
+        busyTicks += Time::getHighResolutionTicks() - start;
+        stopTicks = Time::getHighResolutionTicks();
+    }
+
+    void writeFromRing(int startIndex, int numSamples)
+    {
+        if (numSamples <= 0)
+            return;
+
+        for (int chan = 0; chan < ring.getNumChannels(); ++chan)
+            channelPointers[chan] = ring.getReadPointer(chan, startIndex);
+
+        if (flacEncoder != nullptr)
+        {
+            flacEncoder->write(channelPointers, numSamples);
+            return;
+        }
+
+        if (writers.size() == 1)
+        {
+            writers.front()->writeFromFloatArrays(channelPointers, ring.getNumChannels(), numSamples);
+            return;
+        }
+
+        for (size_t chan = 0; chan < writers.size(); ++chan)
+            writers[chan]->writeFromFloatArrays(channelPointers + chan, 1, numSamples);
+    }
+
+    /** The preallocation is split between the files, as they all grow at the same rate, so
+        64 mono files reserve no more ahead of the data than one polyphonic file would. Each
+        still reserves at least a buffer's worth at a time.
+    */
+    static CaptureFileOutputStream::Options shareCaptureFileOptions(CaptureFileOutputStream::Options o, int numFiles)
+    {
+        if (o.preallocateBytes > 0 && numFiles > 1)
+            o.preallocateBytes = jmax((int64)o.bufferBytes, o.preallocateBytes / numFiles);
+
+        return o;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultichannelRecorder)
+};
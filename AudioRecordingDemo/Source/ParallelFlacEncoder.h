@@ -0,0 +1,366 @@
+#pragma once
+#include "CaptureFileOutputStream.h"
+
+//==============================================================================
+/*  Encodes a multichannel stream into one FLAC file per channel, or per group of
+    up to 8 channels, with the groups encoded in parallel on a ThreadPool.
+
+    write() is called from a single producer thread. It copies each group's
+    channels into that group's own lock-free queue, and a job for the group is
+    put on the pool whenever there is something to encode, so the groups never
+    wait for one another.
+
+    If a group's encoder falls so far behind that its queue is full, the data
+    goes to a raw float spill file next to the output instead of being dropped.
+    The encoder works through that before going back to the queue, so the FLAC
+    file still comes out as one continuous stream once it has caught up. While
+    the spill file is in use, new data for that group keeps going into it.
+
+    Nothing is locked. Only the producer writes the spill file and only the
+    group's job reads it, each with its own stream, and all they share besides
+    the queue are atomic frame counts of how much has been written to the file
+    and how much read back. The producer only goes back to the queue once the job has read
+    everything, so anything in the queue is always older than what's still in
+    the file.
+*/
+class ParallelFlacEncoder
+{
+public:
+    struct Options
+    {
+        int channelsPerFile = 1;        // 1..8, FLAC doesn't do more than 8 channels in one stream
+        int qualityIndex = 5;           // one of FlacAudioFormat::getQualityOptions()
+        int numThreads = 0;             // encoder threads, 0 to leave a couple of cores free
+        int queueChunks = 4;            // how much each group buffers in memory before spilling to disk
+    };
+
+    struct Stats
+    {
+        int64 framesEncoded = 0;        // of the group that's furthest behind
+        int64 bytesWritten = 0;         // FLAC output across all files
+        int64 spilledFrames = 0;        // frames that took the detour through a spill file, summed over groups
+        int64 spillBacklogFrames = 0;   // frames waiting in spill files right now, summed over groups
+        int64 lostFrames = 0;           // only if a spill file couldn't be written either
+    };
+
+    /** Creates all the files up front, named after baseFile with _chNN or _chNN-MM and
+        .flac. Returns nullptr if any of them can't be created. Each group is encoded
+        chunkSamples frames at a time. Stalls in the file I/O and in encoding a chunk are
+        recorded into the histograms, which must outlive the encoder.
+    */
+    static std::unique_ptr<ParallelFlacEncoder> create(const File& baseFile, double sampleRate, int numChannels, int chunkSamples,
+                                                       const Options& options, const CaptureFileOutputStream::Options& captureFile,
+                                                       StallHistogram& ioStalls, StallHistogram& encodeStalls)
+    {
+        std::unique_ptr<ParallelFlacEncoder> encoder(new ParallelFlacEncoder(options, chunkSamples, encodeStalls));
+        const auto perFile = jlimit(1, 8, options.channelsPerFile);
+
+        for (int first = 0; first < numChannels; first += perFile)
+        {
+            const auto num = jmin(perFile, numChannels - first);
+            const auto name = baseFile.getFileNameWithoutExtension() + "_ch" + String(first + 1).paddedLeft('0', 2)
+                                + (num > 1 ? "-" + String(first + num).paddedLeft('0', 2) : String());
+
+            auto group = std::make_unique<Group>(*encoder, first, num);
+            const auto target = baseFile.getSiblingFile(name + ".flac");
+            target.deleteFile();
+
+            auto stream = std::make_unique<CaptureFileOutputStream>(target, captureFile, &ioStalls);
+
+            if (stream->failedToOpen())
+                return nullptr;
+
+            FlacAudioFormat flac;
+            group->writer.reset(flac.createWriterFor(stream.get(), sampleRate, (unsigned int)num, 24, {}, options.qualityIndex));
+
+            if (group->writer == nullptr)
+                return nullptr;
+
+            group->stream = stream.release(); // (the writer owns it now)
+            group->spillFile = baseFile.getSiblingFile(name + ".spill");
+            group->queue.setSize(num, chunkSamples * jmax(2, options.queueChunks));
+            group->queue.clear();
+            group->fifo.setTotalSize(group->queue.getNumSamples());
+            group->chunk.setSize(num, chunkSamples);
+            group->interleaved.calloc((size_t)(num * chunkSamples));
+            group->spillScratch.calloc((size_t)(num * chunkSamples));
+            encoder->groups.push_back(std::move(group));
+        }
+
+        return encoder;
+    }
+
+    ~ParallelFlacEncoder()
+    {
+        close();
+    }
+
+    /** Called from the producer thread only. channelData has one pointer per channel. */
+    void write(const float* const* channelData, int numSamples)
+    {
+        for (auto& group : groups)
+            push(*group, channelData + group->firstChannel, numSamples);
+
+        scheduleEncoders();
+    }
+
+    /** Puts any group that has something to encode on the pool. write() does this too,
+        so this is only needed while waiting for the encoders to finish.
+    */
+    void scheduleEncoders()
+    {
+        for (auto& group : groups)
+            if (group->hasWork() && !pool.contains(group.get()))
+                pool.addJob(group.get(), false);
+    }
+
+    /** True once everything written so far has been encoded. */
+    bool isIdle() const
+    {
+        for (auto& group : groups)
+            if (group->hasWork() || pool.contains(group.get()))
+                return false;
+
+        return true;
+    }
+
+    /** Waits for the jobs, then closes the FLAC files and deletes the spill files. */
+    void close()
+    {
+        pool.removeAllJobs(false, -1);
+
+        for (auto& group : groups)
+        {
+            group->writer.reset();
+            group->stream = nullptr;
+            group->spillIn.reset();
+            group->spillOut.reset();
+            group->spillFile.deleteFile();
+        }
+    }
+
+    Stats getStats() const
+    {
+        Stats s;
+        s.framesEncoded = groups.empty() ? 0 : std::numeric_limits<int64>::max();
+
+        for (auto& group : groups)
+        {
+            s.framesEncoded = jmin(s.framesEncoded, group->framesEncoded.load());
+            s.bytesWritten += group->bytesWritten.load();
+            s.spilledFrames += group->spilledFrames.load();
+            const auto spillRead = group->spillRead.load(); // (first, so it's never more than what's loaded for spillWritten)
+            s.spillBacklogFrames += group->spillWritten.load() - spillRead;
+            s.lostFrames = jmax(s.lostFrames, group->lostFrames.load());
+        }
+
+        return s;
+    }
+
+private:
+    struct Group : public ThreadPoolJob
+    {
+        Group(ParallelFlacEncoder& o, int first, int num)
+            : ThreadPoolJob("FLAC Encoder"), owner(o), firstChannel(first), numChannels(num)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            return owner.encodeNextChunk(*this) ? jobNeedsRunningAgain : jobHasFinished;
+        }
+
+        bool hasWork() const
+        {
+            if (fifo.getNumReady() > 0)
+                return true;
+
+            const auto read = spillRead.load(); // (first, so it's never more than what's loaded for spillWritten)
+            return spillWritten.load() > read;
+        }
+
+        ParallelFlacEncoder& owner;
+        const int firstChannel, numChannels;
+        std::unique_ptr<AudioFormatWriter> writer;
+        CaptureFileOutputStream* stream = nullptr; // (owned by the writer)
+
+        AudioBuffer<float> queue, chunk;
+        AbstractFifo fifo{ 1 };
+        HeapBlock<float> interleaved; // (the job's)
+
+        File spillFile;
+        std::unique_ptr<FileOutputStream> spillOut; // (the producer's)
+        std::unique_ptr<FileInputStream> spillIn;   // (the job's)
+        HeapBlock<float> spillScratch;              // (the producer's)
+        bool spilling = false;                      // (the producer's)
+
+        // Frame counts since the encoder started. The producer stores spillWritten once the frames are
+        // flushed, and spillStart, the count that the file's first frame has, before that. The job stores
+        // spillRead once it's read them back.
+        std::atomic<int64> spillWritten{ 0 }, spillRead{ 0 }, spillStart{ 0 };
+
+        std::atomic<int64> framesEncoded{ 0 }, bytesWritten{ 0 }, spilledFrames{ 0 }, lostFrames{ 0 };
+    };
+
+    Options options;
+    const int chunkSamples;
+    StallHistogram& encodeStalls;
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Group>> groups;
+
+    ParallelFlacEncoder(const Options& optionsToUse, int chunkSamplesToUse, StallHistogram& encodeStallsToUse)
+        : options(optionsToUse),
+          chunkSamples(chunkSamplesToUse),
+          encodeStalls(encodeStallsToUse),
+          pool(optionsToUse.numThreads > 0 ? optionsToUse.numThreads : jmax(1, SystemStats::getNumCpus() - 2))
+    {
+    }
+
+    void push(Group& group, const float* const* channelData, int numSamples)
+    {
+        // (once the job has read back everything in the spill file, new data can go to the queue again)
+        if (group.spilling && group.spillRead.load() == group.spillWritten.load())
+            group.spilling = false;
+
+        if (!group.spilling && group.fifo.getFreeSpace() >= numSamples)
+        {
+            const auto scope = group.fifo.write(numSamples);
+
+            for (int chan = 0; chan < group.numChannels; ++chan)
+            {
+                auto* dest = group.queue.getWritePointer(chan);
+                FloatVectorOperations::copy(dest + scope.startIndex1, channelData[chan], scope.blockSize1);
+                FloatVectorOperations::copy(dest + scope.startIndex2, channelData[chan] + scope.blockSize1, scope.blockSize2);
+            }
+
+            return;
+        }
+
+        // The encoder can't keep up, so from here on this group's data goes to disk until it has caught up
+        if (!group.spilling)
+        {
+            startSpill(group);
+            group.spilling = true;
+        }
+
+        if (!appendToSpill(group, channelData, numSamples))
+            group.lostFrames += numSamples;
+    }
+
+    /** Empties the spill file, which the job has read everything from, before it's used again. */
+    void startSpill(Group& group)
+    {
+        if (group.spillOut == nullptr)
+        {
+            group.spillFile.deleteFile();
+            group.spillOut = group.spillFile.createOutputStream();
+        }
+        else if (group.spillOut->setPosition(0))
+        {
+            group.spillOut->truncate();
+        }
+
+        group.spillStart = group.spillWritten.load();
+    }
+
+    bool appendToSpill(Group& group, const float* const* channelData, int numSamples)
+    {
+        if (group.spillOut == nullptr)
+            return false;
+
+        const auto frameBytes = (int64)group.numChannels * (int64)sizeof(float);
+        const auto end = (group.spillWritten.load() - group.spillStart.load()) * frameBytes;
+
+        for (int done = 0; done < numSamples;)
+        {
+            const auto num = jmin(chunkSamples, numSamples - done);
+
+            for (int i = 0; i < num; ++i)
+                for (int chan = 0; chan < group.numChannels; ++chan)
+                    group.spillScratch[i * group.numChannels + chan] = channelData[chan][done + i];
+
+            if (!group.spillOut->write(group.spillScratch, (size_t)(num * group.numChannels) * sizeof(float)))
+            {
+                group.spillOut->setPosition(end); // (so a partial write doesn't shift what comes after it)
+                return false;
+            }
+
+            done += num;
+        }
+
+        group.spillOut->flush();
+        group.spilledFrames += numSamples;
+        group.spillWritten += numSamples; // (publishes the frames to the job)
+        return true;
+    }
+
+    /** Moves the next chunk for this group into group.chunk, oldest data first. */
+    int takeNextChunk(Group& group)
+    {
+        // Anything still in the queue went in before the spill file was started
+        if (const auto ready = group.fifo.getNumReady())
+        {
+            const auto scope = group.fifo.read(jmin(ready, chunkSamples));
+
+            for (int chan = 0; chan < group.numChannels; ++chan)
+            {
+                auto* src = group.queue.getReadPointer(chan);
+                FloatVectorOperations::copy(group.chunk.getWritePointer(chan), src + scope.startIndex1, scope.blockSize1);
+                FloatVectorOperations::copy(group.chunk.getWritePointer(chan, scope.blockSize1), src + scope.startIndex2, scope.blockSize2);
+            }
+
+            return scope.blockSize1 + scope.blockSize2;
+        }
+
+        const auto written = group.spillWritten.load();
+        const auto read = group.spillRead.load();
+
+        if (read == written)
+            return 0;
+
+        if (group.spillIn == nullptr)
+            group.spillIn = group.spillFile.createInputStream();
+
+        const auto num = (int)jmin((int64)chunkSamples, written - read);
+        const auto bytes = (int)(num * group.numChannels * (int)sizeof(float));
+
+        if (group.spillIn == nullptr
+            || !group.spillIn->setPosition((read - group.spillStart.load()) * group.numChannels * (int64)sizeof(float))
+            || group.spillIn->read(group.interleaved, bytes) != bytes)
+        {
+            // Can't get it back, so give up on what's in there rather than stall the group
+            group.lostFrames += written - read;
+            group.spillRead = written;
+            return 0;
+        }
+
+        for (int chan = 0; chan < group.numChannels; ++chan)
+        {
+            auto* dest = group.chunk.getWritePointer(chan);
+
+            for (int i = 0; i < num; ++i)
+                dest[i] = group.interleaved[i * group.numChannels + chan];
+        }
+
+        group.spillRead = read + num; // (once it's caught up, the producer goes back to the queue)
+        return num;
+    }
+
+    bool encodeNextChunk(Group& group)
+    {
+        const auto num = takeNextChunk(group);
+
+        if (num == 0)
+            return false;
+
+        const auto start = Time::getHighResolutionTicks();
+        group.writer->writeFromFloatArrays(group.chunk.getArrayOfReadPointers(), group.numChannels, num);
+        encodeStalls.record(Time::highResolutionTicksToSeconds(Time::getHighResolutionTicks() - start) * 1000.0);
+
+        group.framesEncoded += num;
+        group.bytesWritten = group.stream->getPosition();
+        return group.hasWork();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ParallelFlacEncoder)
+};
@@ -0,0 +1,176 @@
+#pragma once
+
+//==============================================================================
+/*  An AudioThumbnailCache that also keeps every finished thumbnail on disk, so
+    reopening a recording, even in a later session, shows its waveform straight
+    away instead of scanning the whole file again.
+
+    Thumbnails are keyed by the hash code of the source AudioThumbnail was given.
+    A plain FileInputSource only hashes the file's path, so a file that has been
+    rewritten would get the old waveform back. Files should therefore be opened
+    through createSourceFor(), whose hash code also covers the file's
+    modification time and size, so a rewritten file simply misses the cache.
+
+    Each entry is one file holding a small header and the thumbnail's own
+    compact binary form (AudioThumbnail::saveTo(), 8-bit min/max pairs). It's
+    read back through a MemoryMappedFile, so nothing is copied on the way into
+    the thumbnail and no more RAM is used than the thumbnail itself needs. The
+    least recently used entries are deleted once the directory grows beyond
+    maxBytesOnDisk.
+*/
+class PersistentThumbnailCache : public AudioThumbnailCache
+{
+public:
+    PersistentThumbnailCache(int maxNumThumbsInMemory, const File& directoryToUse, int64 maxBytesOnDiskToUse = 512 * 1024 * 1024)
+        : AudioThumbnailCache(maxNumThumbsInMemory),
+          directory(directoryToUse),
+          maxBytesOnDisk(maxBytesOnDiskToUse)
+    {
+        directory.createDirectory();
+    }
+
+    static File getDefaultDirectory()
+    {
+        return File::getSpecialLocation(File::userApplicationDataDirectory)
+                   .getChildFile("DanteJUCEDemo").getChildFile("Thumbnails");
+    }
+
+    /** A source for AudioThumbnail::setSource() that keys the file by its path, its
+        modification time and its size.
+    */
+    static InputSource* createSourceFor(const File& file)
+    {
+        return new FileSource(file);
+    }
+
+    File getFileFor(int64 hashCode) const
+    {
+        return directory.getChildFile(String::toHexString(hashCode) + ".thumb");
+    }
+
+protected:
+    void saveNewlyFinishedThumbnail(const AudioThumbnailBase& thumb, int64 hashCode) override
+    {
+        MemoryOutputStream data;
+        thumb.saveTo(data);
+
+        const auto target = getFileFor(hashCode);
+        TemporaryFile temp(target);
+
+        {
+            FileOutputStream out(temp.getFile());
+
+            if (out.failedToOpen())
+                return;
+
+            out.writeInt(magic);
+            out.writeInt(formatVersion);
+            out.writeInt64(hashCode);
+            out.writeInt64((int64)data.getDataSize());
+            out.write(data.getData(), data.getDataSize());
+            out.flush();
+
+            if (out.getStatus().failed())
+                return;
+        }
+
+        if (temp.overwriteTargetFileWithTemporary())
+            deleteLeastRecentlyUsed(target);
+    }
+
+    bool loadNewThumb(AudioThumbnailBase& thumb, int64 hashCode) override
+    {
+        const auto file = getFileFor(hashCode);
+
+        if (!file.existsAsFile())
+            return false;
+
+        auto loaded = false;
+
+        {
+            MemoryMappedFile mapped(file, MemoryMappedFile::readOnly);
+
+            if (const auto* data = static_cast<const char*>(mapped.getData()))
+            {
+                const auto size = mapped.getSize();
+
+                if (size >= headerSize
+                    && ByteOrder::littleEndianInt(data) == (uint32)magic
+                    && ByteOrder::littleEndianInt(data + 4) == (uint32)formatVersion
+                    && (int64)ByteOrder::littleEndianInt64(data + 8) == hashCode
+                    && (int64)ByteOrder::littleEndianInt64(data + 16) == (int64)(size - headerSize))
+                {
+                    MemoryInputStream in(data + headerSize, size - headerSize, false);
+                    loaded = thumb.loadFrom(in);
+                }
+            }
+        }
+
+        if (!loaded)
+        {
+            file.deleteFile(); // (a stale or damaged entry, so it'll be rebuilt)
+            return false;
+        }
+
+        file.setLastAccessTime(Time::getCurrentTime());
+        return true;
+    }
+
+private:
+    class FileSource : public FileInputSource
+    {
+    public:
+        explicit FileSource(const File& f) : FileInputSource(f, true), file(f) {}
+
+        int64 hashCode() const override
+        {
+            return FileInputSource::hashCode() ^ (int64)((uint64)file.getSize() * 0x9e3779b97f4a7c15ull);
+        }
+
+    private:
+        const File file;
+    };
+
+    static constexpr int magic = 0x43485444; // "DTHC" when written little-endian
+    static constexpr int formatVersion = 1;
+    static constexpr size_t headerSize = 24; // magic, version, hash code, payload size
+
+    const File directory;
+    const int64 maxBytesOnDisk;
+
+    /** Never deletes the entry that was just written, even if the file times are too coarse
+        to tell it apart from the others.
+    */
+    void deleteLeastRecentlyUsed(const File& newest)
+    {
+        auto entries = directory.findChildFiles(File::findFiles, false, "*.thumb");
+        int64 totalBytes = 0;
+
+        for (auto& f : entries)
+            totalBytes += f.getSize();
+
+        if (totalBytes <= maxBytesOnDisk)
+            return;
+
+        std::sort(entries.begin(), entries.end(), [](const File& a, const File& b)
+        {
+            return jmax(a.getLastAccessTime(), a.getLastModificationTime()) < jmax(b.getLastAccessTime(), b.getLastModificationTime());
+        });
+
+        for (auto& f : entries)
+        {
+            if (totalBytes <= maxBytesOnDisk)
+                break;
+
+            if (f == newest)
+                continue;
+
+            const auto size = f.getSize();
+
+            if (f.deleteFile())
+                totalBytes -= size;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PersistentThumbnailCache)
+};
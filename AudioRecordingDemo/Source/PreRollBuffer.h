@@ -0,0 +1,256 @@
+#pragma once
+
+//==============================================================================
+/*  Keeps the last few seconds of the first few input channels, as many as the
+    recording will write, so it can start with audio from before the button was
+    pressed.
+
+    The storage is allocated once in prepare() and holds packed 24-bit samples
+    unless told otherwise, which takes three quarters of the memory of floats
+    and loses nothing for anything recorded at 24 bits or less.
+
+    The audio thread calls push() on every block while nothing is recording. To
+    start a recording, claim() marks the buffer as taken, and it keeps filling
+    until the audio thread calls freeze() on the block where live recording
+    begins, at the exact sample where the file continues. That way the pre-roll
+    and the live audio join up without a gap or an overlap, even if the recording
+    was armed to start at a later sample. From then on push() does nothing until
+    the recording has read the pre-roll back out and called release().
+*/
+class PreRollBuffer
+{
+public:
+    PreRollBuffer() = default;
+
+    /** Allocates and clears the storage. Must not be called while push() can run. */
+    void prepare(int newNumChannels, int lengthInSamples, bool storeAsInt24)
+    {
+        numChannels = jmax(0, newNumChannels);
+        length = jmax(0, lengthInSamples);
+        bytesPerSample = storeAsInt24 ? 3 : (int)sizeof(float);
+
+        const auto bytes = (size_t)numChannels * (size_t)length * (size_t)bytesPerSample;
+        storage.malloc(jmax((size_t)1, bytes));
+        zeromem(storage, bytes); // (touches every page now rather than in the audio callback)
+
+        writePos = 0;
+        numValid = 0;
+        state = filling;
+    }
+
+    int getNumChannels() const noexcept { return numChannels; }
+    int getLength() const noexcept { return length; }
+
+    //==============================================================================
+    /** Audio thread. Channels beyond numInputChannels, or null ones, are stored as silence. */
+    void push(const float* const* inputChannelData, int numInputChannels, int numSamples) noexcept
+    {
+        if (state.load() == frozen || length == 0 || numSamples <= 0)
+            return;
+
+        // Only the newest samples of a block longer than the whole buffer are worth keeping
+        const auto skip = jmax(0, numSamples - length);
+        const auto num = numSamples - skip;
+        const auto num1 = jmin(num, length - writePos);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            const auto* src = chan < numInputChannels ? inputChannelData[chan] : nullptr;
+
+            if (src == nullptr)
+            {
+                zeromem(getSample(chan, writePos), (size_t)(num1 * bytesPerSample));
+                zeromem(getSample(chan, 0), (size_t)((num - num1) * bytesPerSample));
+                continue;
+            }
+
+            store(chan, writePos, src + skip, num1);
+            store(chan, 0, src + skip + num1, num - num1);
+        }
+
+        writePos = (writePos + num) % length;
+        numValid = jmin(numValid + num, length);
+    }
+
+    /** Stops filling if the buffer has been claimed, so that what it holds ends with the
+        last sample pushed. Returns false if it hadn't been claimed.
+    */
+    bool freeze() noexcept
+    {
+        auto expected = claimed;
+        return state.compare_exchange_strong(expected, frozen);
+    }
+
+    //==============================================================================
+    /** Reserves the buffer for a recording that's about to start. Returns false if a
+        previous recording hasn't released it yet.
+    */
+    bool claim()
+    {
+        auto expected = filling;
+        return state.compare_exchange_strong(expected, claimed);
+    }
+
+    bool isFrozen() const noexcept { return state.load() == frozen; }
+
+    /** Copies part of the frozen pre-roll out as floats. Sample 0 is the oldest of the
+        getLength() samples; anything from before the buffer started filling is silence.
+    */
+    void read(float* const* dest, int numDestChannels, int startSample, int numSamples) const
+    {
+        jassert(isFrozen());
+
+        for (int chan = 0; chan < numDestChannels; ++chan)
+        {
+            for (int i = 0; i < numSamples;)
+            {
+                const auto age = length - (startSample + i); // samples before the freeze
+                const auto ringIndex = (writePos - age + length) % length;
+                const auto num = jmin(numSamples - i, length - ringIndex);
+
+                if (chan >= numChannels || age > numValid)
+                {
+                    // (older than anything recorded; runs up to where the valid part starts)
+                    const auto silent = chan >= numChannels ? numSamples - i : jmin(numSamples - i, age - numValid);
+                    FloatVectorOperations::clear(dest[chan] + i, silent);
+                    i += silent;
+                    continue;
+                }
+
+                load(chan, ringIndex, dest[chan] + i, num);
+                i += num;
+            }
+        }
+    }
+
+    /** Lets the buffer start filling again from empty, once the recording that claimed it
+        has read what it needs, or has finished without ever starting.
+    */
+    void release()
+    {
+        auto expected = claimed;
+
+        if (state.compare_exchange_strong(expected, filling))
+            return;
+
+        if (state.load() == frozen)
+        {
+            writePos = 0;
+            numValid = 0;
+            state = filling;
+        }
+    }
+
+private:
+    enum State { filling, claimed, frozen };
+
+    HeapBlock<char> storage;
+    int numChannels = 0, length = 0, bytesPerSample = 3;
+    int writePos = 0, numValid = 0; // (only touched by the audio thread until it's frozen)
+    std::atomic<State> state{ filling };
+
+    using FloatData = AudioData::Pointer<AudioData::Float32, AudioData::NativeEndian, AudioData::NonInterleaved, AudioData::Const>;
+    using FloatDest = AudioData::Pointer<AudioData::Float32, AudioData::NativeEndian, AudioData::NonInterleaved, AudioData::NonConst>;
+    using PackedData = AudioData::Pointer<AudioData::Int24, AudioData::LittleEndian, AudioData::NonInterleaved, AudioData::Const>;
+    using PackedDest = AudioData::Pointer<AudioData::Int24, AudioData::LittleEndian, AudioData::NonInterleaved, AudioData::NonConst>;
+
+    char* getSample(int chan, int index) const noexcept
+    {
+        return storage + ((size_t)chan * (size_t)length + (size_t)index) * (size_t)bytesPerSample;
+    }
+
+    void store(int chan, int index, const float* src, int num) noexcept
+    {
+        if (num <= 0)
+            return;
+
+        if (bytesPerSample == 3)
+            PackedDest(getSample(chan, index)).convertSamples(FloatData(src), num);
+        else
+            FloatVectorOperations::copy(reinterpret_cast<float*>(getSample(chan, index)), src, num);
+    }
+
+    void load(int chan, int index, float* dest, int num) const noexcept
+    {
+        if (bytesPerSample == 3)
+            FloatDest(dest).convertSamples(PackedData(getSample(chan, index)), num);
+        else
+            FloatVectorOperations::copy(dest, reinterpret_cast<const float*>(getSample(chan, index)), num);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PreRollBuffer)
+};
+
+//==============================================================================
+/*  Wraps the writer for a recording that has claimed a PreRollBuffer. Before the
+    first live block is passed on, the whole pre-roll is written, so it lands in
+    the file immediately ahead of the live audio. This all happens on whichever
+    thread drives the writer, e.g. a ThreadedWriter's background thread.
+*/
+class PreRollAudioFormatWriter : public AudioFormatWriter
+{
+public:
+    /** If a thumbnail is given, the pre-roll is added to it at position 0, so the
+        live audio should be added from getLength() samples onwards.
+    */
+    PreRollAudioFormatWriter(std::unique_ptr<AudioFormatWriter> writerToWrap, PreRollBuffer& claimedBuffer,
+                             AudioThumbnail* thumbnailToUpdate = nullptr)
+        : AudioFormatWriter(nullptr, writerToWrap->getFormatName(), writerToWrap->getSampleRate(),
+                            writerToWrap->getNumChannels(), (unsigned int)writerToWrap->getBitsPerSample()),
+          writer(std::move(writerToWrap)),
+          preRoll(claimedBuffer),
+          thumbnail(thumbnailToUpdate)
+    {
+        usesFloatingPointData = writer->isFloatingPoint();
+    }
+
+    ~PreRollAudioFormatWriter() override
+    {
+        // (a recording that stopped before any live audio arrived still gets its pre-roll)
+        writePreRoll();
+        preRoll.release();
+    }
+
+    bool write(const int** samplesToWrite, int numSamples) override
+    {
+        writePreRoll();
+        return writer->write(samplesToWrite, numSamples);
+    }
+
+    bool flush() override
+    {
+        return writer->flush();
+    }
+
+private:
+    std::unique_ptr<AudioFormatWriter> writer;
+    PreRollBuffer& preRoll;
+    AudioThumbnail* thumbnail;
+    bool done = false;
+
+    void writePreRoll()
+    {
+        if (done)
+            return;
+
+        done = true;
+
+        if (!preRoll.isFrozen())
+            return;
+
+        const auto chunkSize = 8192;
+        AudioBuffer<float> chunk((int)numChannels, chunkSize);
+
+        for (int pos = 0; pos < preRoll.getLength(); pos += chunkSize)
+        {
+            const auto num = jmin(chunkSize, preRoll.getLength() - pos);
+            preRoll.read(chunk.getArrayOfWritePointers(), chunk.getNumChannels(), pos, num);
+            writer->writeFromFloatArrays(chunk.getArrayOfReadPointers(), chunk.getNumChannels(), num);
+
+            if (thumbnail != nullptr)
+                thumbnail->addBlock(pos, chunk, 0, num);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PreRollAudioFormatWriter)
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+//==============================================================================
+/*  An AudioFormatWriter that splits one continuous stream into a numbered series
+    of files, each exactly segmentLengthSamples long, without losing or repeating a
+    sample at the joins. It's meant to be wrapped in an
+    AudioFormatWriter::ThreadedWriter, so all of the following happens on the
+    ThreadedWriter's thread, never on the audio thread:
+
+    - The next segment's file is opened as soon as the current one has started,
+      so switching over is just swapping two pointers at the exact sample index.
+    - The finished segment is handed to a separate thread, which lets its writer
+      flush and fix up the header, so a slow close doesn't hold up the stream.
+    - After each segment is finished, the oldest ones are deleted if there are
+      more than the retention policy allows.
+
+    If the next file can't be opened, the current segment just carries on for
+    another segment length and opening is tried again then, so no audio is lost.
+*/
+class SegmentedAudioFormatWriter : public AudioFormatWriter,
+                                   private Thread
+{
+public:
+    /** Creates the writer for one segment. firstSample is where the segment starts,
+        counted from the start of the stream. Called on the writer thread.
+    */
+    using WriterFactory = std::function<std::unique_ptr<AudioFormatWriter>(const File& file, int64 firstSample)>;
+
+    struct Retention
+    {
+        int maxSegments = 0;        // finished segments kept on disk, 0 for no limit
+        int64 maxTotalBytes = 0;    // across all finished segments, 0 for no limit
+    };
+
+    /** Segment n of the series is written to the file baseFile would have, with _nnnn
+        appended to its name. Returns nullptr if the first segment can't be created.
+    */
+    static std::unique_ptr<SegmentedAudioFormatWriter> create(const File& baseFile, int64 segmentLengthSamples,
+                                                              WriterFactory factory, Retention retention)
+    {
+        jassert(segmentLengthSamples > 0 && factory != nullptr);
+
+        auto firstFile = getSegmentFile(baseFile, 0);
+        auto first = factory(firstFile, 0);
+
+        if (first == nullptr)
+            return nullptr;
+
+        return std::unique_ptr<SegmentedAudioFormatWriter>(new SegmentedAudioFormatWriter(baseFile, segmentLengthSamples,
+                                                                                          std::move(factory), retention,
+                                                                                          std::move(first), firstFile));
+    }
+
+    ~SegmentedAudioFormatWriter() override
+    {
+        if (current != nullptr)
+            finishSegment(std::move(current), currentFile);
+
+        if (next != nullptr)
+        {
+            // (opened early but never used)
+            next.reset();
+            nextFile.deleteFile();
+        }
+
+        signalThreadShouldExit();
+        notify();
+        stopThread(-1);
+    }
+
+    static File getSegmentFile(const File& baseFile, int index)
+    {
+        return baseFile.getSiblingFile(baseFile.getFileNameWithoutExtension() + "_" + String(index).paddedLeft('0', 4)
+                                       + baseFile.getFileExtension());
+    }
+
+    int getCurrentSegmentIndex() const noexcept { return segmentIndex.load(); }
+    int getNumSegmentsFinished() const noexcept { return segmentsFinished.load(); }
+    int getNumSegmentsDeleted() const noexcept { return segmentsDeleted.load(); }
+
+    //==============================================================================
+    bool write(const int** samplesToWrite, int numSamples) override
+    {
+        auto ok = true;
+
+        for (int done = 0; done < numSamples;)
+        {
+            if (samplesInSegment >= segmentLimit)
+                switchToNextSegment();
+
+            const auto num = (int)jmin((int64)(numSamples - done), segmentLimit - samplesInSegment);
+
+            for (int chan = 0; chan < (int)numChannels; ++chan)
+                offsetChannels[chan] = samplesToWrite[chan] != nullptr ? samplesToWrite[chan] + done : nullptr;
+
+            ok = current->write(offsetChannels, num) && ok;
+            samplesInSegment += num;
+            streamPosition += num;
+            done += num;
+        }
+
+        if (next == nullptr && !nextFailed)
+            openNextSegment();
+
+        return ok;
+    }
+
+    bool flush() override
+    {
+        return current != nullptr && current->flush();
+    }
+
+private:
+    File baseFile;
+    const int64 segmentLength;
+    WriterFactory factory;
+    const Retention retention;
+
+    std::unique_ptr<AudioFormatWriter> current, next;
+    File currentFile, nextFile;
+    int64 samplesInSegment = 0, segmentLimit = 0, streamPosition = 0;
+    bool nextFailed = false;
+    HeapBlock<const int*> offsetChannels;
+
+    CriticalSection finishLock; // (the writer thread and the finishing thread only)
+    std::vector<std::pair<std::unique_ptr<AudioFormatWriter>, File>> toFinish;
+    Array<File> finishedSegments;
+
+    std::atomic<int> segmentIndex{ 0 }, segmentsFinished{ 0 }, segmentsDeleted{ 0 };
+
+    SegmentedAudioFormatWriter(const File& base, int64 segmentLengthSamples, WriterFactory factoryToUse, Retention retentionToUse,
+                               std::unique_ptr<AudioFormatWriter> firstSegment, const File& firstFile)
+        : AudioFormatWriter(nullptr, firstSegment->getFormatName(), firstSegment->getSampleRate(),
+                            firstSegment->getNumChannels(), (unsigned int)firstSegment->getBitsPerSample()),
+          Thread("Segment Finishing Thread"),
+          baseFile(base),
+          segmentLength(segmentLengthSamples),
+          factory(std::move(factoryToUse)),
+          retention(retentionToUse),
+          current(std::move(firstSegment)),
+          currentFile(firstFile),
+          segmentLimit(segmentLengthSamples)
+    {
+        // Samples are passed straight through, so they have to be in the form the segments expect
+        usesFloatingPointData = current->isFloatingPoint();
+        offsetChannels.calloc(numChannels + 1);
+        startThread(3);
+    }
+
+    void openNextSegment()
+    {
+        nextFile = getSegmentFile(baseFile, segmentIndex.load() + 1);
+        nextFile.deleteFile();
+        next = factory(nextFile, streamPosition - samplesInSegment + segmentLimit);
+        nextFailed = next == nullptr;
+    }
+
+    void switchToNextSegment()
+    {
+        if (next == nullptr)
+            openNextSegment();
+
+        if (next == nullptr)
+        {
+            // Rather than lose anything, carry on in this file and try again a segment later
+            segmentLimit += segmentLength;
+            nextFailed = false;
+            return;
+        }
+
+        finishSegment(std::move(current), currentFile);
+
+        current = std::move(next);
+        currentFile = nextFile;
+        ++segmentIndex;
+        samplesInSegment = 0;
+        segmentLimit = segmentLength;
+        nextFailed = false;
+    }
+
+    void finishSegment(std::unique_ptr<AudioFormatWriter> writer, const File& file)
+    {
+        {
+            const ScopedLock sl(finishLock);
+            toFinish.emplace_back(std::move(writer), file);
+        }
+
+        notify();
+    }
+
+    void run() override
+    {
+        for (;;)
+        {
+            decltype(toFinish) batch;
+
+            {
+                const ScopedLock sl(finishLock);
+                batch.swap(toFinish);
+            }
+
+            for (auto& segment : batch)
+            {
+                segment.first.reset(); // (flushes it and writes the final header)
+                finishedSegments.add(segment.second);
+                ++segmentsFinished;
+            }
+
+            if (!batch.empty())
+                applyRetention();
+
+            if (threadShouldExit())
+            {
+                const ScopedLock sl(finishLock);
+
+                if (toFinish.empty())
+                    break;
+
+                continue;
+            }
+
+            wait(-1);
+        }
+    }
+
+    void applyRetention()
+    {
+        int64 totalBytes = 0;
+
+        for (auto& f : finishedSegments)
+            totalBytes += f.getSize();
+
+        while (finishedSegments.size() > 0
+               && ((retention.maxSegments > 0 && finishedSegments.size() > retention.maxSegments)
+                   || (retention.maxTotalBytes > 0 && totalBytes > retention.maxTotalBytes)))
+        {
+            const auto oldest = finishedSegments.removeAndReturn(0);
+            totalBytes -= oldest.getSize();
+
+            if (oldest.deleteFile())
+                ++segmentsDeleted;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SegmentedAudioFormatWriter)
+};
@@ -0,0 +1,408 @@
+#pragma once
+
+//==============================================================================
+/*  Spectra of many channels at once, worked out on a thread of its own.
+
+    The audio thread only copies each block into a lock-free FIFO. A worker
+    thread wakes up once per frame, moves whatever has arrived into a sliding
+    window of the last fftSize samples per channel, and for each channel runs a
+    Hann-windowed dsp::FFT::performFrequencyOnlyForwardTransform() over it, so
+    consecutive frames overlap by however much less than fftSize has come in
+    since the last one. The window table and the mapping from FFT bins to
+    logarithmically spaced bands are worked out once, in prepare().
+
+    Each band holds the loudest bin it covers, as a 0..1 proportion of the
+    decibel range, with a falling decay, so what the UI gets is ready to draw.
+    The bands of all channels are published through a triple buffer like the
+    one in LevelSnapshots, so the worker and the UI never wait for each other.
+*/
+class MultichannelSpectrumAnalyser : private Thread
+{
+public:
+    struct Options
+    {
+        int fftOrder = 11;                  // 2048 points
+        int numBands = 128;
+        float minFrequency = 20.0f;
+        float minDecibels = -100.0f;        // the bottom of the 0..1 range
+        int framesPerSecond = 60;
+        float decayDecibelsPerSecond = 60.0f;
+    };
+
+    MultichannelSpectrumAnalyser() : Thread("Spectrum Analyser") {}
+
+    ~MultichannelSpectrumAnalyser() override
+    {
+        stop();
+    }
+
+    /** Stops the worker, allocates everything for the given layout and starts it again.
+        Must not be called while push(), update() or getBands() can run.
+    */
+    void prepare(int newNumChannels, double newSampleRate, const Options& newOptions)
+    {
+        stop();
+
+        options = newOptions;
+        numChannels = jmax(0, newNumChannels);
+        numBands = jmax(1, options.numBands);
+        sampleRate = newSampleRate;
+
+        fft = std::make_unique<dsp::FFT>(options.fftOrder);
+        const auto fftSize = fft->getSize();
+
+        window.malloc((size_t)fftSize);
+        dsp::WindowingFunction<float>::fillWindowingTables(window, (size_t)fftSize, dsp::WindowingFunction<float>::hann, true);
+        fftData.calloc((size_t)(2 * fftSize));
+
+        // Enough for a few frames, in case the worker gets held up
+        const auto fifoSize = jmax(4 * fftSize, sampleRate > 0 ? roundToInt(sampleRate / 4) : 0);
+        fifoBuffer.setSize(jmax(1, numChannels), fifoSize);
+        fifoBuffer.clear();
+        fifo.setTotalSize(fifoSize);
+        fifo.reset();
+
+        history.setSize(jmax(1, numChannels), fftSize);
+        history.clear();
+        historyPos = 0;
+        newSamples = 0;
+        droppedSamples = 0;
+
+        prepareBands();
+
+        smoothed.calloc((size_t)(numChannels * numBands + 1));
+        slots.calloc((size_t)(3 * numChannels * numBands + 1));
+        back = 0;
+        front = 2;
+        middle = 1;
+
+        if (numChannels > 0 && sampleRate > 0)
+            startThread(4);
+    }
+
+    void prepare(int newNumChannels, double newSampleRate)
+    {
+        prepare(newNumChannels, newSampleRate, Options());
+    }
+
+    void stop()
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread(2000);
+    }
+
+    int getNumChannels() const noexcept { return numChannels; }
+    int getNumBands() const noexcept { return numBands; }
+
+    /** The lowest frequency a band covers. */
+    float getBandFrequency(int band) const noexcept
+    {
+        return options.minFrequency * std::pow((float)(sampleRate / 2.0) / options.minFrequency, (float)band / (float)numBands);
+    }
+
+    int64 getNumDroppedSamples() const noexcept { return droppedSamples.load(); }
+
+    //==============================================================================
+    /** Audio thread. Just a copy into the FIFO; if the worker is that far behind, the
+        block is dropped.
+    */
+    void push(const float* const* channelData, int numInputChannels, int numSamples) noexcept
+    {
+        if (numChannels == 0 || numSamples <= 0)
+            return;
+
+        if (fifo.getFreeSpace() < numSamples)
+        {
+            droppedSamples += numSamples;
+            return;
+        }
+
+        const auto scope = fifo.write(numSamples);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            auto* dest = fifoBuffer.getWritePointer(chan);
+            const auto* src = chan < numInputChannels ? channelData[chan] : nullptr;
+
+            if (src == nullptr)
+            {
+                FloatVectorOperations::clear(dest + scope.startIndex1, scope.blockSize1);
+                FloatVectorOperations::clear(dest + scope.startIndex2, scope.blockSize2);
+                continue;
+            }
+
+            FloatVectorOperations::copy(dest + scope.startIndex1, src, scope.blockSize1);
+            FloatVectorOperations::copy(dest + scope.startIndex2, src + scope.blockSize1, scope.blockSize2);
+        }
+    }
+
+    /** Message thread. Takes the latest frame if there's a new one, and returns whether
+        there was.
+    */
+    bool update() noexcept
+    {
+        if ((middle.load() & newData) == 0)
+            return false;
+
+        front = middle.exchange(front) & indexMask;
+        return true;
+    }
+
+    /** getNumBands() values from 0 to 1, lowest frequency first, from the frame that
+        update() last took.
+    */
+    const float* getBands(int channel) const noexcept
+    {
+        jassert(isPositiveAndBelow(channel, numChannels));
+        return slots + (front * numChannels + channel) * numBands;
+    }
+
+private:
+    static constexpr int indexMask = 3, newData = 4;
+
+    Options options;
+    int numChannels = 0, numBands = 1;
+    double sampleRate = 0.0;
+
+    std::unique_ptr<dsp::FFT> fft;
+    HeapBlock<float> window, fftData;
+
+    AudioBuffer<float> fifoBuffer;
+    AbstractFifo fifo{ 1 };
+    std::atomic<int64> droppedSamples{ 0 };
+
+    AudioBuffer<float> history; // the last fftSize samples of each channel, as a ring
+    int historyPos = 0, newSamples = 0;
+
+    HeapBlock<int> bandStart, bandEnd; // FFT bin range of each band
+    HeapBlock<float> smoothed;
+
+    HeapBlock<float> slots; // three frames of numChannels * numBands
+    int back = 0, front = 2; // (each only ever touched by its own side)
+    std::atomic<int> middle{ 1 };
+
+    void prepareBands()
+    {
+        const auto fftSize = fft->getSize();
+        const auto binsPerHz = fftSize / jmax(1.0, sampleRate);
+
+        bandStart.malloc((size_t)numBands);
+        bandEnd.malloc((size_t)numBands);
+
+        for (int band = 0; band < numBands; ++band)
+        {
+            // (at the bottom, several bands can fall inside one bin, so they share it)
+            const auto start = jlimit(1, fftSize / 2 - 1, (int)(getBandFrequency(band) * binsPerHz));
+            const auto end = jlimit(start + 1, fftSize / 2, (int)std::ceil(getBandFrequency(band + 1) * binsPerHz));
+
+            bandStart[band] = start;
+            bandEnd[band] = end;
+        }
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            const auto frameStart = Time::getMillisecondCounterHiRes();
+
+            if (takeNewSamples())
+            {
+                analyse();
+                back = middle.exchange(back | newData) & indexMask;
+            }
+
+            const auto elapsed = Time::getMillisecondCounterHiRes() - frameStart;
+            wait(jmax(1, roundToInt(1000.0 / jmax(1, options.framesPerSecond) - elapsed)));
+        }
+    }
+
+    bool takeNewSamples()
+    {
+        const auto ready = fifo.getNumReady();
+
+        if (ready == 0)
+            return false;
+
+        const auto scope = fifo.read(ready);
+        appendToHistory(scope.startIndex1, scope.blockSize1);
+        appendToHistory(scope.startIndex2, scope.blockSize2);
+        return true;
+    }
+
+    void appendToHistory(int fifoIndex, int num)
+    {
+        const auto size = history.getNumSamples();
+
+        // Anything older than the last fftSize samples would be overwritten anyway
+        const auto skip = jmax(0, num - size);
+        fifoIndex += skip;
+        num -= skip;
+
+        const auto num1 = jmin(num, size - historyPos);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            const auto* src = fifoBuffer.getReadPointer(chan, fifoIndex);
+            auto* dest = history.getWritePointer(chan);
+
+            FloatVectorOperations::copy(dest + historyPos, src, num1);
+            FloatVectorOperations::copy(dest, src + num1, num - num1);
+        }
+
+        historyPos = (historyPos + num) % size;
+    }
+
+    void analyse()
+    {
+        const auto fftSize = fft->getSize();
+        const auto normalise = 2.0f / (float)fftSize; // (a full-scale sine comes out at 0 dB with the normalised window)
+        const auto range = -options.minDecibels;
+        const auto decay = options.decayDecibelsPerSecond / (float)jmax(1, options.framesPerSecond) / range;
+        auto* frame = slots + back * numChannels * numBands;
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            // Unroll the ring, oldest sample first, and window it
+            const auto* src = history.getReadPointer(chan);
+            FloatVectorOperations::copy(fftData, src + historyPos, fftSize - historyPos);
+            FloatVectorOperations::copy(fftData + fftSize - historyPos, src, historyPos);
+            FloatVectorOperations::multiply(fftData, window, fftSize);
+
+            fft->performFrequencyOnlyForwardTransform(fftData, true);
+
+            auto* levels = smoothed + chan * numBands;
+            auto* out = frame + chan * numBands;
+
+            for (int band = 0; band < numBands; ++band)
+            {
+                const auto peak = FloatVectorOperations::findMaximum(fftData + bandStart[band], bandEnd[band] - bandStart[band]);
+                const auto db = Decibels::gainToDecibels(peak * normalise, options.minDecibels);
+                const auto level = (db - options.minDecibels) / range;
+
+                levels[band] = jmax(level, levels[band] - decay);
+                out[band] = levels[band];
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MultichannelSpectrumAnalyser)
+};
+
+//==============================================================================
+/*  Shows the spectrum of every active input of the device it's attached to, as a
+    grid of small panels. It repaints at most once per frame the analyser has
+    produced, and everything is drawn with one fillRectList() call.
+*/
+class SpectrumAnalyserComponent : public Component,
+                                  public AudioIODeviceCallback,
+                                  private Timer
+{
+public:
+    SpectrumAnalyserComponent()
+    {
+        setOpaque(true);
+        startTimerHz(60);
+    }
+
+    ~SpectrumAnalyserComponent() override
+    {
+        stopTimer();
+    }
+
+    //==============================================================================
+    void audioDeviceAboutToStart(AudioIODevice* device) override
+    {
+        const ScopedLock sl(analyserLock);
+        analyser.prepare(device->getActiveInputChannels().countNumberOfSetBits(), device->getCurrentSampleRate());
+    }
+
+    void audioDeviceStopped() override
+    {
+        const ScopedLock sl(analyserLock);
+        analyser.prepare(0, 0.0);
+    }
+
+    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
+                               float** outputChannelData, int numOutputChannels,
+                               int numSamples) override
+    {
+        analyser.push(inputChannelData, numInputChannels, numSamples);
+
+        // We need to clear the output buffers, in case they're full of junk..
+        for (int i = 0; i < numOutputChannels; ++i)
+            if (outputChannelData[i] != nullptr)
+                FloatVectorOperations::clear(outputChannelData[i], numSamples);
+    }
+
+    //==============================================================================
+    void paint(Graphics& g) override
+    {
+        g.fillAll(Colour(0xff101418));
+
+        const ScopedLock sl(analyserLock);
+        const auto num = analyser.getNumChannels();
+
+        if (num == 0 || !hasFrame)
+        {
+            g.setColour(Colours::grey);
+            g.setFont(14.0f);
+            g.drawFittedText("(No spectrum yet)", getLocalBounds(), Justification::centred, 1);
+            return;
+        }
+
+        // Roughly square panels, as many as it takes
+        const auto area = getLocalBounds().reduced(2).toFloat();
+        const auto columns = jlimit(1, num, (int)std::ceil(std::sqrt(num * area.getWidth() / jmax(1.0f, area.getHeight()))));
+        const auto rows = (num + columns - 1) / columns;
+        const auto panelWidth = area.getWidth() / (float)columns;
+        const auto panelHeight = area.getHeight() / (float)rows;
+        const auto numBands = analyser.getNumBands();
+
+        RectangleList<float> panels, bars;
+        bars.ensureStorageAllocated(num * numBands);
+
+        for (int chan = 0; chan < num; ++chan)
+        {
+            const auto panel = Rectangle<float>(area.getX() + (float)(chan % columns) * panelWidth,
+                                                area.getY() + (float)(chan / columns) * panelHeight,
+                                                panelWidth, panelHeight).reduced(1.0f);
+            panels.addWithoutMerging(panel);
+
+            const auto* bands = analyser.getBands(chan);
+            const auto bandWidth = panel.getWidth() / (float)numBands;
+
+            for (int band = 0; band < numBands; ++band)
+            {
+                const auto height = jlimit(0.0f, 1.0f, bands[band]) * panel.getHeight();
+
+                if (height >= 0.5f)
+                    bars.addWithoutMerging({ panel.getX() + (float)band * bandWidth, panel.getBottom() - height, bandWidth, height });
+            }
+        }
+
+        g.setColour(Colour(0xff1c242c));
+        g.fillRectList(panels);
+        g.setColour(Colours::skyblue);
+        g.fillRectList(bars);
+    }
+
+private:
+    CriticalSection analyserLock; // (the message thread and the device starting or stopping, never the audio callback)
+    MultichannelSpectrumAnalyser analyser;
+    bool hasFrame = false;
+
+    void timerCallback() override
+    {
+        const ScopedLock sl(analyserLock);
+
+        if (analyser.update())
+        {
+            hasFrame = true;
+            repaint();
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SpectrumAnalyserComponent)
+};
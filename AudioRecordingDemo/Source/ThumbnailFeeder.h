@@ -0,0 +1,132 @@
+#pragma once
+
+//==============================================================================
+/*  Builds an AudioThumbnail from live audio without doing any of the work on the
+    audio thread.
+
+    push() only copies the block into a preallocated ring. A TimeSliceClient on a
+    background thread takes it out again in whole thumbnail buckets and passes them
+    to AudioThumbnail::addBlock(), so every bucket's min/max comes from one
+    vectorised FloatVectorOperations::findMinAndMax() over the full bucket, and the
+    thumbnail's allocations and lock stay off the audio thread. (Adding a block that
+    doesn't start and end on bucket boundaries makes the thumbnail overwrite the
+    partly filled bucket, which is what feeding it straight from the callback did.)
+
+    If the background thread falls behind by more than the ring, whole blocks are
+    dropped and counted, which leaves a gap at the end of the thumbnail.
+*/
+class ThumbnailFeeder : private TimeSliceClient
+{
+public:
+    /** samplesPerThumbSample must match the value the thumbnail was created with. */
+    ThumbnailFeeder(AudioThumbnail& thumbnailToFeed, TimeSliceThread& threadToUse,
+                    int samplesPerThumbSample = 512, int ringBuckets = 512)
+        : thumbnail(thumbnailToFeed),
+          thread(threadToUse),
+          bucketSize(samplesPerThumbSample),
+          ringSize(samplesPerThumbSample * ringBuckets)
+    {
+        thread.addTimeSliceClient(this);
+    }
+
+    ~ThumbnailFeeder() override
+    {
+        thread.removeTimeSliceClient(this);
+    }
+
+    /** Clears the thumbnail and gets ready for a new stream, the first sample of which
+        goes at firstSampleNum. Call this while push() can't be running, e.g. before the
+        audio callback is allowed to use it.
+    */
+    void reset(int newNumChannels, double sampleRate, int64 firstSampleNum = 0)
+    {
+        const ScopedLock sl(consumerLock);
+
+        ring.setSize(jmax(1, newNumChannels), ringSize, false, true, true);
+        ring.clear();
+        fifo.setTotalSize(ringSize);
+        fifo.reset();
+        numChannels = newNumChannels;
+        nextSampleNum = firstSampleNum;
+        droppedSamples = 0;
+        finishing = false;
+
+        thumbnail.reset(newNumChannels, sampleRate);
+    }
+
+    /** The number of channels that push() expects, as passed to reset(). */
+    int getNumChannels() const noexcept { return numChannels; }
+
+    /** Called on the audio thread. This is just a copy into the ring. */
+    void push(const float* const* channelData, int numSamples) noexcept
+    {
+        if (fifo.getFreeSpace() < numSamples)
+        {
+            droppedSamples += numSamples;
+            return;
+        }
+
+        const auto scope = fifo.write(numSamples);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+        {
+            auto* dest = ring.getWritePointer(chan);
+            FloatVectorOperations::copy(dest + scope.startIndex1, channelData[chan], scope.blockSize1);
+            FloatVectorOperations::copy(dest + scope.startIndex2, channelData[chan] + scope.blockSize1, scope.blockSize2);
+        }
+    }
+
+    /** Lets the last, partly filled bucket through once nothing more is being pushed. */
+    void finish()
+    {
+        finishing = true;
+        thread.moveToFrontOfQueue(this);
+    }
+
+    int64 getNumDroppedSamples() const noexcept { return droppedSamples.load(); }
+
+private:
+    AudioThumbnail& thumbnail;
+    TimeSliceThread& thread;
+    const int bucketSize, ringSize;
+
+    CriticalSection consumerLock; // (only taken by reset() and the background thread, never by push())
+    AudioBuffer<float> ring;
+    AbstractFifo fifo{ 1 };
+    int numChannels = 0;
+    int64 nextSampleNum = 0;
+    std::atomic<int64> droppedSamples{ 0 };
+    std::atomic<bool> finishing{ false };
+
+    int useTimeSlice() override
+    {
+        const ScopedLock sl(consumerLock);
+
+        auto ready = fifo.getNumReady();
+
+        // The ring is a whole number of buckets long, so as long as only whole buckets are
+        // taken out, every read (and the wrap point) starts on a bucket boundary
+        if (!finishing.load())
+            ready -= ready % bucketSize;
+
+        if (ready <= 0)
+            return 20;
+
+        const auto scope = fifo.read(ready);
+        addToThumbnail(scope.startIndex1, scope.blockSize1);
+        addToThumbnail(scope.startIndex2, scope.blockSize2);
+        return 10;
+    }
+
+    void addToThumbnail(int startIndex, int numSamples)
+    {
+        if (numSamples <= 0)
+            return;
+
+        AudioBuffer<float> block(ring.getArrayOfWritePointers(), numChannels, startIndex, numSamples);
+        thumbnail.addBlock(nextSampleNum, block, 0, numSamples);
+        nextSampleNum += numSamples;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ThumbnailFeeder)
+};
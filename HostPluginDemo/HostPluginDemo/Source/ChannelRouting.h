@@ -0,0 +1,236 @@
+#pragma once
+
+//==============================================================================
+/*  An AudioBuffer that refers to channel data owned by something else, and can be
+    pointed at different channels every block without allocating.
+
+    An AudioBuffer that's constructed around existing channels, or told to refer to
+    them, allocates its own list of channel pointers once there are more than 31 of
+    them. This one allocates that list, at its largest, in prepare(). refer() only
+    shrinks the buffer within it and then overwrites the pointers.
+*/
+template <typename FloatType>
+class ChannelView
+{
+public:
+    void prepare (int maxNumChannels, int maxNumSamples)
+    {
+        buffer.setSize (jmax (1, maxNumChannels), jmax (1, maxNumSamples));
+        maxChannels = jmax (1, maxNumChannels);
+        maxSamples = jmax (1, maxNumSamples);
+    }
+
+    bool canRefer (int numChannels, int numSamples) const noexcept
+    {
+        return numChannels <= maxChannels && numSamples <= maxSamples;
+    }
+
+    /** Returns a buffer of numSamples whose channels are the ones given. */
+    AudioBuffer<FloatType>& refer (FloatType* const* channels, int numChannels, int numSamples) noexcept
+    {
+        jassert (canRefer (numChannels, numSamples));
+
+        buffer.setNotClear(); // (otherwise setSize() would zero the space the buffer no longer uses)
+        buffer.setSize (numChannels, numSamples, false, false, true);
+
+        auto** pointers = buffer.getArrayOfWritePointers();
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            pointers[ch] = channels[ch];
+
+        return buffer;
+    }
+
+private:
+    AudioBuffer<FloatType> buffer;
+    int maxChannels = 0, maxSamples = 0;
+};
+
+//==============================================================================
+/*  Decides how a hosted plugin's channels line up with the host's, and passes the
+    host's buffer to the plugin accordingly.
+
+    negotiateLayout() asks the plugin to take the host's channel count on its main
+    buses, as the named layout for that count or, failing that, as discrete
+    channels. A plugin that accepts neither keeps the layout it had.
+
+    prepare() then works out, once, where each of the plugin's channels comes from:
+
+    - The channels of its main buses that the host has too are the host's own
+      channels. The plugin works on those in place, with no copying.
+    - Main input channels beyond the host's get a copy of the host's channels,
+      repeated, so e.g. a mono host feeds both sides of a stereo plugin. Whatever
+      the plugin writes to them is dropped.
+    - Everything else, such as a sidechain, gets silence.
+
+    The host's channels that the plugin doesn't have pass through untouched.
+*/
+class ChannelRouting
+{
+public:
+    /** Sets the plugin's main buses to numChannels if it'll take them. Only while it isn't
+        processing.
+    */
+    static void negotiateLayout (AudioPluginInstance& plugin, int numChannels)
+    {
+        const auto current = plugin.getBusesLayout();
+
+        if (current.outputBuses.isEmpty() && current.inputBuses.isEmpty())
+            return;
+
+        for (const auto& set : { AudioChannelSet::canonicalChannelSet (numChannels),
+                                 AudioChannelSet::discreteChannels (numChannels) })
+        {
+            auto layout = current;
+
+            for (auto* buses : { &layout.inputBuses, &layout.outputBuses })
+                if (! buses->isEmpty() && ! buses->getReference (0).isDisabled())
+                    buses->getReference (0) = set;
+
+            if (layout == current || (plugin.checkBusesLayoutSupported (layout) && plugin.setBusesLayout (layout)))
+                return;
+        }
+    }
+
+    /** Works out the routing for the plugin's current layout, and allocates everything
+        process() will need.
+    */
+    void prepare (const AudioProcessor& plugin, int numHostChannels, int maxBlockSize)
+    {
+        const auto numInputs = plugin.getTotalNumInputChannels();
+        const auto numOutputs = plugin.getTotalNumOutputChannels();
+        const auto mainInputs = plugin.getMainBusNumInputChannels();
+        const auto mainOutputs = plugin.getMainBusNumOutputChannels();
+
+        numPluginChannels = jmax (numInputs, numOutputs);
+        maxSamples = jmax (1, maxBlockSize);
+        sources.assign ((size_t) numPluginChannels, { Source::silence, 0 });
+
+        // (in JUCE's buffer, the main buses are the first channels on both sides)
+        for (int ch = 0; ch < numPluginChannels; ++ch)
+        {
+            if (ch < jmax (mainInputs, mainOutputs) && ch < numHostChannels)
+                sources[(size_t) ch] = { Source::host, ch };
+            else if (ch < mainInputs && numHostChannels > 0)
+                sources[(size_t) ch] = { Source::copy, ch % numHostChannels };
+        }
+
+        identity = numPluginChannels <= numHostChannels
+                     && std::all_of (sources.begin(), sources.end(), [] (const Source& s) { return s.kind == Source::host; });
+
+        numScratchChannels = (int) std::count_if (sources.begin(), sources.end(), [] (const Source& s) { return s.kind != Source::host; });
+        numHostChannelsUsed = 0;
+
+        for (const auto& s : sources)
+            if (s.kind != Source::silence)
+                numHostChannelsUsed = jmax (numHostChannelsUsed, s.channel + 1);
+
+        floatScratch.setSize (numScratchChannels, numScratchChannels > 0 ? jmax (1, maxBlockSize) : 0);
+        doubleScratch.setSize (plugin.isUsingDoublePrecision() ? numScratchChannels : 0,
+                               plugin.isUsingDoublePrecision() && numScratchChannels > 0 ? jmax (1, maxBlockSize) : 0);
+
+        floatPointers.assign ((size_t) numPluginChannels, nullptr);
+        doublePointers.assign ((size_t) numPluginChannels, nullptr);
+        floatView.prepare (numPluginChannels, maxBlockSize);
+        doubleView.prepare (plugin.isUsingDoublePrecision() ? numPluginChannels : 0, maxBlockSize);
+        pieceMidi.ensureSize (4096);
+    }
+
+    /** Runs the host's buffer through the plugin. Only on the audio thread, with at least
+        as many channels as prepare() was told about.
+    */
+    template <typename FloatType>
+    void process (AudioPluginInstance& plugin, AudioBuffer<FloatType>& buffer, MidiBuffer& midi)
+    {
+        const auto numSamples = buffer.getNumSamples();
+
+        // (the usual case: the plugin has exactly the host's channels)
+        if (identity && numPluginChannels == buffer.getNumChannels())
+        {
+            plugin.processBlock (buffer, midi);
+            return;
+        }
+
+        if (buffer.getNumChannels() < numHostChannelsUsed)
+        {
+            jassertfalse; // (the host's buffer is narrower than the one this was prepared for)
+            return;
+        }
+
+        if (numSamples <= maxSamples)
+        {
+            processPiece (plugin, buffer, 0, numSamples, midi);
+            return;
+        }
+
+        // (a block bigger than the host was prepared for goes through in pieces, each with its own MIDI)
+        for (int start = 0; start < numSamples; start += maxSamples)
+        {
+            const auto num = jmin (maxSamples, numSamples - start);
+
+            pieceMidi.clear();
+            pieceMidi.addEvents (midi, start, num, -start);
+            processPiece (plugin, buffer, start, num, pieceMidi);
+        }
+
+        midi.clear(); // (what the plugin sent out of each piece is dropped, rather than reassembled)
+    }
+
+private:
+    struct Source
+    {
+        enum Kind { host, copy, silence };
+
+        Kind kind;
+        int channel;
+    };
+
+    std::vector<Source> sources;
+    int numPluginChannels = 0, numScratchChannels = 0, numHostChannelsUsed = 0, maxSamples = 1;
+    bool identity = true;
+    MidiBuffer pieceMidi;
+
+    AudioBuffer<float> floatScratch;
+    AudioBuffer<double> doubleScratch;
+    std::vector<float*> floatPointers;
+    std::vector<double*> doublePointers;
+    ChannelView<float> floatView;
+    ChannelView<double> doubleView;
+
+    ChannelView<float>& getView (AudioBuffer<float>&) noexcept              { return floatView; }
+    ChannelView<double>& getView (AudioBuffer<double>&) noexcept            { return doubleView; }
+    AudioBuffer<float>& getScratch (AudioBuffer<float>&) noexcept           { return floatScratch; }
+    AudioBuffer<double>& getScratch (AudioBuffer<double>&) noexcept         { return doubleScratch; }
+    std::vector<float*>& getPointers (AudioBuffer<float>&) noexcept         { return floatPointers; }
+    std::vector<double*>& getPointers (AudioBuffer<double>&) noexcept       { return doublePointers; }
+
+    template <typename FloatType>
+    void processPiece (AudioPluginInstance& plugin, AudioBuffer<FloatType>& buffer,
+                       int start, int numSamples, MidiBuffer& midi)
+    {
+        auto& scratch = getScratch (buffer);
+        auto& pointers = getPointers (buffer);
+
+        for (int ch = 0, scratchIndex = 0; ch < numPluginChannels; ++ch)
+        {
+            const auto& source = sources[(size_t) ch];
+
+            if (source.kind == Source::host)
+            {
+                pointers[(size_t) ch] = buffer.getWritePointer (source.channel, start);
+                continue;
+            }
+
+            auto* dest = scratch.getWritePointer (scratchIndex++);
+
+            if (source.kind == Source::copy)
+                FloatVectorOperations::copy (dest, buffer.getReadPointer (source.channel, start), numSamples);
+            else
+                FloatVectorOperations::clear (dest, numSamples);
+
+            pointers[(size_t) ch] = dest;
+        }
+
+        plugin.processBlock (getView (buffer).refer (pointers.data(), numPluginChannels, numSamples), midi);
+    }
+};
@@ -55,6 +55,15 @@
 
 #pragma once
 
+#include "HostedPluginSlot.h"
+#include "PluginPreloader.h"
+#include "PluginRack.h"
+#include "PluginSandbox.h"
+#include "PluginScanner.h"
+#include "PluginListStore.h"
+#include "PluginStateFormat.h"
+#include "PluginLoadProfile.h"
+
 //==============================================================================
 enum class EditorStyle { thisWindow, newWindow };
 
@@ -74,18 +83,47 @@ public:
             opt.doNotSave = false;
             opt.filenameSuffix = ".props";
             opt.ignoreCaseOfKeyNames = false;
-            opt.storageFormat = PropertiesFile::StorageFormat::storeAsXML;
+            opt.storageFormat = PropertiesFile::StorageFormat::storeAsBinary; // (older XML settings still load)
+            opt.millisecondsBeforeSaving = -1; // (saved by the pluginListStore's thread instead)
             opt.osxLibrarySubFolder = "Application Support";
             return opt;
         }());
 
         pluginFormatManager.addDefaultFormats();
 
-        if (auto savedPluginList = appProperties.getUserSettings()->getXmlValue ("pluginList"))
-            pluginList.recreateFromXml (*savedPluginList);
+        auto& settings = *appProperties.getUserSettings();
+        pluginListStore = std::make_unique<PluginListStore> (settings.getFile().getSiblingFile ("PluginList.bin"), pluginList, settings);
+
+        // (the first time, the list is moved over from where older versions kept it)
+        if (! pluginListStore->load())
+        {
+            if (auto savedPluginList = settings.getXmlValue ("pluginList"))
+                pluginList.recreateFromXml (*savedPluginList);
+
+            settings.removeValue ("pluginList");
+            pluginListStore->saveSoon();
+        }
+
+        // (the sandbox's test processors, which only a sandbox worker can load)
+        for (const auto& name : SandboxTestProcessor::getNames())
+        {
+            const auto description = SandboxTestProcessor::createDescription (name);
+
+            if (canUseSandbox())
+                pluginList.addType (description);
+            else
+                pluginList.removeType (description);
+        }
+
+        scanCache = std::make_unique<PluginScanCache> (appProperties.getUserSettings()->getFile().getSiblingFile ("PluginScanCache.xml"));
+        pluginList.setCustomScanner (std::make_unique<OutOfProcessPluginScanner> (*scanCache, getWorkerExecutable()));
 
         MessageManagerLock lock;
         pluginList.addChangeListener (this);
+
+        // (picks up plugins that were installed or updated since last time, without loading the unchanged ones)
+        listRefresher = std::make_unique<PluginListRefresher> (pluginFormatManager, pluginList, *scanCache,
+                                                               *appProperties.getUserSettings(), getNumScanningThreads());
     }
 
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override
@@ -96,58 +134,50 @@ public:
         if (! mainInput.isDisabled() && mainInput != mainOutput)
             return false;
 
-        if (mainOutput.size() > 2)
-            return false;
-
-        return true;
+        // (up to a full Dante device's worth; each plugin gets the host's layout if it can take it)
+        return mainOutput.size() >= 1 && mainOutput.size() <= maxChannels;
     }
 
     void prepareToPlay (double sr, int bs) override
     {
         const ScopedLock sl (innerMutex);
 
-        active = true;
-
-        if (inner != nullptr)
-        {
-            inner->setRateAndBufferSizeDetails (sr, bs);
-            inner->prepareToPlay (sr, bs);
-        }
+        slot.prepareToPlay (sr, bs, jmax (getTotalNumInputChannels(), getTotalNumOutputChannels()), getProcessingPrecision());
     }
 
     void releaseResources() override
     {
         const ScopedLock sl (innerMutex);
 
-        active = false;
-
-        if (inner != nullptr)
-            inner->releaseResources();
+        slot.releaseResources();
     }
 
     void reset() override
     {
         const ScopedLock sl (innerMutex);
 
-        if (inner != nullptr)
-            inner->reset();
+        slot.reset();
     }
 
-    // In this example, we don't actually pass any audio through the inner processor.
-    // In a 'real' plugin, we'd need to add some synchronisation to ensure that the inner
-    // plugin instance was never modified (deleted, replaced etc.) during a call to processBlock.
+    // The inner plugin can be swapped or cleared on the message thread at any time, so it's
+    // only ever reached through the slot, which makes sure the instance being used here isn't
+    // deleted until this callback has moved on to its replacement.
     void processBlock (AudioBuffer<float>& audioBuffer, MidiBuffer& midiBuffer) override
     {
         jassert (! isUsingDoublePrecision());
-        if (inner != nullptr)
-            inner->processBlock(audioBuffer, midiBuffer);
+        slot.process (audioBuffer, midiBuffer);
     }
 
-    void processBlock (AudioBuffer<double>&, MidiBuffer&) override
+    // A plugin that can't process doubles itself gets a float copy of each block, converted
+    // in buffers that the slot allocated in prepareToPlay().
+    void processBlock (AudioBuffer<double>& audioBuffer, MidiBuffer& midiBuffer) override
     {
         jassert (isUsingDoublePrecision());
+        slot.process (audioBuffer, midiBuffer);
     }
 
+    bool supportsDoublePrecisionProcessing() const override           { return true; }
+
     bool hasEditor() const override                                   { return false; }
     AudioProcessorEditor* createEditor() override                     { return nullptr; }
 
@@ -162,57 +192,115 @@ public:
     const String getProgramName (int) override                        { return "None"; }
     void changeProgramName (int, const String&) override              {}
 
+    /** The state is a PluginStateFormat container: a chunk with the XML that describes
+        what's loaded, followed by a chunk with each plugin's state, as it is.
+    */
     void getStateInformation (MemoryBlock& destData) override
     {
         const ScopedLock sl (innerMutex);
 
         XmlElement xml ("state");
+        std::vector<MemoryBlock> states;
 
-        if (inner != nullptr)
+        if (auto* rack = getRack())
+        {
+            xml.addChildElement (rack->createXml (&states).release());
+        }
+        else if (auto* inner = slot.getPlugin())
         {
             xml.setAttribute (editorStyleTag, (int) editorStyle);
             xml.addChildElement (inner->getPluginDescription().createXml().release());
-            xml.addChildElement ([this]
-            {
-                MemoryBlock innerState;
-                inner->getStateInformation (innerState);
 
-                auto stateNode = std::make_unique<XmlElement> (innerStateTag);
-                stateNode->addTextElement (innerState.toBase64Encoding());
-                return stateNode.release();
-            }());
+            states.emplace_back();
+            inner->getStateInformation (states.back());
         }
 
-        const auto text = xml.toString();
-        destData.replaceAll (text.toRawUTF8(), text.getNumBytesAsUTF8());
+        PluginStateWriter writer (destData, stateCompressionLevel);
+        writer.writeChunk (layoutChunk, xml.toString (XmlElement::TextFormat().singleLine().withoutHeader()));
+
+        for (auto& state : states)
+        {
+            writer.writeChunk (pluginStateChunk, state);
+            state.reset(); // (so there's only ever one extra copy of each)
+        }
     }
 
     void setStateInformation (const void* data, int sizeInBytes) override
     {
         const ScopedLock sl (innerMutex);
 
-        auto xml = XmlDocument::parse (String (CharPointer_UTF8 (static_cast<const char*> (data)), (size_t) sizeInBytes));
+        std::unique_ptr<XmlElement> xml;
+        std::vector<MemoryBlock> states;
+        const PluginStateReader reader (data, (size_t) sizeInBytes);
 
-        if (auto* pluginNode = xml->getChildByName ("PLUGIN"))
+        if (reader.isValid())
+        {
+            if (const auto* layout = reader.findChunk (layoutChunk))
+                xml = parseXML (layout->getText());
+
+            for (const auto* chunk : reader.findChunks (pluginStateChunk))
+                states.push_back (chunk->getData());
+        }
+        else
+        {
+            // (older versions saved the XML on its own, with the states in it as base64)
+            xml = XmlDocument::parse (String (CharPointer_UTF8 (static_cast<const char*> (data)), (size_t) sizeInBytes));
+        }
+
+        if (xml == nullptr)
+            return;
+
+        if (auto* rackNode = xml->getChildByName ("RACK"))
+        {
+            loadRack (*rackNode, std::move (states));
+        }
+        else if (auto* pluginNode = xml->getChildByName ("PLUGIN"))
         {
             PluginDescription pd;
             pd.loadFromXml (*pluginNode);
 
             MemoryBlock innerState;
-            innerState.fromBase64Encoding (xml->getChildElementAllSubText (innerStateTag, {}));
+
+            if (! states.empty())
+                innerState = std::move (states.front());
+            else
+                innerState.fromBase64Encoding (xml->getChildElementAllSubText (innerStateTag, {}));
 
             setNewPlugin (pd,
                           (EditorStyle) xml->getIntAttribute (editorStyleTag, 0),
-                          innerState);
+                          std::move (innerState));
         }
     }
 
-    void setNewPlugin (const PluginDescription& pd, EditorStyle where, const MemoryBlock& mb = {})
+    /** Smaller saved states, for the time it takes to deflate and inflate them. 0, the
+        default, stores them as they are, and 1 to 9 trade more time for smaller states.
+    */
+    void setStateCompressionLevel (int newLevel)
     {
         const ScopedLock sl (innerMutex);
+        stateCompressionLevel = jlimit (0, 9, newLevel);
+    }
+
+    void setNewPlugin (const PluginDescription& pd, EditorStyle where, MemoryBlock mb = {})
+    {
+        const ScopedLock sl (innerMutex);
+
+        // (the state is moved along rather than copied, as it can be very large)
+        PluginPreloader::StateRestorer restoreState = [mb = std::move (mb)] (AudioPluginInstance& instance)
+        {
+            if (! mb.isEmpty())
+                instance.setStateInformation (mb.getData(), (int) mb.getSize());
+        };
 
-        const auto callback = [this, where, mb] (std::unique_ptr<AudioPluginInstance> instance, const String& error)
+        // The preloader restores the state, prepares the plugin and warms it up on its own thread
+        // (apart from a VST3's state and preparation, which it does on this one), so this only has
+        // to publish it. The slot asks the plugin to take this processor's layout
+        // when it prepares it. If the plugin won't, it keeps its own, and its ChannelRouting maps
+        // its channels onto ours.
+        PluginPreloader::Callback onReady = [this, where] (std::unique_ptr<HostedPluginSlot::PreparedPlugin> plugin, const String& error)
         {
+            const ScopedLock callbackLock (innerMutex);
+
             if (error.isNotEmpty())
             {
                 NativeMessageBox::showMessageBoxAsync (MessageBoxIconType::WarningIcon,
@@ -223,80 +311,263 @@ public:
                 return;
             }
 
-            inner = std::move (instance);
             editorStyle = where;
+            slot.setPlugin (std::move (plugin));
 
-            if (inner != nullptr && ! mb.isEmpty())
-                inner->setStateInformation (mb.getData(), (int) mb.getSize());
+            NullCheckedInvocation::invoke (pluginChanged);
+        };
 
-            // In a 'real' plugin, we'd also need to set the bus configuration of the inner plugin.
-            // One possibility would be to match the bus configuration of the wrapper plugin, but
-            // the inner plugin isn't guaranteed to support the same layout. Alternatively, we
-            // could try to apply a reasonably similar layout, and maintain a mapping between the
-            // inner/outer channel layouts.
-            //
-            // In any case, it is essential that the inner plugin is told about the bus
-            // configuration that will be used. The AudioBuffer passed to the inner plugin must also
-            // exactly match this layout.
+        if (isUsingSandbox() || pd.pluginFormatName == SandboxTestProcessor::formatName)
+        {
+            // (launching the worker waits for it to load the plugin, so that's done on the preloader's thread too)
+            preloader.preload ([this, pd] (String& error)
+                               {
+                                   auto sandboxed = SandboxedPlugin::launch (getWorkerExecutable(), pd, error);
+
+                                   if (sandboxed != nullptr)
+                                       sandboxed->onWorkerLost = [name = pd.name]
+                                       {
+                                           NativeMessageBox::showMessageBoxAsync (MessageBoxIconType::WarningIcon,
+                                                                                  "Plugin Stopped",
+                                                                                  name + " crashed or quit, and is being bypassed.",
+                                                                                  nullptr,
+                                                                                  nullptr);
+                                       };
+
+                                   return std::unique_ptr<AudioPluginInstance> (std::move (sandboxed));
+                               },
+                               std::move (restoreState),
+                               std::move (onReady));
+            return;
+        }
 
-            if (active)
+        // (JUCE's formats create their plugins on the message thread, and the preloader takes it from there)
+        pluginFormatManager.createPluginInstanceAsync (pd, getSampleRate(), getBlockSize(),
+                                                       [this, restoreState = std::move (restoreState), onReady = std::move (onReady)]
+                                                       (std::unique_ptr<AudioPluginInstance> instance, const String& error) mutable
+        {
+            if (instance == nullptr)
             {
-                inner->setRateAndBufferSizeDetails (getSampleRate(), getBlockSize());
-                inner->prepareToPlay (getSampleRate(), getBlockSize());
+                onReady (nullptr, error);
+                return;
             }
 
-            NullCheckedInvocation::invoke (pluginChanged);
-        };
-
-        pluginFormatManager.createPluginInstanceAsync (pd, getSampleRate(), getBlockSize(), callback);
+            preloader.preload (std::move (instance), std::move (restoreState), std::move (onReady));
+        });
     }
 
     void clearPlugin()
     {
         const ScopedLock sl (innerMutex);
 
-        inner = nullptr;
+        preloader.cancel(); // (so a plugin that's still loading doesn't replace nothing)
+        slot.setPlugin (std::unique_ptr<AudioPluginInstance>());
         NullCheckedInvocation::invoke (pluginChanged);
     }
 
+    /** Adds a plugin to the end of the rack's last chain, or in a new branch across all
+        the channels so that it runs in parallel with the others. The rack is rebuilt with
+        the new plugin and swapped in. A single plugin that's loaded becomes the first in
+        the rack.
+    */
+    void addToRack (const PluginDescription& pd, bool inNewBranch)
+    {
+        const ScopedLock sl (innerMutex);
+
+        std::vector<MemoryBlock> states;
+
+        auto rackXml = [this, &states]
+        {
+            if (auto* rack = getRack())
+                return rack->createXml (&states);
+
+            auto xml = PluginRack::createEmptyXml (jmax (1, getTotalNumOutputChannels()));
+
+            if (auto* inner = slot.getPlugin())
+            {
+                states.emplace_back();
+                inner->getStateInformation (states.back());
+                PluginRack::addPluginToXml (PluginRack::addBranchToXml (*xml), inner->getPluginDescription(), {});
+            }
+
+            return xml;
+        }();
+
+        auto* branch = rackXml->getNumChildElements() > 0 && ! inNewBranch
+                           ? rackXml->getChildElement (rackXml->getNumChildElements() - 1)
+                           : &PluginRack::addBranchToXml (*rackXml);
+
+        PluginRack::addPluginToXml (*branch, pd, {});
+        loadRack (*rackXml, std::move (states));
+    }
+
+    /** How much of each block's time the loaded plugin has been taking. For a rack, that's
+        followed by each of its branches, each one followed by the plugins in its chain.
+    */
+    std::vector<PluginLoadProfile::Statistics> getLoadStatistics() const
+    {
+        const ScopedLock sl (innerMutex);
+        std::vector<PluginLoadProfile::Statistics> result;
+
+        if (slot.getPlugin() != nullptr)
+            result.push_back (slot.getLoadStatistics());
+
+        if (auto* rack = getRack())
+            for (int b = 0; b < rack->getNumBranches(); ++b)
+            {
+                result.push_back (rack->getBranchLoadStatistics (b));
+
+                for (int p = 0; p < rack->getNumPlugins (b); ++p)
+                    result.push_back (rack->getPluginLoadStatistics (b, p));
+            }
+
+        return result;
+    }
+
+    void resetLoadStatistics()
+    {
+        const ScopedLock sl (innerMutex);
+
+        slot.resetLoadStatistics();
+
+        if (auto* rack = getRack())
+            rack->resetLoadStatistics();
+    }
+
+    /** The sandbox can only be used by the standalone app, which doubles as the process
+        that sandboxed plugins run in.
+    */
+    bool canUseSandbox() const noexcept
+    {
+        return getWorkerExecutable() != File();
+    }
+
+    /** How many plugin files are scanned at once, each in a process of its own. */
+    static int getNumScanningThreads()
+    {
+        return jlimit (1, 8, SystemStats::getNumCpus());
+    }
+
+    /** Loads plugins chosen from now on into a separate process, so that a crash or a hang
+        can't take the host down with it. Plugins in a rack still run in this one.
+    */
+    void setUseSandbox (bool shouldUseSandbox)
+    {
+        appProperties.getUserSettings()->setValue ("useSandbox", shouldUseSandbox);
+        pluginListStore->saveSoon();
+    }
+
+    bool isUsingSandbox()
+    {
+        return canUseSandbox() && appProperties.getUserSettings()->getBoolValue ("useSandbox");
+    }
+
     bool isPluginLoaded() const
     {
         const ScopedLock sl (innerMutex);
-        return inner != nullptr;
+        return slot.getPlugin() != nullptr;
+    }
+
+    bool isRackLoaded() const
+    {
+        const ScopedLock sl (innerMutex);
+        return getRack() != nullptr;
     }
 
     std::unique_ptr<AudioProcessorEditor> createInnerEditor() const
     {
         const ScopedLock sl (innerMutex);
+        auto* inner = slot.getPlugin();
         return rawToUniquePtr (inner->hasEditor() ? inner->createEditorIfNeeded() : nullptr);
     }
 
     EditorStyle getEditorStyle() const noexcept { return editorStyle; }
 
+    /** How long the old and new plugins are faded across when the plugin is swapped or
+        cleared while audio is running. Zero switches over at the next block.
+    */
+    void setCrossfadeSeconds (double seconds)           { slot.setCrossfadeSeconds (seconds); }
+    double getCrossfadeSeconds() const noexcept         { return slot.getCrossfadeSeconds(); }
+
     ApplicationProperties appProperties;
     AudioPluginFormatManager pluginFormatManager;
     KnownPluginList pluginList;
     std::function<void()> pluginChanged;
 
 private:
-    CriticalSection innerMutex;
-    std::unique_ptr<AudioPluginInstance> inner;
+    std::unique_ptr<PluginListStore> pluginListStore;
+    std::unique_ptr<PluginScanCache> scanCache;
+    std::unique_ptr<PluginListRefresher> listRefresher; // (uses the cache, so must go first)
+
+    CriticalSection innerMutex; // (never taken by processBlock)
+    RealtimeWorkerPool workerPool; // (runs the parallel branches of a rack, so must outlive the slot)
+    HostedPluginSlot slot;
+    PluginPreloader preloader { slot }; // (prepares plugins for the slot, so must go before it)
     EditorStyle editorStyle = EditorStyle{};
-    bool active = false;
 
+    static constexpr int maxChannels = 128;
     static constexpr const char* innerStateTag = "inner_state";
     static constexpr const char* editorStyleTag = "editor_style";
+    static constexpr uint32 layoutChunk = PluginStateFormat::makeChunkId ("LYOT");
+    static constexpr uint32 pluginStateChunk = PluginStateFormat::makeChunkId ("PSTA");
+    int stateCompressionLevel = 0;
+
+    /** The app that sandboxed plugins and plugin scans run in, which is this one when
+        it's the standalone build. Anywhere else, there's nothing to launch.
+    */
+    File getWorkerExecutable() const
+    {
+        return wrapperType == wrapperType_Standalone ? File::getSpecialLocation (File::currentExecutableFile)
+                                                     : File();
+    }
+
+    PluginRack* getRack() const
+    {
+        return dynamic_cast<PluginRack*> (slot.getPlugin());
+    }
+
+    void loadRack (const XmlElement& rackXml, std::vector<MemoryBlock> states = {})
+    {
+        PluginRack::createFromXml (rackXml, pluginFormatManager, workerPool, getSampleRate(), getBlockSize(),
+                                   [this] (std::unique_ptr<PluginRack> rack, const String& errors)
+        {
+            if (errors.isNotEmpty())
+                NativeMessageBox::showMessageBoxAsync (MessageBoxIconType::WarningIcon,
+                                                       "Some Plugins Failed To Load",
+                                                       errors,
+                                                       nullptr,
+                                                       nullptr);
+
+            // An AudioProcessorGraph that's prepared off the message thread leaves building itself, and
+            // preparing its plugins, to the message thread, which gets to that before this callback. So
+            // only the states are restored in the background, and there's nothing to warm up yet, which
+            // would also mean using the worker pool from the wrong thread. A rack with any VST3s in it
+            // has its states restored on the message thread instead.
+            const auto plugins = rack->getPlugins();
+            const auto onMessageThread = std::any_of (plugins.begin(), plugins.end(),
+                                                      [] (AudioPluginInstance* p) { return PluginPreloader::needsMessageThread (*p); });
+
+            preloader.preload (std::move (rack),
+                               [] (AudioPluginInstance& instance) { static_cast<PluginRack&> (instance).restoreStates(); },
+                               [this] (std::unique_ptr<HostedPluginSlot::PreparedPlugin> prepared, const String&)
+            {
+                const ScopedLock callbackLock (innerMutex);
+
+                editorStyle = EditorStyle::thisWindow;
+                slot.setPlugin (std::move (prepared));
+
+                NullCheckedInvocation::invoke (pluginChanged);
+            }, 0, onMessageThread);
+        }, std::move (states));
+    }
 
     void changeListenerCallback (ChangeBroadcaster* source) override
     {
         if (source != &pluginList)
             return;
 
-        if (auto savedPluginList = pluginList.createXml())
-        {
-            appProperties.getUserSettings()->setValue ("pluginList", savedPluginList.get());
-            appProperties.saveIfNeeded();
-        }
+        // (only the changes are written, on the store's thread, and a burst of them is written at once)
+        pluginListStore->saveSoon();
     }
 };
 
@@ -321,38 +592,46 @@ static void doLayout (Component* main, Component& bottom, int bottomHeight, Rect
 class PluginLoaderComponent : public Component
 {
 public:
-    template <typename Callback>
+    template <typename Callback, typename RackCallback>
     PluginLoaderComponent (AudioPluginFormatManager& manager,
                            KnownPluginList& list,
-                           Callback&& callback)
-        : pluginListComponent (manager, list, {}, {})
+                           PropertiesFile* properties,
+                           int numScanningThreads,
+                           Callback&& callback,
+                           RackCallback&& rackCallback)
+        : pluginListComponent (manager, list, {}, properties)
     {
         pluginListComponent.getTableListBox().setMultipleSelectionEnabled (false);
+        pluginListComponent.setNumberOfThreadsForScanning (numScanningThreads);
 
         addAndMakeVisible (pluginListComponent);
         addAndMakeVisible (buttons);
 
-        const auto getCallback = [this, &list, callback = std::forward<Callback> (callback)] (EditorStyle style)
+        const auto getCallback = [this, &list] (auto callbackToInvoke, auto arg)
         {
-            return [this, &list, callback, style]
+            return [this, &list, callbackToInvoke, arg]
             {
                 const auto index = pluginListComponent.getTableListBox().getSelectedRow();
                 const auto& types = list.getTypes();
 
                 if (isPositiveAndBelow (index, types.size()))
-                    NullCheckedInvocation::invoke (callback, types.getReference (index), style);
+                    NullCheckedInvocation::invoke (callbackToInvoke, types.getReference (index), arg);
             };
         };
 
-        buttons.thisWindowButton.onClick = getCallback (EditorStyle::thisWindow);
-        buttons.newWindowButton .onClick = getCallback (EditorStyle::newWindow);
+        buttons.thisWindowButton.onClick   = getCallback (callback, EditorStyle::thisWindow);
+        buttons.newWindowButton .onClick   = getCallback (callback, EditorStyle::newWindow);
+        buttons.addToChainButton.onClick   = getCallback (rackCallback, false);
+        buttons.addBranchButton .onClick   = getCallback (rackCallback, true);
     }
 
     void resized() override
     {
-        doLayout (&pluginListComponent, buttons, 80, getLocalBounds());
+        doLayout (&pluginListComponent, buttons, 160, getLocalBounds());
     }
 
+    ToggleButton& getSandboxButton() noexcept     { return buttons.sandboxButton; }
+
 private:
     struct Buttons : public Component
     {
@@ -363,6 +642,9 @@ private:
             addAndMakeVisible (label);
             addAndMakeVisible (thisWindowButton);
             addAndMakeVisible (newWindowButton);
+            addAndMakeVisible (addToChainButton);
+            addAndMakeVisible (addBranchButton);
+            addAndMakeVisible (sandboxButton);
         }
 
         void resized() override
@@ -371,24 +653,34 @@ private:
             vertical.autoFlow = Grid::AutoFlow::row;
             vertical.setGap (Grid::Px { margin });
             vertical.autoRows = vertical.autoColumns = Grid::TrackInfo { Grid::Fr { 1 } };
-            vertical.items.insertMultiple (0, GridItem{}, 2);
+            vertical.items.insertMultiple (0, GridItem{}, 4);
             vertical.performLayout (getLocalBounds());
 
             label.setBounds (vertical.items[0].currentBounds.toNearestInt());
 
-            Grid grid;
-            grid.autoFlow = Grid::AutoFlow::column;
-            grid.setGap (Grid::Px { margin });
-            grid.autoRows = grid.autoColumns = Grid::TrackInfo { Grid::Fr { 1 } };
-            grid.items = { GridItem { thisWindowButton },
-                           GridItem { newWindowButton } };
+            const auto layoutRow = [] (Rectangle<int> bounds, Button& left, Button& right)
+            {
+                Grid grid;
+                grid.autoFlow = Grid::AutoFlow::column;
+                grid.setGap (Grid::Px { margin });
+                grid.autoRows = grid.autoColumns = Grid::TrackInfo { Grid::Fr { 1 } };
+                grid.items = { GridItem { left },
+                               GridItem { right } };
+
+                grid.performLayout (bounds);
+            };
 
-            grid.performLayout (vertical.items[1].currentBounds.toNearestInt());
+            layoutRow (vertical.items[1].currentBounds.toNearestInt(), thisWindowButton, newWindowButton);
+            layoutRow (vertical.items[2].currentBounds.toNearestInt(), addToChainButton, addBranchButton);
+            sandboxButton.setBounds (vertical.items[3].currentBounds.toNearestInt());
         }
 
         Label label { "", "Select a plugin from the list, then display it using the buttons below." };
         TextButton thisWindowButton { "Open In This Window" };
         TextButton newWindowButton { "Open In New Window" };
+        TextButton addToChainButton { "Add To Rack Chain" };
+        TextButton addBranchButton { "Add To Rack In Parallel" };
+        ToggleButton sandboxButton { "Open plugins in a separate process" };
     };
 
     PluginListComponent pluginListComponent;
@@ -399,16 +691,17 @@ private:
 class PluginEditorComponent : public Component
 {
 public:
-    template <typename Callback>
-    PluginEditorComponent (std::unique_ptr<AudioProcessorEditor> editorIn, Callback&& onClose)
+    template <typename Callback, typename LoadCallback>
+    PluginEditorComponent (std::unique_ptr<AudioProcessorEditor> editorIn, Callback&& onClose, LoadCallback&& onShowLoad)
         : editor (std::move (editorIn))
     {
         addAndMakeVisible (editor.get());
-        addAndMakeVisible (closeButton);
+        addAndMakeVisible (buttons);
 
         childBoundsChanged (editor.get());
 
-        closeButton.onClick = std::forward<Callback> (onClose);
+        buttons.closeButton.onClick = std::forward<Callback> (onClose);
+        buttons.loadButton.onClick = std::forward<LoadCallback> (onShowLoad);
     }
 
     void setScaleFactor (float scale)
@@ -419,7 +712,7 @@ public:
 
     void resized() override
     {
-        doLayout (editor.get(), closeButton, buttonHeight, getLocalBounds());
+        doLayout (editor.get(), buttons, buttonHeight, getLocalBounds());
     }
 
     void childBoundsChanged (Component* child) override
@@ -427,8 +720,9 @@ public:
         if (child != editor.get())
             return;
 
+        // (a plugin without an editor, e.g. one in the sandbox, just gets the close button)
         const auto size = editor != nullptr ? editor->getLocalBounds()
-                                            : Rectangle<int>();
+                                            : Rectangle<int> (300, 0);
 
         setSize (size.getWidth(), margin + buttonHeight + size.getHeight());
     }
@@ -436,8 +730,164 @@ public:
 private:
     static constexpr auto buttonHeight = 40;
 
+    struct Buttons : public Component
+    {
+        Buttons()
+        {
+            addAndMakeVisible (closeButton);
+            addAndMakeVisible (loadButton);
+        }
+
+        void resized() override
+        {
+            auto bounds = getLocalBounds();
+            loadButton.setBounds (bounds.removeFromRight (bounds.getWidth() / 3));
+            closeButton.setBounds (bounds.withTrimmedRight (margin));
+        }
+
+        TextButton closeButton { "Close Plugin" };
+        TextButton loadButton { "CPU Load" };
+    };
+
     std::unique_ptr<AudioProcessorEditor> editor;
-    TextButton closeButton { "Close Plugin" };
+    Buttons buttons;
+};
+
+//==============================================================================
+/*  Shows how much of each block's time the hosted plugins take, as a table that's
+    refreshed a few times a second, and exports it as CSV.
+*/
+class PluginLoadComponent : public Component,
+                            private Timer
+{
+public:
+    explicit PluginLoadComponent (HostAudioProcessorImpl& owner)
+        : hostProcessor (owner)
+    {
+        addAndMakeVisible (resetButton);
+        addAndMakeVisible (exportButton);
+
+        resetButton.onClick = [this] { hostProcessor.resetLoadStatistics(); };
+        exportButton.onClick = [this] { exportToCsv(); };
+
+        setSize (640, 220);
+        startTimerHz (4);
+    }
+
+    void paint (Graphics& g) override
+    {
+        g.fillAll (getLookAndFeel().findColour (ResizableWindow::backgroundColourId));
+        g.setFont (Font (Font::getDefaultMonospacedFontName(), 13.0f, Font::plain));
+        g.setColour (getLookAndFeel().findColour (Label::textColourId));
+
+        auto area = getLocalBounds().reduced (margin).withTrimmedBottom (buttonHeight + margin);
+
+        if (statistics.empty())
+        {
+            g.drawText ("No plugin is loaded.", area, Justification::centred);
+            return;
+        }
+
+        const auto drawRow = [&g, &area] (const StringArray& cells)
+        {
+            auto row = area.removeFromTop (rowHeight);
+            g.drawText (cells[0], row.removeFromLeft (row.getWidth() - 5 * numberWidth), Justification::centredLeft, true);
+
+            for (int i = 1; i < cells.size(); ++i)
+                g.drawText (cells[i], row.removeFromLeft (numberWidth), Justification::centredRight);
+        };
+
+        drawRow (getHeadings());
+
+        for (const auto& s : statistics)
+            drawRow (getCells (s));
+    }
+
+    void resized() override
+    {
+        auto bottom = getLocalBounds().reduced (margin).removeFromBottom (buttonHeight);
+        exportButton.setBounds (bottom.removeFromRight (120));
+        resetButton.setBounds (bottom.removeFromRight (120 + margin).withTrimmedRight (margin));
+    }
+
+private:
+    static constexpr auto rowHeight = 20;
+    static constexpr auto numberWidth = 80;
+    static constexpr auto buttonHeight = 30;
+
+    HostAudioProcessorImpl& hostProcessor;
+    std::vector<PluginLoadProfile::Statistics> statistics;
+    TextButton resetButton { "Reset" }, exportButton { "Export CSV..." };
+    std::unique_ptr<FileChooser> chooser;
+
+    static StringArray getHeadings()
+    {
+        return { "Plugin", "Blocks", "p50 %", "p99 %", "Max %", "Overruns" };
+    }
+
+    static StringArray getCells (const PluginLoadProfile::Statistics& s)
+    {
+        return { s.name,
+                 String (s.numBlocks),
+                 String (s.median * 100.0, 1),
+                 String (s.percentile99 * 100.0, 1),
+                 String (s.maximum * 100.0, 1),
+                 String (s.numOverruns) };
+    }
+
+    void timerCallback() override
+    {
+        statistics = hostProcessor.getLoadStatistics();
+        repaint();
+    }
+
+    void exportToCsv()
+    {
+        chooser = std::make_unique<FileChooser> ("Export CPU load",
+                                                 File::getSpecialLocation (File::userDocumentsDirectory).getChildFile ("PluginLoad.csv"),
+                                                 "*.csv");
+
+        chooser->launchAsync (FileBrowserComponent::saveMode | FileBrowserComponent::canSelectFiles | FileBrowserComponent::warnAboutOverwriting,
+                              [this, rows = hostProcessor.getLoadStatistics()] (const FileChooser& fc)
+        {
+            const auto file = fc.getResult();
+
+            if (file == File())
+                return;
+
+            StringArray lines { getHeadings().joinIntoString (",") };
+
+            for (const auto& s : rows)
+            {
+                auto cells = getCells (s);
+                cells.set (0, cells[0].quoted());
+                lines.add (cells.joinIntoString (","));
+            }
+
+            if (! file.replaceWithText (lines.joinIntoString ("\n") + "\n"))
+                NativeMessageBox::showMessageBoxAsync (MessageBoxIconType::WarningIcon,
+                                                       "Export Failed",
+                                                       "Couldn't write " + file.getFullPathName(),
+                                                       nullptr,
+                                                       nullptr);
+        });
+    }
+};
+
+//==============================================================================
+class PluginLoadWindow : public DocumentWindow
+{
+public:
+    explicit PluginLoadWindow (HostAudioProcessorImpl& owner)
+        : DocumentWindow ("CPU Load", Colours::darkgrey, DocumentWindow::closeButton)
+    {
+        setUsingNativeTitleBar (true);
+        setContentOwned (new PluginLoadComponent (owner), true);
+        setResizable (true, false);
+        setAlwaysOnTop (true);
+    }
+
+    void closeButtonPressed() override      { setVisible (false); }
 };
 
 //==============================================================================
@@ -462,21 +912,35 @@ public:
           hostProcessor (owner),
           loader (owner.pluginFormatManager,
                   owner.pluginList,
+                  owner.appProperties.getUserSettings(),
+                  HostAudioProcessorImpl::getNumScanningThreads(),
                   [&owner] (const PluginDescription& pd,
                             EditorStyle editorStyle)
                   {
                       owner.setNewPlugin (pd, editorStyle);
+                  },
+                  [&owner] (const PluginDescription& pd,
+                            bool inNewBranch)
+                  {
+                      owner.addToRack (pd, inNewBranch);
                   }),
           scopedCallback (owner.pluginChanged, [this] { pluginChanged(); })
     {
         setSize (500, 500);
         setResizable (false, false);
         addAndMakeVisible (closeButton);
+        addChildComponent (loadButton);
         addAndMakeVisible (loader);
 
         hostProcessor.pluginChanged();
 
         closeButton.onClick = [this] { clearPlugin(); };
+        loadButton.onClick = [this] { showLoad(); };
+
+        auto& sandboxButton = loader.getSandboxButton();
+        sandboxButton.setEnabled (owner.canUseSandbox());
+        sandboxButton.setToggleState (owner.isUsingSandbox(), dontSendNotification);
+        sandboxButton.onClick = [this] { hostProcessor.setUseSandbox (loader.getSandboxButton().getToggleState()); };
     }
 
     void paint (Graphics& g) override
@@ -486,8 +950,20 @@ public:
 
     void resized() override
     {
-        closeButton.setBounds (getLocalBounds().withSizeKeepingCentre (200, buttonHeight));
-        loader.setBounds (getLocalBounds());
+        // (a rack has no editor of its own, so the list stays up for adding more plugins to it)
+        if (hostProcessor.isRackLoaded())
+        {
+            auto bounds = getLocalBounds();
+            auto buttons = bounds.removeFromBottom (buttonHeight + 2 * margin).withSizeKeepingCentre (2 * 200 + margin, buttonHeight);
+            closeButton.setBounds (buttons.removeFromLeft (200));
+            loadButton.setBounds (buttons.removeFromRight (200));
+            loader.setBounds (bounds);
+        }
+        else
+        {
+            closeButton.setBounds (getLocalBounds().withSizeKeepingCentre (200, buttonHeight));
+            loader.setBounds (getLocalBounds());
+        }
     }
 
     void childBoundsChanged (Component* child) override
@@ -519,16 +995,28 @@ public:
 private:
     void pluginChanged()
     {
-        loader.setVisible (! hostProcessor.isPluginLoaded());
+        const auto rackLoaded = hostProcessor.isRackLoaded();
+
+        loader.setVisible (rackLoaded || ! hostProcessor.isPluginLoaded());
         closeButton.setVisible (hostProcessor.isPluginLoaded());
+        closeButton.setButtonText (rackLoaded ? "Close Rack" : "Close Plugin");
+        loadButton.setVisible (rackLoaded);
 
-        if (hostProcessor.isPluginLoaded())
+        if (rackLoaded)
+        {
+            currentEditorComponent = nullptr;
+            editor = nullptr;
+            setSize (500, 500);
+            resized();
+        }
+        else if (hostProcessor.isPluginLoaded())
         {
             auto editorComponent = std::make_unique<PluginEditorComponent> (hostProcessor.createInnerEditor(), [this]
             {
                 const auto posted = MessageManager::callAsync ([this] { clearPlugin(); });
                 jassertquiet (posted);
-            });
+            },
+            [this] { showLoad(); });
 
             editorComponent->setScaleFactor (currentScaleFactor);
             currentEditorComponent = editorComponent.get();
@@ -560,6 +1048,7 @@ private:
         {
             editor = nullptr;
             setSize (500, 500);
+            resized();
         }
     }
 
@@ -570,6 +1059,18 @@ private:
         hostProcessor.clearPlugin();
     }
 
+    void showLoad()
+    {
+        if (loadWindow == nullptr)
+        {
+            loadWindow = std::make_unique<PluginLoadWindow> (hostProcessor);
+            loadWindow->centreAroundComponent (this, loadWindow->getWidth(), loadWindow->getHeight());
+        }
+
+        loadWindow->setVisible (true);
+        loadWindow->toFront (true);
+    }
+
     static constexpr auto buttonHeight = 30;
 
     HostAudioProcessorImpl& hostProcessor;
@@ -578,6 +1079,8 @@ private:
     PluginEditorComponent* currentEditorComponent = nullptr;
     ScopedValueSetter<std::function<void()>> scopedCallback;
     TextButton closeButton { "Close Plugin" };
+    TextButton loadButton { "CPU Load" };
+    std::unique_ptr<PluginLoadWindow> loadWindow;
     float currentScaleFactor = 1.0f;
 };
 
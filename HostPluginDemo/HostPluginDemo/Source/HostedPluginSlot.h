@@ -0,0 +1,531 @@
+#pragma once
+
+#include "ChannelRouting.h"
+#include "PluginLoadProfile.h"
+
+//==============================================================================
+/*  Holds the plugin instance that the host passes its audio through, and lets the
+    message thread swap it for another one while the audio thread is running,
+    without the audio thread ever waiting for a lock.
+
+    The instance is published through an atomic pointer to a reference-counted
+    holder. The slot and its list of retired instances own the references, so an
+    instance that has been swapped out is only released, on the message thread,
+    once the audio thread has finished a block that no longer uses it.
+
+    If a crossfade length is set, the audio thread runs the outgoing and incoming
+    instances side by side for that long after a swap and fades from one to the
+    other, so even swapping a plugin that's making sound doesn't click. A missing
+    plugin counts as a straight pass-through, so loading into an empty slot and
+    clearing it fade too.
+
+    The host can run in double precision. Plugins that support it natively are
+    prepared for it and get the host's buffers as they are. The rest are prepared
+    in single precision, and process() converts each block to and from a float
+    buffer that was allocated along with everything else in prepareToPlay().
+
+    Each plugin is asked to take the host's channel count on its main buses when
+    it's prepared, and gets a ChannelRouting worked out for whatever layout it
+    ends up with, so process() only has to hand it the right channel pointers.
+
+    All of that can be done ahead of time, on any thread, with prepareInAdvance().
+    setPlugin() then only has to publish the plugin, unless the host has been
+    prepared differently in the meantime.
+
+    Every call into a plugin is timed into its own PluginLoadProfile, which
+    getLoadStatistics() reads.
+
+    Everything apart from process() belongs to the message thread, or to whichever
+    thread prepares and releases the host, and must be called under the owner's
+    lock. process() never takes it.
+*/
+class HostedPluginSlot : private Timer
+{
+public:
+    /** How the host is prepared, which is what each plugin is prepared for. */
+    struct Settings
+    {
+        double sampleRate = 44100.0;
+        int blockSize = 512, numChannels = 2;
+        AudioProcessor::ProcessingPrecision precision = AudioProcessor::singlePrecision;
+        bool prepared = false;
+        uint32 version = 0; // (changes every time the host is prepared or released)
+    };
+
+    /** A plugin that's been got ready for the slot, so that it can go straight in. */
+    struct PreparedPlugin
+    {
+        std::unique_ptr<AudioPluginInstance> instance;
+        ChannelRouting routing;
+        uint32 settingsVersion = 0;
+    };
+
+    HostedPluginSlot() = default;
+
+    ~HostedPluginSlot() override
+    {
+        stopTimer();
+        processing = false;
+        releaseRetiredPlugins();
+    }
+
+    //==============================================================================
+    /** Prepares the current plugin, and any that are set later, for this rate, block
+        size and precision, and allocates what a crossfade or a conversion needs.
+    */
+    void prepareToPlay (double newSampleRate, int newBlockSize, int numChannels,
+                        AudioProcessor::ProcessingPrecision newPrecision = AudioProcessor::singlePrecision)
+    {
+        const auto hostChannels = jmax (1, numChannels);
+
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            settings.sampleRate = newSampleRate;
+            settings.blockSize = newBlockSize;
+            settings.numChannels = hostChannels;
+            settings.precision = newPrecision;
+            settings.prepared = true;
+            ++settings.version;
+        }
+
+        const auto usingDouble = newPrecision == AudioProcessor::doublePrecision;
+
+        fadeBuffer.setSize (hostChannels, jmax (1, newBlockSize));
+        doubleFadeBuffer.setSize (usingDouble ? hostChannels : 0, usingDouble ? jmax (1, newBlockSize) : 0);
+        conversionBuffer.setSize (usingDouble ? hostChannels : 0, usingDouble ? jmax (1, newBlockSize) : 0);
+        fadeView.prepare (hostChannels, newBlockSize);
+        doubleFadeView.prepare (usingDouble ? hostChannels : 0, newBlockSize);
+        conversionView.prepare (usingDouble ? hostChannels : 0, newBlockSize);
+        fadeMidi.ensureSize (4096);
+        conversionMidi.ensureSize (4096);
+
+        if (owned != nullptr)
+        {
+            prepare (*owned->instance, owned->routing, settings);
+            owned->profile.prepare (newSampleRate);
+        }
+
+        // (the audio thread isn't running, so its state can be reset from here)
+        lastSeen = owned.get();
+        fadingFrom = nullptr;
+        fading = false;
+        processing = true;
+    }
+
+    void releaseResources()
+    {
+        {
+            const SpinLock::ScopedLockType sl (settingsLock);
+            settings.prepared = false;
+            ++settings.version;
+        }
+
+        processing = false;
+
+        if (owned != nullptr)
+            owned->instance->releaseResources();
+
+        lastSeen = owned.get();
+        fadingFrom = nullptr;
+        fading = false;
+    }
+
+    void reset()
+    {
+        if (owned != nullptr)
+            owned->instance->reset();
+    }
+
+    //==============================================================================
+    /** Returns how the host is prepared now. Can be called on any thread. */
+    Settings getSettings() const
+    {
+        const SpinLock::ScopedLockType sl (settingsLock);
+        return settings;
+    }
+
+    /** Does everything setPlugin() would do to a plugin before publishing it, for these
+        settings: negotiates its layout, prepares it and works out its routing. It then
+        runs a few blocks of silence through it, so that its code and memory are warm
+        by the time the audio thread gets it, and resets it.
+
+        It doesn't touch the slot, so it can be done on any thread, without the owner's
+        lock, while the audio thread carries on with the current plugin.
+    */
+    static std::unique_ptr<PreparedPlugin> prepareInAdvance (std::unique_ptr<AudioPluginInstance> plugin,
+                                                             const Settings& settingsToUse, int numWarmUpBlocks = 4)
+    {
+        auto prepared = std::make_unique<PreparedPlugin>();
+        prepared->instance = std::move (plugin);
+        prepared->settingsVersion = settingsToUse.version;
+
+        if (prepared->instance != nullptr && settingsToUse.prepared)
+        {
+            prepare (*prepared->instance, prepared->routing, settingsToUse);
+
+            if (numWarmUpBlocks > 0)
+            {
+                warmUp (*prepared, settingsToUse, numWarmUpBlocks);
+                prepared->instance->reset(); // (so nothing it did carries over into the host's audio)
+            }
+        }
+
+        return prepared;
+    }
+
+    /** Runs blocks of silence through a plugin from prepareInAdvance(), which must have
+        been prepared with these settings. It's up to the caller to reset() the plugin
+        afterwards, which some formats only allow on the message thread.
+    */
+    static void warmUp (PreparedPlugin& plugin, const Settings& settingsItWasPreparedWith, int numBlocks)
+    {
+        if (plugin.instance == nullptr || ! settingsItWasPreparedWith.prepared || numBlocks <= 0)
+            return;
+
+        if (plugin.instance->isUsingDoublePrecision())
+            processSilence<double> (plugin, settingsItWasPreparedWith, numBlocks);
+        else
+            processSilence<float> (plugin, settingsItWasPreparedWith, numBlocks);
+    }
+
+    /** Makes this the plugin that process() uses from its next block on. It's prepared
+        first if the host is, and the previous one is released once it's safe to.
+        A nullptr empties the slot.
+    */
+    void setPlugin (std::unique_ptr<AudioPluginInstance> newPlugin)
+    {
+        auto prepared = std::make_unique<PreparedPlugin>();
+        prepared->instance = std::move (newPlugin);
+        prepared->settingsVersion = settings.version - 1; // (so it's prepared now)
+
+        setPlugin (std::move (prepared));
+    }
+
+    /** The same, for a plugin from prepareInAdvance(). That's only prepared again if the
+        host has been prepared differently since.
+    */
+    void setPlugin (std::unique_ptr<PreparedPlugin> newPlugin)
+    {
+        HostedPlugin::Ptr holder;
+
+        if (newPlugin != nullptr && newPlugin->instance != nullptr)
+        {
+            holder = new HostedPlugin (std::move (newPlugin->instance), std::move (newPlugin->routing));
+
+            if (settings.prepared && newPlugin->settingsVersion != settings.version)
+                prepare (*holder->instance, holder->routing, settings);
+
+            holder->profile.prepare (settings.sampleRate);
+        }
+
+        current = holder.get();
+        std::swap (owned, holder);
+
+        if (holder != nullptr)
+        {
+            const ScopedLock sl (retiredLock);
+            retired.push_back ({ std::move (holder), callbackEpoch.load() });
+        }
+
+        startTimer (50);
+    }
+
+    /** The plugin process() is using, or will be from its next block on. */
+    AudioPluginInstance* getPlugin() const noexcept
+    {
+        return owned != nullptr ? owned->instance.get() : nullptr;
+    }
+
+    /** How much of each block's time the current plugin has been taking since it was set,
+        or since resetLoadStatistics().
+    */
+    PluginLoadProfile::Statistics getLoadStatistics() const
+    {
+        if (owned == nullptr)
+            return {};
+
+        auto s = owned->profile.getStatistics();
+        s.name = owned->instance->getName();
+        return s;
+    }
+
+    void resetLoadStatistics() noexcept
+    {
+        if (owned != nullptr)
+            owned->profile.resetStatistics();
+    }
+
+    /** Sets how long the old and new plugins are faded across after a swap. Zero
+        switches straight over.
+    */
+    void setCrossfadeSeconds (double seconds) noexcept    { crossfadeSeconds = jmax (0.0, seconds); }
+    double getCrossfadeSeconds() const noexcept           { return crossfadeSeconds.load(); }
+
+    //==============================================================================
+    /** Runs the buffer through the current plugin. Only ever called by the audio thread,
+        with the precision the slot was prepared for.
+    */
+    template <typename FloatType>
+    void process (AudioBuffer<FloatType>& buffer, MidiBuffer& midi)
+    {
+        ++callbackEpoch; // (odd from here on, until we're done with the plugins)
+
+        auto* plugin = current.load();
+
+        if (plugin != lastSeen)
+        {
+            const auto fadeSamples = roundToInt (crossfadeSeconds.load() * settings.sampleRate);
+
+            // (if a fade was still going, the plugin that was fading out is dropped from here)
+            fading = fadeSamples > 0;
+            fadingFrom = fading ? lastSeen : nullptr;
+            fadePosition = 0;
+            fadeLength = fadeSamples;
+            lastSeen = plugin;
+        }
+
+        const auto numSamples = buffer.getNumSamples();
+        const auto numChannels = buffer.getNumChannels();
+
+        auto& scratch = getFadeBuffer (buffer);
+
+        if (fading && numSamples <= scratch.getNumSamples() && numChannels <= scratch.getNumChannels())
+        {
+            auto& outgoing = getFadeView (buffer).refer (scratch.getArrayOfWritePointers(), numChannels, numSamples);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                outgoing.copyFrom (ch, 0, buffer, ch, 0, numSamples);
+
+            fadeMidi.clear();
+            fadeMidi.addEvents (midi, 0, numSamples, 0);
+
+            processWith (fadingFrom.load(), outgoing, fadeMidi); // (its MIDI output is dropped)
+            processWith (plugin, buffer, midi);
+
+            const auto numToFade = jmin (numSamples, fadeLength - fadePosition);
+            const auto startGain = (float) fadePosition / (float) fadeLength;
+            const auto endGain = (float) (fadePosition + numToFade) / (float) fadeLength;
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                buffer.applyGainRamp (ch, 0, numToFade, startGain, endGain);
+                buffer.addFromWithRamp (ch, 0, outgoing.getReadPointer (ch), numToFade, 1.0f - startGain, 1.0f - endGain);
+            }
+
+            fadePosition += numToFade;
+
+            if (fadePosition >= fadeLength)
+            {
+                fading = false;
+                fadingFrom = nullptr;
+            }
+        }
+        else
+        {
+            // (a block bigger than the host was prepared for just cuts over)
+            if (fading)
+            {
+                fading = false;
+                fadingFrom = nullptr;
+            }
+
+            processWith (plugin, buffer, midi);
+        }
+
+        ++callbackEpoch;
+    }
+
+private:
+    struct HostedPlugin : public ReferenceCountedObject
+    {
+        HostedPlugin (std::unique_ptr<AudioPluginInstance> p, ChannelRouting r)
+            : instance (std::move (p)), routing (std::move (r)) {}
+
+        using Ptr = ReferenceCountedObjectPtr<HostedPlugin>;
+        std::unique_ptr<AudioPluginInstance> instance;
+        ChannelRouting routing; // (set up when the instance is prepared)
+        PluginLoadProfile profile;
+    };
+
+    struct RetiredPlugin
+    {
+        HostedPlugin::Ptr plugin;
+        uint64 epoch;
+    };
+
+    // Owned by the message thread
+    HostedPlugin::Ptr owned;
+    Settings settings; // (also read by the audio thread, but only changed while it isn't running)
+    SpinLock settingsLock; // (only for getSettings() on other threads; the owner's thread needs no lock to read them)
+
+    CriticalSection retiredLock; // (the audio thread never takes this)
+    std::vector<RetiredPlugin> retired;
+
+    // Shared with the audio thread
+    std::atomic<HostedPlugin*> current { nullptr };
+    std::atomic<HostedPlugin*> fadingFrom { nullptr };
+    std::atomic<uint64> callbackEpoch { 0 };
+    std::atomic<bool> processing { false };
+    std::atomic<double> crossfadeSeconds { 0.02 };
+
+    // Owned by the audio thread
+    HostedPlugin* lastSeen = nullptr;
+    AudioBuffer<float> fadeBuffer, conversionBuffer;
+    AudioBuffer<double> doubleFadeBuffer;
+    ChannelView<float> fadeView, conversionView;
+    ChannelView<double> doubleFadeView;
+    MidiBuffer fadeMidi, conversionMidi;
+    bool fading = false;
+    int fadePosition = 0, fadeLength = 0;
+
+    static void prepare (AudioPluginInstance& plugin, ChannelRouting& routing, const Settings& s)
+    {
+        const auto native = s.precision == AudioProcessor::doublePrecision && plugin.supportsDoublePrecisionProcessing();
+
+        ChannelRouting::negotiateLayout (plugin, s.numChannels);
+
+        plugin.setProcessingPrecision (native ? AudioProcessor::doublePrecision : AudioProcessor::singlePrecision);
+        plugin.setRateAndBufferSizeDetails (s.sampleRate, s.blockSize);
+        plugin.prepareToPlay (s.sampleRate, s.blockSize);
+
+        routing.prepare (plugin, s.numChannels, s.blockSize);
+    }
+
+    template <typename FloatType>
+    static void processSilence (PreparedPlugin& plugin, const Settings& s, int numBlocks)
+    {
+        AudioBuffer<FloatType> silence (s.numChannels, jmax (1, s.blockSize));
+        MidiBuffer midi;
+
+        for (int i = 0; i < numBlocks; ++i)
+        {
+            silence.clear();
+            midi.clear();
+            plugin.routing.process (*plugin.instance, silence, midi);
+        }
+    }
+
+    AudioBuffer<float>& getFadeBuffer (AudioBuffer<float>&) noexcept       { return fadeBuffer; }
+    AudioBuffer<double>& getFadeBuffer (AudioBuffer<double>&) noexcept     { return doubleFadeBuffer; }
+    ChannelView<float>& getFadeView (AudioBuffer<float>&) noexcept         { return fadeView; }
+    ChannelView<double>& getFadeView (AudioBuffer<double>&) noexcept       { return doubleFadeView; }
+
+    static void processWith (HostedPlugin* plugin, AudioBuffer<float>& buffer, MidiBuffer& midi)
+    {
+        if (plugin == nullptr)
+            return;
+
+        const PluginLoadProfile::ScopedTimer timer (plugin->profile, buffer.getNumSamples());
+        plugin->routing.process (*plugin->instance, buffer, midi);
+    }
+
+    void processWith (HostedPlugin* plugin, AudioBuffer<double>& buffer, MidiBuffer& midi)
+    {
+        if (plugin == nullptr)
+            return;
+
+        const PluginLoadProfile::ScopedTimer timer (plugin->profile, buffer.getNumSamples()); // (conversions included)
+        auto& instance = *plugin->instance;
+
+        if (instance.isUsingDoublePrecision())
+        {
+            plugin->routing.process (instance, buffer, midi);
+            return;
+        }
+
+        const auto numSamples = buffer.getNumSamples();
+        const auto numChannels = jmin (buffer.getNumChannels(), conversionBuffer.getNumChannels());
+        const auto chunkSize = conversionBuffer.getNumSamples();
+
+        if (chunkSize == 0)
+            return;
+
+        // (a block bigger than the host was prepared for goes through in pieces, each with its own MIDI)
+        if (numSamples <= chunkSize)
+        {
+            convertThroughFloat (*plugin, buffer, 0, numSamples, numChannels, midi);
+            return;
+        }
+
+        for (int start = 0; start < numSamples; start += chunkSize)
+        {
+            const auto num = jmin (chunkSize, numSamples - start);
+
+            conversionMidi.clear();
+            conversionMidi.addEvents (midi, start, num, -start);
+            convertThroughFloat (*plugin, buffer, start, num, numChannels, conversionMidi);
+        }
+
+        midi.clear(); // (what the plugin sent out of each piece is dropped, rather than reassembled)
+    }
+
+    void convertThroughFloat (HostedPlugin& plugin, AudioBuffer<double>& buffer,
+                              int start, int numSamples, int numChannels, MidiBuffer& midi)
+    {
+        auto& floats = conversionView.refer (conversionBuffer.getArrayOfWritePointers(), numChannels, numSamples);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            convert (buffer.getReadPointer (ch, start), floats.getWritePointer (ch), numSamples);
+
+        plugin.routing.process (*plugin.instance, floats, midi);
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            convert (floats.getReadPointer (ch), buffer.getWritePointer (ch, start), numSamples);
+    }
+
+    /** A plain loop over contiguous samples, which the compiler turns into packed
+        conversions (cvtpd2ps and cvtps2pd, or their NEON equivalents).
+    */
+    template <typename Source, typename Dest>
+    static void convert (const Source* src, Dest* dest, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = static_cast<Dest> (src[i]);
+    }
+
+    /** True once the audio thread has finished a whole block that started after the
+        plugin was retired, so it has seen the swap, and isn't still fading it out.
+    */
+    bool isSafeToRelease (const RetiredPlugin& r) const
+    {
+        if (! processing.load())
+            return true;
+
+        const auto blockAfterSwapFinished = r.epoch + 2 + (r.epoch & 1);
+        return callbackEpoch.load() >= blockAfterSwapFinished && fadingFrom.load() != r.plugin.get();
+    }
+
+    void releaseRetiredPlugins()
+    {
+        std::vector<RetiredPlugin> toRelease;
+
+        {
+            const ScopedLock sl (retiredLock);
+
+            for (auto it = retired.begin(); it != retired.end();)
+            {
+                if (isSafeToRelease (*it))
+                {
+                    toRelease.push_back (std::move (*it));
+                    it = retired.erase (it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            if (retired.empty())
+                stopTimer();
+        }
+
+        // (the plugins get deleted here, outside the lock)
+    }
+
+    void timerCallback() override
+    {
+        releaseRetiredPlugins();
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (HostedPluginSlot)
+};
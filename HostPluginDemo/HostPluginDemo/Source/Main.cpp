@@ -14,3 +14,30 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new HostAudioProcessor();
 }
+
+//==============================================================================
+bool runChildProcessWorker (const juce::String& commandLine)
+{
+    return PluginSandboxWorker::runIfRequested (commandLine)
+        || PluginScanWorker::runIfRequested (commandLine);
+}
+
+//==============================================================================
+bool runUnitTests (const juce::String& commandLine)
+{
+    if (! commandLine.contains ("--run-unit-tests"))
+        return false;
+
+    PluginSandboxTests sandboxTests;
+    juce::UnitTestRunner runner;
+    runner.runTests ({ &sandboxTests });
+
+    int numFailures = 0;
+
+    for (int i = 0; i < runner.getNumResults(); ++i)
+        numFailures += runner.getResult (i)->failures;
+
+    juce::JUCEApplicationBase::getInstance()->setApplicationReturnValue (numFailures > 0 ? 1 : 0);
+    juce::JUCEApplicationBase::quit();
+    return true;
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+//==============================================================================
+/*  Keeps a KnownPluginList on disk in a compact binary file that only ever has
+    the changes appended to it, and saves it, together with the app's settings,
+    on a background thread.
+
+    The file is a short header followed by records. Each record adds or replaces
+    one plugin, removes one, or adds or removes one blacklisted file, and carries
+    its own length and checksum, so a record that was cut short by a crash is just
+    ignored. load() maps the file with MemoryMappedFile and replays the records
+    into an index of what's stored, so nothing is parsed beyond the records
+    themselves.
+
+    saveSoon() can be called on every change. It only takes a copy of the list's
+    types and blacklist, since KnownPluginList doesn't lock its blacklist against
+    other threads, and wakes the thread. That waits a moment for further changes,
+    then compares the latest copy with what was last loaded or saved and appends a
+    record for each difference. Once most of the file is records that later ones
+    have overridden, it's rewritten from scratch instead.
+
+    Every instance of the plugin shares the same file, so loading and saving hold
+    an InterProcessLock. If the file's size or time isn't what this instance last
+    left it at, another one has written to it since, and it's indexed again before
+    anything is appended; only this instance's own changes go on top, so the other
+    one's aren't lost. Nothing counts as saved until it has been written, so after
+    a failed write the same changes are tried again next time.
+*/
+class PluginListStore : private Thread
+{
+public:
+    PluginListStore (const File& fileToUse, KnownPluginList& listToStore, PropertiesFile& settingsToSave)
+        : Thread ("Plugin list store"), file (fileToUse), list (listToStore), settings (settingsToSave),
+          fileLock ("PluginListStore_" + String::toHexString (fileToUse.getFullPathName().hashCode64()))
+    {
+        startThread (3);
+    }
+
+    /** Writes out anything that's still waiting. */
+    ~PluginListStore() override
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread (10000);
+
+        if (auto snapshot = takeSnapshot())
+            save (*snapshot);
+    }
+
+    /** Fills the list from the file. Returns false if there isn't a usable one, e.g. the
+        first time, when the list has to come from somewhere else.
+    */
+    bool load()
+    {
+        const ScopedLock sl (lock);
+        const InterProcessLock::ScopedLockType fl (fileLock);
+
+        if (! readIndex())
+            return false;
+
+        list.clear();
+        list.clearBlacklistedFiles();
+
+        for (const auto& pair : stored)
+        {
+            PluginDescription d;
+
+            if (readDescription (pair.second, d))
+                list.addType (d);
+        }
+
+        for (const auto& b : storedBlacklist)
+            list.addToBlacklist (b);
+
+        synced = stored;
+        syncedBlacklist = storedBlacklist;
+        return true;
+    }
+
+    /** Asks for the list and the settings to be saved shortly, on the background thread.
+        Call it on the message thread, where the list is changed.
+    */
+    void saveSoon()
+    {
+        auto snapshot = std::make_unique<Snapshot>();
+        snapshot->types = list.getTypes();
+        snapshot->blacklist = list.getBlacklistedFiles();
+
+        {
+            const ScopedLock sl (snapshotLock);
+            std::swap (latest, snapshot);
+        }
+
+        notify();
+    }
+
+private:
+    enum RecordType : uint8 { addType = 1, removeType, addBlacklisted, removeBlacklisted };
+
+    struct Snapshot
+    {
+        Array<PluginDescription> types;
+        StringArray blacklist;
+    };
+
+    struct Record
+    {
+        uint8 type = 0;
+        const uint8* payload = nullptr;
+        int size = 0, keySize = 0;
+    };
+
+    static constexpr uint32 magic = 0x4c504a44; // "DJPL" when written little-endian
+    static constexpr uint32 formatVersion = 1;
+    static constexpr int headerSize = 8;
+    static constexpr int recordHeaderSize = 13; // (size, type, key size, checksum)
+    static constexpr int coalesceMs = 500;
+
+    const File file;
+    KnownPluginList& list;
+    PropertiesFile& settings;
+
+    CriticalSection lock; // (keeps save() on the thread and in the destructor apart)
+    InterProcessLock fileLock; // (keeps other instances out of the file meanwhile)
+
+    std::map<String, MemoryBlock> stored; // (what the file holds, by identifier)
+    std::set<String> storedBlacklist;
+    int64 storedSize = 0; // (up to the end of the last whole record)
+    int numStoredRecords = 0;
+    bool loaded = false;
+    int64 knownFileSize = -1; // (as this instance last read or left the file)
+    Time knownFileTime;
+
+    std::map<String, MemoryBlock> synced; // (this instance's list as it was last loaded or saved)
+    std::set<String> syncedBlacklist;
+
+    CriticalSection snapshotLock;
+    std::unique_ptr<Snapshot> latest; // (the newest copy that hasn't been saved yet)
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            wait (-1);
+
+            // (anything else that changes in the meantime goes in the same save)
+            if (! threadShouldExit())
+                wait (coalesceMs);
+
+            if (auto snapshot = takeSnapshot())
+                save (*snapshot);
+        }
+    }
+
+    std::unique_ptr<Snapshot> takeSnapshot()
+    {
+        const ScopedLock sl (snapshotLock);
+        return std::move (latest);
+    }
+
+    void save (const Snapshot& snapshot)
+    {
+        const ScopedLock sl (lock);
+        const InterProcessLock::ScopedLockType fl (fileLock);
+
+        std::map<String, MemoryBlock> current;
+
+        for (const auto& d : snapshot.types)
+            current[d.createIdentifierString()] = writeDescription (d);
+
+        const std::set<String> currentBlacklist (snapshot.blacklist.begin(), snapshot.blacklist.end());
+
+        if (file.getSize() != knownFileSize || file.getLastModificationTime() != knownFileTime)
+            readIndex();
+
+        // (only what changed here since the last save, on top of whatever's in the file now)
+        auto next = stored;
+        auto nextBlacklist = storedBlacklist;
+        MemoryOutputStream changes;
+        int numChanges = 0;
+
+        for (const auto& pair : current)
+        {
+            const auto it = synced.find (pair.first);
+
+            if (it == synced.end() || it->second != pair.second)
+            {
+                numChanges += writeRecord (changes, addType, pair.second);
+                next[pair.first] = pair.second;
+            }
+        }
+
+        for (const auto& pair : synced)
+        {
+            if (current.find (pair.first) == current.end())
+            {
+                numChanges += writeRecord (changes, removeType, keyOnly (pair.first));
+                next.erase (pair.first);
+            }
+        }
+
+        for (const auto& b : currentBlacklist)
+        {
+            if (syncedBlacklist.count (b) == 0)
+            {
+                numChanges += writeRecord (changes, addBlacklisted, keyOnly (b));
+                nextBlacklist.insert (b);
+            }
+        }
+
+        for (const auto& b : syncedBlacklist)
+        {
+            if (currentBlacklist.count (b) == 0)
+            {
+                numChanges += writeRecord (changes, removeBlacklisted, keyOnly (b));
+                nextBlacklist.erase (b);
+            }
+        }
+
+        const auto numLive = (int) (next.size() + nextBlacklist.size());
+        const auto compact = ! loaded || numStoredRecords + numChanges > 2 * numLive + 64;
+
+        const auto written = compact ? rewrite (next, nextBlacklist)
+                                     : (numChanges == 0 || append (changes.getMemoryBlock(), numChanges));
+
+        if (written)
+        {
+            stored = std::move (next);
+            storedBlacklist = std::move (nextBlacklist);
+            synced = std::move (current);
+            syncedBlacklist = currentBlacklist;
+        }
+
+        settings.saveIfNeeded();
+    }
+
+    /** Replays the file's records into the index. Returns false, with the index empty, if
+        there isn't a usable file.
+    */
+    bool readIndex()
+    {
+        stored.clear();
+        storedBlacklist.clear();
+        storedSize = 0;
+        numStoredRecords = 0;
+        loaded = false;
+        knownFileSize = file.getSize();
+        knownFileTime = file.getLastModificationTime();
+
+        MemoryMappedFile mapped (file, MemoryMappedFile::readOnly);
+
+        if (mapped.getData() == nullptr || ! readHeader (mapped))
+            return false;
+
+        const auto* data = static_cast<const uint8*> (mapped.getData());
+        const auto size = (int64) mapped.getSize();
+        auto validSize = (int64) headerSize;
+
+        for (Record r; readRecord (data, size, validSize, r); validSize += recordHeaderSize + r.size)
+        {
+            const auto key = String::fromUTF8 (reinterpret_cast<const char*> (r.payload), r.keySize);
+            ++numStoredRecords;
+
+            switch (r.type)
+            {
+                case addType:           stored[key] = MemoryBlock (r.payload, (size_t) r.size); break;
+                case removeType:        stored.erase (key); break;
+                case addBlacklisted:    storedBlacklist.insert (key); break;
+                case removeBlacklisted: storedBlacklist.erase (key); break;
+                default:                break;
+            }
+        }
+
+        storedSize = validSize;
+        loaded = true;
+        return true;
+    }
+
+    void noteFileWritten()
+    {
+        knownFileSize = file.getSize();
+        knownFileTime = file.getLastModificationTime();
+    }
+
+    bool append (const MemoryBlock& records, int numRecords)
+    {
+        {
+            FileOutputStream out (file);
+
+            // (drops anything after the last whole record, e.g. one that a crash cut short)
+            if (! out.openedOk() || ! out.setPosition (storedSize) || out.truncate().failed())
+                return false;
+
+            out.write (records.getData(), records.getSize());
+            out.flush();
+
+            if (out.getStatus().failed())
+            {
+                knownFileSize = -1; // (whatever did get written is indexed again next time)
+                return false;
+            }
+        }
+
+        storedSize += (int64) records.getSize();
+        numStoredRecords += numRecords;
+        noteFileWritten();
+        return true;
+    }
+
+    bool rewrite (const std::map<String, MemoryBlock>& types, const std::set<String>& blacklist)
+    {
+        file.getParentDirectory().createDirectory();
+        TemporaryFile temp (file);
+
+        int numRecords = 0;
+        int64 size = 0;
+
+        {
+            FileOutputStream out (temp.getFile());
+
+            if (! out.openedOk())
+                return false;
+
+            out.writeInt ((int) magic);
+            out.writeInt ((int) formatVersion);
+
+            for (const auto& pair : types)
+                numRecords += writeRecord (out, addType, pair.second);
+
+            for (const auto& b : blacklist)
+                numRecords += writeRecord (out, addBlacklisted, keyOnly (b));
+
+            out.flush();
+            size = out.getPosition();
+
+            if (out.getStatus().failed())
+                return false;
+        }
+
+        if (! temp.overwriteTargetFileWithTemporary())
+            return false;
+
+        storedSize = size;
+        numStoredRecords = numRecords;
+        loaded = true;
+        noteFileWritten();
+        return true;
+    }
+
+    //==============================================================================
+    static bool readHeader (const MemoryMappedFile& mapped)
+    {
+        if (mapped.getSize() < (size_t) headerSize)
+            return false;
+
+        const auto* data = static_cast<const uint8*> (mapped.getData());
+        return ByteOrder::littleEndianInt (data) == magic
+            && ByteOrder::littleEndianInt (data + 4) == formatVersion;
+    }
+
+    static bool readRecord (const uint8* data, int64 size, int64 offset, Record& r)
+    {
+        if (offset + recordHeaderSize > size)
+            return false;
+
+        const auto* header = data + offset;
+        r.size = (int) ByteOrder::littleEndianInt (header);
+        r.type = header[4];
+        r.keySize = (int) ByteOrder::littleEndianInt (header + 5);
+        r.payload = header + recordHeaderSize;
+
+        return r.size >= 0 && isPositiveAndNotGreaterThan (r.keySize, r.size)
+            && offset + recordHeaderSize + r.size <= size
+            && ByteOrder::littleEndianInt (header + 9) == checksum (r.payload, r.size);
+    }
+
+    /** Every payload starts with its key, so a record can be indexed without decoding the rest. */
+    static int writeRecord (OutputStream& out, RecordType type, const MemoryBlock& payload)
+    {
+        const auto* bytes = static_cast<const uint8*> (payload.getData());
+        const auto keySize = (int) std::strlen (static_cast<const char*> (payload.getData()));
+
+        out.writeInt ((int) payload.getSize());
+        out.writeByte ((char) type);
+        out.writeInt (keySize);
+        out.writeInt ((int) checksum (bytes, (int) payload.getSize()));
+        out.write (bytes, payload.getSize());
+        return 1;
+    }
+
+    static MemoryBlock keyOnly (const String& key)
+    {
+        MemoryOutputStream out;
+        out.writeString (key);
+        return out.getMemoryBlock();
+    }
+
+    static uint32 checksum (const uint8* data, int size) noexcept
+    {
+        uint32 hash = 2166136261u; // (FNV-1a)
+
+        for (int i = 0; i < size; ++i)
+            hash = (hash ^ data[i]) * 16777619u;
+
+        return hash;
+    }
+
+    static MemoryBlock writeDescription (const PluginDescription& d)
+    {
+        MemoryOutputStream out;
+        out.writeString (d.createIdentifierString());
+
+        for (const auto* s : { &d.name, &d.descriptiveName, &d.pluginFormatName, &d.category,
+                               &d.manufacturerName, &d.version, &d.fileOrIdentifier })
+            out.writeString (*s);
+
+        out.writeInt64 (d.lastFileModTime.toMilliseconds());
+        out.writeInt64 (d.lastInfoUpdateTime.toMilliseconds());
+        out.writeInt (d.deprecatedUid);
+        out.writeInt (d.uniqueId);
+        out.writeInt (d.numInputChannels);
+        out.writeInt (d.numOutputChannels);
+        out.writeByte ((char) ((d.isInstrument ? 1 : 0) | (d.hasSharedContainer ? 2 : 0) | (d.hasARAExtension ? 4 : 0)));
+        return out.getMemoryBlock();
+    }
+
+    static bool readDescription (const MemoryBlock& block, PluginDescription& d)
+    {
+        MemoryInputStream in (block, false);
+        in.readString(); // (the key)
+
+        for (auto* s : { &d.name, &d.descriptiveName, &d.pluginFormatName, &d.category,
+                         &d.manufacturerName, &d.version, &d.fileOrIdentifier })
+            *s = in.readString();
+
+        d.lastFileModTime = Time (in.readInt64());
+        d.lastInfoUpdateTime = Time (in.readInt64());
+        d.deprecatedUid = in.readInt();
+        d.uniqueId = in.readInt();
+        d.numInputChannels = in.readInt();
+        d.numOutputChannels = in.readInt();
+
+        if (in.getNumBytesRemaining() != 1)
+            return false;
+
+        const auto flags = in.readByte();
+        d.isInstrument = (flags & 1) != 0;
+        d.hasSharedContainer = (flags & 2) != 0;
+        d.hasARAExtension = (flags & 4) != 0;
+
+        return true;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginListStore)
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+//==============================================================================
+/*  Measures how much of each block's deadline one hosted plugin uses.
+
+    It works like AudioProcessLoadMeasurer: a ScopedTimer times each call, and the
+    time is divided by the real-time duration of the samples processed, so 1.0
+    means the plugin alone took as long as the block lasts. Each block's load is
+    counted in a histogram, so the median and 99th percentile can be read off
+    later, along with the worst block and how many blocks overran.
+
+    Only one thread at a time records into a profile, normally the audio thread,
+    and it never locks or allocates. The counters are atomics that it stores to
+    without read-modify-write operations, which other threads can read at any
+    time. resetStatistics() only asks for a reset, which the recording thread does
+    at its next block.
+*/
+class PluginLoadProfile
+{
+public:
+    struct Statistics
+    {
+        String name;
+        uint64 numBlocks = 0, numOverruns = 0;
+        double median = 0.0, percentile99 = 0.0, maximum = 0.0; // (as fractions of the blocks' durations)
+    };
+
+    /** Times one call, from its construction to its destruction. */
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer (PluginLoadProfile& p, int numSamplesInBlock) noexcept
+            : profile (p), numSamples (numSamplesInBlock), start (Time::getHighResolutionTicks()) {}
+
+        ~ScopedTimer()
+        {
+            profile.registerRenderTime (Time::getHighResolutionTicks() - start, numSamples);
+        }
+
+    private:
+        PluginLoadProfile& profile;
+        const int numSamples;
+        const int64 start;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedTimer)
+    };
+
+    PluginLoadProfile() = default;
+
+    /** Only while nothing's recording, e.g. when the plugin's prepared. */
+    void prepare (double sampleRate) noexcept
+    {
+        loadPerTickPerSample = sampleRate / (double) Time::getHighResolutionTicksPerSecond();
+    }
+
+    void registerRenderTime (int64 ticks, int numSamples) noexcept
+    {
+        if (resetRequested.load (std::memory_order_relaxed) && resetRequested.exchange (false))
+            clear();
+
+        if (numSamples <= 0)
+            return;
+
+        const auto load = (double) ticks * loadPerTickPerSample / (double) numSamples;
+        const auto bin = jlimit (0, numBins - 1, (int) (load * binsPerUnit));
+
+        increment (bins[(size_t) bin]);
+        increment (numBlocks);
+
+        if (load > 1.0)
+            increment (numOverruns);
+
+        if (load > maximum.load (std::memory_order_relaxed))
+            maximum.store (load, std::memory_order_relaxed);
+    }
+
+    /** Can be called on any thread. The percentiles are rounded up to the next half a percent. */
+    Statistics getStatistics() const
+    {
+        Statistics s;
+        s.numBlocks = numBlocks.load (std::memory_order_relaxed);
+        s.numOverruns = numOverruns.load (std::memory_order_relaxed);
+        s.maximum = maximum.load (std::memory_order_relaxed);
+
+        uint64 total = 0;
+
+        for (const auto& b : bins)
+            total += b.load (std::memory_order_relaxed);
+
+        if (total == 0)
+            return s;
+
+        uint64 count = 0;
+        auto foundMedian = false;
+
+        for (int i = 0; i < numBins; ++i)
+        {
+            count += bins[(size_t) i].load (std::memory_order_relaxed);
+            const auto upperEdge = jmin (s.maximum, (double) (i + 1) / binsPerUnit);
+
+            if (! foundMedian && count * 2 >= total)
+            {
+                s.median = upperEdge;
+                foundMedian = true;
+            }
+
+            if (count * 100 >= total * 99)
+            {
+                s.percentile99 = upperEdge;
+                break;
+            }
+        }
+
+        return s;
+    }
+
+    /** Can be called on any thread. */
+    void resetStatistics() noexcept
+    {
+        resetRequested = true;
+    }
+
+private:
+    static constexpr int binsPerUnit = 200;
+    static constexpr int numBins = 2 * binsPerUnit + 1; // (up to twice the deadline, then one for anything beyond)
+
+    double loadPerTickPerSample = 0.0;
+    std::array<std::atomic<uint64>, (size_t) numBins> bins {};
+    std::atomic<uint64> numBlocks { 0 }, numOverruns { 0 };
+    std::atomic<double> maximum { 0.0 };
+    std::atomic<bool> resetRequested { false };
+
+    /** Only the recording thread writes, so this needn't be a locked increment. */
+    static void increment (std::atomic<uint64>& counter) noexcept
+    {
+        counter.store (counter.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void clear() noexcept
+    {
+        for (auto& b : bins)
+            b.store (0, std::memory_order_relaxed);
+
+        numBlocks.store (0, std::memory_order_relaxed);
+        numOverruns.store (0, std::memory_order_relaxed);
+        maximum.store (0.0, std::memory_order_relaxed);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE (PluginLoadProfile)
+};
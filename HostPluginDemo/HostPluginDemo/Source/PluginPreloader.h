@@ -0,0 +1,247 @@
+#pragma once
+
+#include "HostedPluginSlot.h"
+
+//==============================================================================
+/*  Gets plugins ready for a HostedPluginSlot on a background thread, so that
+    neither the message thread nor the audio thread waits for a heavy one.
+
+    On the preloader's thread, each plugin has its state restored, is prepared
+    with HostedPluginSlot::prepareInAdvance() for however the host is prepared at
+    the time, and has a few blocks of silence run through it to warm it up. The
+    callback then gets it on the message thread, ready for setPlugin() to publish
+    with nothing more than a pointer swap.
+
+    JUCE's plugin formats create their instances on the message thread, so a plugin
+    is normally created there first and handed over. Anything that can be created
+    elsewhere, like a sandboxed plugin, can be created on the preloader's thread
+    too, by passing a function that does it.
+
+    VST3 plugins are the exception. The VST3 spec has their state set, and their
+    processing set up and activated, on the message thread, and JUCE asserts that
+    it is and locks the message manager if it isn't. So they, and anything else
+    the caller says needs it, have their state restored, are prepared and are
+    reset on the message thread, and only the warm-up runs on the preloader's.
+    That keeps the preloader from ever waiting for the message thread, which may
+    itself be waiting for the preloader to stop.
+
+    Only the newest request counts. One that's overtaken by another before it's
+    done is dropped, and its callback is never called.
+*/
+class PluginPreloader : private Thread,
+                        private AsyncUpdater
+{
+public:
+    using Callback = std::function<void (std::unique_ptr<HostedPluginSlot::PreparedPlugin>, const String& error)>;
+    using Creator = std::function<std::unique_ptr<AudioPluginInstance> (String& error)>;
+    using StateRestorer = std::function<void (AudioPluginInstance&)>;
+
+    /** The slot has to outlive the preloader. */
+    explicit PluginPreloader (const HostedPluginSlot& slotToPrepareFor)
+        : Thread ("Plugin preloader"), slot (slotToPrepareFor)
+    {
+        startThread (4);
+    }
+
+    ~PluginPreloader() override
+    {
+        signalThreadShouldExit();
+        notify();
+        stopThread (60000); // (a plugin that's being prepared has to be let finish)
+        cancelPendingUpdate();
+    }
+
+    /** Readies a plugin that's already been created. Pass true for prepareOnMessageThread
+        if it contains plugins that needsMessageThread() would be true for, e.g. a rack.
+    */
+    void preload (std::unique_ptr<AudioPluginInstance> plugin, StateRestorer restoreState, Callback callback,
+                  int numWarmUpBlocks = 4, bool prepareOnMessageThread = false)
+    {
+        auto job = std::make_unique<Job>();
+        job->preparesOnMessageThread = prepareOnMessageThread || (plugin != nullptr && needsMessageThread (*plugin));
+        job->plugin = std::move (plugin);
+        job->restoreState = std::move (restoreState);
+        job->callback = std::move (callback);
+        job->numWarmUpBlocks = numWarmUpBlocks;
+        add (std::move (job));
+    }
+
+    /** Creates a plugin on the preloader's thread, and then readies it. */
+    void preload (Creator create, StateRestorer restoreState, Callback callback, int numWarmUpBlocks = 4)
+    {
+        auto job = std::make_unique<Job>();
+        job->create = std::move (create);
+        job->restoreState = std::move (restoreState);
+        job->callback = std::move (callback);
+        job->numWarmUpBlocks = numWarmUpBlocks;
+        add (std::move (job));
+    }
+
+    /** True for plugins whose state can only be restored, and that can only be prepared
+        and reset, on the message thread.
+    */
+    static bool needsMessageThread (const AudioPluginInstance& plugin)
+    {
+        return plugin.getPluginDescription().pluginFormatName == "VST3";
+    }
+
+    /** Drops whatever's waiting or being readied. */
+    void cancel()
+    {
+        std::unique_ptr<Job> cancelled;
+
+        const ScopedLock sl (lock);
+        ++newest;
+        cancelled = std::move (waiting);
+    }
+
+private:
+    struct Job
+    {
+        Creator create;
+        std::unique_ptr<AudioPluginInstance> plugin;
+        StateRestorer restoreState;
+        Callback callback;
+        int numWarmUpBlocks = 0;
+        bool preparesOnMessageThread = false, needsResetting = false;
+        uint32 number = 0;
+
+        std::unique_ptr<HostedPluginSlot::PreparedPlugin> prepared;
+        HostedPluginSlot::Settings preparedWith;
+        String error;
+    };
+
+    const HostedPluginSlot& slot;
+
+    CriticalSection lock;
+    std::unique_ptr<Job> waiting;
+    std::vector<std::unique_ptr<Job>> toPrepare, finished;
+    uint32 newest = 0;
+
+    void add (std::unique_ptr<Job> job)
+    {
+        std::unique_ptr<Job> overtaken;
+
+        {
+            const ScopedLock sl (lock);
+            job->number = ++newest;
+            overtaken = std::move (waiting);
+            waiting = std::move (job);
+        }
+
+        // (an overtaken plugin is deleted here, on the caller's thread, outside the lock)
+        notify();
+    }
+
+    bool isNewest (const Job& job)
+    {
+        const ScopedLock sl (lock);
+        return job.number == newest;
+    }
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            std::unique_ptr<Job> job;
+
+            {
+                const ScopedLock sl (lock);
+                job = std::move (waiting);
+            }
+
+            if (job == nullptr)
+            {
+                wait (-1);
+                continue;
+            }
+
+            if (job->create != nullptr)
+            {
+                job->plugin = job->create (job->error);
+                job->create = nullptr;
+            }
+
+            if (job->plugin != nullptr && isNewest (*job))
+            {
+                if (job->preparesOnMessageThread)
+                {
+                    // (comes back here to be warmed up once it's prepared)
+                    handBack (std::move (job), toPrepare);
+                    continue;
+                }
+
+                NullCheckedInvocation::invoke (job->restoreState, *job->plugin);
+                job->prepared = HostedPluginSlot::prepareInAdvance (std::move (job->plugin), slot.getSettings(),
+                                                                    job->numWarmUpBlocks);
+            }
+            else if (job->prepared != nullptr && isNewest (*job))
+            {
+                HostedPluginSlot::warmUp (*job->prepared, job->preparedWith, job->numWarmUpBlocks);
+                job->needsResetting = true;
+            }
+
+            // (handed back even if it's been overtaken, so the plugin is deleted on the message thread)
+            handBack (std::move (job), finished);
+        }
+    }
+
+    void handBack (std::unique_ptr<Job> job, std::vector<std::unique_ptr<Job>>& list)
+    {
+        {
+            const ScopedLock sl (lock);
+            list.push_back (std::move (job));
+        }
+
+        triggerAsyncUpdate();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        std::vector<std::unique_ptr<Job>> jobsToPrepare, jobs;
+
+        {
+            const ScopedLock sl (lock);
+            std::swap (jobsToPrepare, toPrepare);
+            std::swap (jobs, finished);
+        }
+
+        for (auto& job : jobsToPrepare)
+        {
+            if (! isNewest (*job))
+                continue;
+
+            NullCheckedInvocation::invoke (job->restoreState, *job->plugin);
+            job->preparedWith = slot.getSettings();
+            job->prepared = HostedPluginSlot::prepareInAdvance (std::move (job->plugin), job->preparedWith, 0);
+
+            if (job->numWarmUpBlocks > 0 && job->preparedWith.prepared)
+            {
+                {
+                    const ScopedLock sl (lock);
+                    jassert (waiting == nullptr); // (anything added since would have overtaken this)
+                    waiting = std::move (job);
+                }
+
+                notify();
+                continue;
+            }
+
+            jobs.push_back (std::move (job));
+        }
+
+        for (auto& job : jobs)
+        {
+            if (! isNewest (*job))
+                continue;
+
+            // (after a warm-up on the preloader's thread, so nothing it did carries over into the host's audio)
+            if (job->needsResetting)
+                job->prepared->instance->reset();
+
+            NullCheckedInvocation::invoke (job->callback, std::move (job->prepared), job->error);
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginPreloader)
+};
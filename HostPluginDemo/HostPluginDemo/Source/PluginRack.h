@@ -0,0 +1,621 @@
+#pragma once
+
+#include "RealtimeWorkerPool.h"
+#include "ChannelRouting.h"
+#include "PluginLoadProfile.h"
+
+//==============================================================================
+/*  A rack of plugins that the host can load in place of a single one.
+
+    The rack is split into branches. Each branch takes a range of the rack's
+    channels, e.g. one stem of a multichannel Dante feed, and runs them through a
+    serial chain of plugins in its own AudioProcessorGraph. Branches can also
+    share channels, in which case they run side by side on copies of the same
+    input and their outputs are summed. Channels that no branch takes pass straight
+    through.
+
+    The branches don't depend on each other, so each callback hands them to a
+    RealtimeWorkerPool as one batch and a rack with several heavy branches spreads
+    across cores instead of running on the audio thread alone.
+
+    Each plugin sits in its graph inside a thin wrapper that times its calls into a
+    PluginLoadProfile of its own, so a chain's load can be told apart plugin by
+    plugin, as well as for the branch as a whole.
+
+    A rack is built completely before it's handed to the audio thread, and doesn't
+    change after that. Editing one means building a new rack from the old one's
+    XML, which the host then swaps in like any other plugin.
+*/
+class PluginRack : public AudioPluginInstance,
+                   private RealtimeWorkerPool::Job
+{
+public:
+    /** The pool is shared and must outlive the rack. */
+    PluginRack (RealtimeWorkerPool& poolToUse, int numChannels)
+        : AudioPluginInstance (BusesProperties().withInput  ("Input",  AudioChannelSet::canonicalChannelSet (numChannels), true)
+                                                .withOutput ("Output", AudioChannelSet::canonicalChannelSet (numChannels), true)),
+          pool (poolToUse)
+    {
+    }
+
+    //==============================================================================
+    /** Adds an empty branch that processes this range of the rack's channels, and
+        returns its index. Only for racks that aren't in use yet.
+    */
+    int addBranch (int firstChannel, int numChannels)
+    {
+        jassert (firstChannel >= 0 && numChannels > 0 && firstChannel + numChannels <= getMainBusNumInputChannels());
+
+        branches.push_back (std::make_unique<Branch> (firstChannel, numChannels));
+        return (int) branches.size() - 1;
+    }
+
+    /** Appends a plugin to the end of a branch's chain. Only for racks that aren't in
+        use yet.
+    */
+    void addPlugin (int branchIndex, std::unique_ptr<AudioPluginInstance> plugin)
+    {
+        jassert (isPositiveAndBelow (branchIndex, getNumBranches()) && plugin != nullptr);
+
+        auto& branch = *branches[(size_t) branchIndex];
+
+        // (a plugin that won't take the branch's layout keeps its own, and only gets the channels it has)
+        plugin->enableAllBuses();
+        ChannelRouting::negotiateLayout (*plugin, branch.numChannels);
+
+        branch.chain.push_back (branch.graph.addNode (std::make_unique<TimedPlugin> (std::move (plugin))));
+        branch.connectChain();
+    }
+
+    int getNumBranches() const noexcept                         { return (int) branches.size(); }
+    Range<int> getBranchChannels (int branchIndex) const        { auto& b = *branches[(size_t) branchIndex]; return { b.firstChannel, b.firstChannel + b.numChannels }; }
+    int getNumPlugins (int branchIndex) const                   { return (int) branches[(size_t) branchIndex]->chain.size(); }
+
+    AudioPluginInstance* getPlugin (int branchIndex, int pluginIndex) const
+    {
+        return &getTimedPlugin (branchIndex, pluginIndex).getPlugin();
+    }
+
+    /** How much of each block's time a branch's whole chain has been taking, on whichever
+        thread it ran.
+    */
+    PluginLoadProfile::Statistics getBranchLoadStatistics (int branchIndex) const
+    {
+        auto s = branches[(size_t) branchIndex]->profile.getStatistics();
+        StringArray names;
+
+        for (int p = 0; p < getNumPlugins (branchIndex); ++p)
+            names.add (getPlugin (branchIndex, p)->getName());
+
+        s.name = "Branch " + String (branchIndex + 1) + ": " + names.joinIntoString (" > ");
+        return s;
+    }
+
+    /** How much of each block's time one plugin in a branch's chain has been taking. */
+    PluginLoadProfile::Statistics getPluginLoadStatistics (int branchIndex, int pluginIndex) const
+    {
+        auto& timed = getTimedPlugin (branchIndex, pluginIndex);
+        auto s = timed.getProfile().getStatistics();
+        s.name = "Branch " + String (branchIndex + 1) + ", " + String (pluginIndex + 1) + ": " + timed.getName();
+        return s;
+    }
+
+    void resetLoadStatistics() noexcept
+    {
+        for (auto& b : branches)
+        {
+            b->profile.resetStatistics();
+
+            for (auto& node : b->chain)
+                static_cast<TimedPlugin*> (node->getProcessor())->getProfile().resetStatistics();
+        }
+    }
+
+    //==============================================================================
+    /** Describes the branches and every plugin in them, along with each plugin's state,
+        so the rack can be rebuilt with createFromXml(). If a vector's given, the states
+        are added to that, in the order of the plugins in the XML, instead of going into
+        the XML as base64.
+    */
+    std::unique_ptr<XmlElement> createXml (std::vector<MemoryBlock>* states = nullptr)
+    {
+        auto xml = createEmptyXml (getMainBusNumInputChannels());
+
+        for (int b = 0; b < getNumBranches(); ++b)
+        {
+            auto& branchXml = addBranchToXml (*xml, getBranchChannels (b));
+
+            for (int p = 0; p < getNumPlugins (b); ++p)
+            {
+                auto* plugin = getPlugin (b, p);
+
+                MemoryBlock state;
+                plugin->getStateInformation (state);
+
+                if (states != nullptr)
+                {
+                    addPluginToXml (branchXml, plugin->getPluginDescription(), {});
+                    states->push_back (std::move (state));
+                }
+                else
+                {
+                    addPluginToXml (branchXml, plugin->getPluginDescription(), state);
+                }
+            }
+        }
+
+        return xml;
+    }
+
+    static std::unique_ptr<XmlElement> createEmptyXml (int numChannels)
+    {
+        auto xml = std::make_unique<XmlElement> (rackTag);
+        xml->setAttribute ("channels", numChannels);
+        return xml;
+    }
+
+    /** Adds a branch to a rack's XML, across all its channels unless a range is given. */
+    static XmlElement& addBranchToXml (XmlElement& rackXml, Range<int> channels = {})
+    {
+        if (channels.isEmpty())
+            channels = { 0, rackXml.getIntAttribute ("channels", 2) };
+
+        auto* branchXml = rackXml.createNewChildElement (branchTag);
+        branchXml->setAttribute ("first", channels.getStart());
+        branchXml->setAttribute ("channels", channels.getLength());
+        return *branchXml;
+    }
+
+    static void addPluginToXml (XmlElement& branchXml, const PluginDescription& description, const MemoryBlock& state)
+    {
+        auto* pluginXml = branchXml.createNewChildElement (slotTag);
+        pluginXml->addChildElement (description.createXml().release());
+
+        if (! state.isEmpty())
+            pluginXml->createNewChildElement (stateTag)->addTextElement (state.toBase64Encoding());
+    }
+
+    using CreationCallback = std::function<void (std::unique_ptr<PluginRack>, const String& errors)>;
+
+    /** Builds a rack from XML made by createXml(), creating its plugins one after another.
+        The callback gets the rack on the message thread, along with the reasons for any
+        plugins that couldn't be created, which are left out.
+
+        The plugins' states are taken from the vector, if createXml() put them in one,
+        and otherwise from the XML. They aren't restored until restoreStates() is called,
+        so that can be done off the message thread.
+    */
+    static void createFromXml (const XmlElement& rackXml, AudioPluginFormatManager& formatManager,
+                               RealtimeWorkerPool& pool, double sampleRate, int blockSize,
+                               CreationCallback callback, std::vector<MemoryBlock> states = {})
+    {
+        auto loader = std::make_shared<Loader> (formatManager, sampleRate, blockSize, std::move (callback));
+        loader->rack = std::make_unique<PluginRack> (pool, rackXml.getIntAttribute ("channels", 2));
+        size_t slotIndex = 0;
+
+        for (auto* branchXml : rackXml.getChildWithTagNameIterator (branchTag))
+        {
+            const auto first = branchXml->getIntAttribute ("first");
+            const auto numChannels = branchXml->getIntAttribute ("channels");
+
+            if (first < 0 || numChannels <= 0 || first + numChannels > loader->rack->getMainBusNumInputChannels())
+            {
+                slotIndex += (size_t) branchXml->getNumChildElements(); // (so the states still line up)
+                continue;
+            }
+
+            const auto branchIndex = loader->rack->addBranch (first, numChannels);
+
+            for (auto* pluginXml : branchXml->getChildWithTagNameIterator (slotTag))
+            {
+                const auto index = slotIndex++;
+                Loader::Pending pending;
+                pending.branchIndex = branchIndex;
+
+                auto* descriptionXml = pluginXml->getChildByName ("PLUGIN");
+
+                if (descriptionXml != nullptr && pending.description.loadFromXml (*descriptionXml))
+                {
+                    if (index < states.size())
+                        pending.state = std::move (states[index]);
+                    else
+                        pending.state.fromBase64Encoding (pluginXml->getChildElementAllSubText (stateTag, {}));
+
+                    loader->pending.push_back (std::move (pending));
+                }
+            }
+        }
+
+        Loader::loadNext (loader);
+    }
+
+    static bool isRackXml (const XmlElement& xml)       { return xml.hasTagName (rackTag); }
+
+    /** Restores the states that createFromXml() found for the plugins. Only before the
+        rack is prepared, on any thread.
+    */
+    void restoreStates()
+    {
+        for (auto& s : statesToRestore)
+            s.first->setStateInformation (s.second.getData(), (int) s.second.getSize());
+
+        statesToRestore.clear();
+    }
+
+    /** The rack's plugins, branch by branch. */
+    std::vector<AudioPluginInstance*> getPlugins() const
+    {
+        std::vector<AudioPluginInstance*> plugins;
+
+        for (int b = 0; b < getNumBranches(); ++b)
+            for (int p = 0; p < getNumPlugins (b); ++p)
+                plugins.push_back (getPlugin (b, p));
+
+        return plugins;
+    }
+
+    //==============================================================================
+    void fillInPluginDescription (PluginDescription& d) const override
+    {
+        d.name = d.descriptiveName = getName();
+        d.pluginFormatName = "Rack";
+        d.category = "Rack";
+        d.manufacturerName = "DanteJUCEDemo";
+        d.version = "1.0";
+        d.numInputChannels = getMainBusNumInputChannels();
+        d.numOutputChannels = getMainBusNumOutputChannels();
+        d.isInstrument = false;
+    }
+
+    const String getName() const override                       { return "Plugin Rack"; }
+
+    bool isBusesLayoutSupported (const BusesLayout& layouts) const override
+    {
+        return layouts.getMainInputChannelSet() == layouts.getMainOutputChannelSet();
+    }
+
+    void prepareToPlay (double sampleRate, int blockSize) override
+    {
+        for (auto& b : branches)
+        {
+            b->graph.setPlayConfigDetails (b->numChannels, b->numChannels, sampleRate, blockSize);
+            b->graph.prepareToPlay (sampleRate, blockSize);
+            b->buffer.setSize (b->numChannels, jmax (1, blockSize));
+            b->view.prepare (b->numChannels, blockSize);
+            b->midi.ensureSize (2048);
+            b->profile.prepare (sampleRate);
+        }
+
+        // (which channels the branches' outputs replace, rather than pass through)
+        covered.clear();
+
+        for (auto& b : branches)
+            covered.setRange (b->firstChannel, b->numChannels, true);
+    }
+
+    void releaseResources() override
+    {
+        for (auto& b : branches)
+            b->graph.releaseResources();
+    }
+
+    void reset() override
+    {
+        for (auto& b : branches)
+            b->graph.reset();
+    }
+
+    /** Blocks bigger than the rack was prepared for are processed in pieces. */
+    void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midi) override
+    {
+        if (branches.empty())
+            return;
+
+        const auto numSamples = buffer.getNumSamples();
+        const auto numChannels = buffer.getNumChannels();
+        const auto maxPiece = branches.front()->buffer.getNumSamples();
+
+        // (not prepared yet, so there's nothing to run the branches with)
+        if (maxPiece == 0)
+        {
+            buffer.clear();
+            return;
+        }
+
+        currentBuffer = &buffer;
+        currentMidi = &midi;
+
+        for (currentStart = 0; currentStart < numSamples; currentStart += maxPiece)
+        {
+            currentLength = jmin (maxPiece, numSamples - currentStart);
+
+            pool.perform (*this, getNumBranches());
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                if (covered[ch])
+                    buffer.clear (ch, currentStart, currentLength);
+
+            for (auto& b : branches)
+                for (int i = 0; i < b->numChannels && b->firstChannel + i < numChannels; ++i)
+                    buffer.addFrom (b->firstChannel + i, currentStart, b->buffer, i, 0, currentLength);
+        }
+
+        currentBuffer = nullptr;
+        currentMidi = nullptr;
+    }
+
+    using AudioProcessor::processBlock;
+
+    double getTailLengthSeconds() const override
+    {
+        auto tail = 0.0;
+
+        for (auto& b : branches)
+            for (auto& node : b->chain)
+                tail = jmax (tail, node->getProcessor()->getTailLengthSeconds());
+
+        return tail;
+    }
+
+    bool acceptsMidi() const override                           { return true; }
+    bool producesMidi() const override                          { return false; }
+    bool hasEditor() const override                             { return false; }
+    AudioProcessorEditor* createEditor() override               { return nullptr; }
+
+    int getNumPrograms() override                               { return 1; }
+    int getCurrentProgram() override                            { return 0; }
+    void setCurrentProgram (int) override                       {}
+    const String getProgramName (int) override                  { return {}; }
+    void changeProgramName (int, const String&) override        {}
+
+    void getStateInformation (MemoryBlock& destData) override
+    {
+        if (auto xml = createXml())
+            copyXmlToBinary (*xml, destData);
+    }
+
+    // (the plugins can only be created asynchronously, so a rack is rebuilt with createFromXml() instead)
+    void setStateInformation (const void*, int) override        {}
+
+private:
+    /*  Stands in for a plugin in a branch's graph, with the plugin's buses as they were
+        negotiated, and passes everything through to it, timing each block as it goes.
+    */
+    class TimedPlugin : public AudioProcessor
+    {
+    public:
+        explicit TimedPlugin (std::unique_ptr<AudioPluginInstance> pluginToWrap)
+            : AudioProcessor (getBusesOf (*pluginToWrap)), plugin (std::move (pluginToWrap))
+        {
+        }
+
+        AudioPluginInstance& getPlugin() const noexcept                 { return *plugin; }
+        PluginLoadProfile& getProfile() noexcept                        { return profile; }
+
+        const String getName() const override                           { return plugin->getName(); }
+        bool isBusesLayoutSupported (const BusesLayout& l) const override { return l == plugin->getBusesLayout(); }
+
+        void prepareToPlay (double sampleRate, int blockSize) override
+        {
+            plugin->setRateAndBufferSizeDetails (sampleRate, blockSize);
+            plugin->prepareToPlay (sampleRate, blockSize);
+            setLatencySamples (plugin->getLatencySamples());
+            profile.prepare (sampleRate);
+        }
+
+        void releaseResources() override                                { plugin->releaseResources(); }
+        void reset() override                                           { plugin->reset(); }
+
+        void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midi) override
+        {
+            const PluginLoadProfile::ScopedTimer timer (profile, buffer.getNumSamples());
+            plugin->processBlock (buffer, midi);
+        }
+
+        using AudioProcessor::processBlock;
+
+        void setPlayHead (AudioPlayHead* newPlayHead) override
+        {
+            AudioProcessor::setPlayHead (newPlayHead);
+            plugin->setPlayHead (newPlayHead);
+        }
+
+        void setNonRealtime (bool isNonRealtime) noexcept override
+        {
+            AudioProcessor::setNonRealtime (isNonRealtime);
+            plugin->setNonRealtime (isNonRealtime);
+        }
+
+        double getTailLengthSeconds() const override                    { return plugin->getTailLengthSeconds(); }
+        bool acceptsMidi() const override                               { return plugin->acceptsMidi(); }
+        bool producesMidi() const override                              { return plugin->producesMidi(); }
+        bool isMidiEffect() const override                              { return plugin->isMidiEffect(); }
+        bool hasEditor() const override                                 { return false; }
+        AudioProcessorEditor* createEditor() override                   { return nullptr; }
+
+        int getNumPrograms() override                                   { return plugin->getNumPrograms(); }
+        int getCurrentProgram() override                                { return plugin->getCurrentProgram(); }
+        void setCurrentProgram (int index) override                     { plugin->setCurrentProgram (index); }
+        const String getProgramName (int index) override                { return plugin->getProgramName (index); }
+        void changeProgramName (int index, const String& newName) override { plugin->changeProgramName (index, newName); }
+        void getStateInformation (MemoryBlock& destData) override       { plugin->getStateInformation (destData); }
+        void setStateInformation (const void* data, int size) override  { plugin->setStateInformation (data, size); }
+
+    private:
+        std::unique_ptr<AudioPluginInstance> plugin;
+        PluginLoadProfile profile;
+
+        static BusesProperties getBusesOf (const AudioProcessor& p)
+        {
+            BusesProperties buses;
+
+            for (const auto isInput : { true, false })
+                for (int i = 0; i < p.getBusCount (isInput); ++i)
+                    if (auto* bus = p.getBus (isInput, i))
+                        buses.addBus (isInput, bus->getName(), bus->getLastEnabledLayout(), bus->isEnabled());
+
+            return buses;
+        }
+
+        JUCE_DECLARE_NON_COPYABLE (TimedPlugin)
+    };
+
+    TimedPlugin& getTimedPlugin (int branchIndex, int pluginIndex) const
+    {
+        return *static_cast<TimedPlugin*> (branches[(size_t) branchIndex]->chain[(size_t) pluginIndex]->getProcessor());
+    }
+
+    struct Branch
+    {
+        Branch (int first, int num)
+            : firstChannel (first), numChannels (num)
+        {
+            // (the graph's I/O nodes take their channel counts from the graph when they're added)
+            graph.setPlayConfigDetails (numChannels, numChannels, 44100.0, 512);
+
+            using IOProcessor = AudioProcessorGraph::AudioGraphIOProcessor;
+            input      = graph.addNode (std::make_unique<IOProcessor> (IOProcessor::audioInputNode));
+            output     = graph.addNode (std::make_unique<IOProcessor> (IOProcessor::audioOutputNode));
+            midiInput  = graph.addNode (std::make_unique<IOProcessor> (IOProcessor::midiInputNode));
+
+            connectChain();
+        }
+
+        void connectChain()
+        {
+            for (auto& c : graph.getConnections())
+                graph.removeConnection (c);
+
+            auto previous = input;
+
+            for (auto& node : chain)
+            {
+                connectAudio (*previous, *node);
+
+                if (node->getProcessor()->acceptsMidi())
+                    graph.addConnection ({ { midiInput->nodeID, AudioProcessorGraph::midiChannelIndex },
+                                           { node->nodeID,      AudioProcessorGraph::midiChannelIndex } });
+
+                previous = node;
+            }
+
+            connectAudio (*previous, *output);
+        }
+
+        void connectAudio (const AudioProcessorGraph::Node& source, const AudioProcessorGraph::Node& dest)
+        {
+            const auto numToConnect = jmin (source.getProcessor()->getTotalNumOutputChannels(),
+                                            dest.getProcessor()->getTotalNumInputChannels());
+
+            for (int ch = 0; ch < numToConnect; ++ch)
+                graph.addConnection ({ { source.nodeID, ch }, { dest.nodeID, ch } });
+        }
+
+        const int firstChannel, numChannels;
+        AudioProcessorGraph graph;
+        AudioProcessorGraph::Node::Ptr input, output, midiInput;
+        std::vector<AudioProcessorGraph::Node::Ptr> chain;
+
+        AudioBuffer<float> buffer; // (the branch's output, mixed back in after every branch is done)
+        ChannelView<float> view;
+        MidiBuffer midi;
+        PluginLoadProfile profile;
+    };
+
+    struct Loader
+    {
+        struct Pending
+        {
+            int branchIndex = 0;
+            PluginDescription description;
+            MemoryBlock state;
+        };
+
+        Loader (AudioPluginFormatManager& fm, double sr, int bs, CreationCallback cb)
+            : formatManager (fm), sampleRate (sr), blockSize (bs), callback (std::move (cb)) {}
+
+        static void loadNext (std::shared_ptr<Loader> loader)
+        {
+            if (loader->next == loader->pending.size())
+            {
+                NullCheckedInvocation::invoke (loader->callback, std::move (loader->rack), loader->errors.joinIntoString ("\n"));
+                return;
+            }
+
+            const auto& pending = loader->pending[loader->next];
+
+            loader->formatManager.createPluginInstanceAsync (pending.description, loader->sampleRate, loader->blockSize,
+                                                             [loader] (std::unique_ptr<AudioPluginInstance> instance, const String& error)
+            {
+                auto& p = loader->pending[loader->next++];
+
+                if (instance != nullptr)
+                {
+                    if (! p.state.isEmpty())
+                        loader->rack->statesToRestore.emplace_back (instance.get(), std::move (p.state));
+
+                    loader->rack->addPlugin (p.branchIndex, std::move (instance));
+                }
+                else
+                {
+                    loader->errors.add (p.description.name + ": " + error);
+                }
+
+                loadNext (loader);
+            });
+        }
+
+        AudioPluginFormatManager& formatManager;
+        const double sampleRate;
+        const int blockSize;
+        CreationCallback callback;
+
+        std::unique_ptr<PluginRack> rack;
+        std::vector<Pending> pending;
+        size_t next = 0;
+        StringArray errors;
+    };
+
+    static constexpr const char* rackTag   = "RACK";
+    static constexpr const char* branchTag = "BRANCH";
+    static constexpr const char* slotTag   = "SLOT";
+    static constexpr const char* stateTag  = "STATE";
+
+    RealtimeWorkerPool& pool;
+    std::vector<std::unique_ptr<Branch>> branches;
+    BigInteger covered;
+    std::vector<std::pair<AudioPluginInstance*, MemoryBlock>> statesToRestore;
+
+    // (only valid during processBlock)
+    AudioBuffer<float>* currentBuffer = nullptr;
+    MidiBuffer* currentMidi = nullptr;
+    int currentStart = 0, currentLength = 0;
+
+    /** Runs one branch over the current piece of the block, on the audio thread or a worker. */
+    void perform (int branchIndex) override
+    {
+        auto& b = *branches[(size_t) branchIndex];
+        const auto& in = *currentBuffer;
+        const PluginLoadProfile::ScopedTimer timer (b.profile, currentLength);
+
+        for (int i = 0; i < b.numChannels; ++i)
+        {
+            if (b.firstChannel + i < in.getNumChannels())
+                b.buffer.copyFrom (i, 0, in, b.firstChannel + i, currentStart, currentLength);
+            else
+                b.buffer.clear (i, 0, currentLength);
+        }
+
+        b.midi.clear();
+        b.midi.addEvents (*currentMidi, currentStart, currentLength, -currentStart);
+
+        b.graph.processBlock (b.view.refer (b.buffer.getArrayOfWritePointers(), b.numChannels, currentLength), b.midi);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginRack)
+};
+
+constexpr const char* PluginRack::rackTag;
+constexpr const char* PluginRack::branchTag;
+constexpr const char* PluginRack::slotTag;
+constexpr const char* PluginRack::stateTag;
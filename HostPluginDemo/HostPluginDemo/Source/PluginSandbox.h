@@ -0,0 +1,759 @@
+#pragma once
+
+#include "SandboxTransport.h"
+#include "ChannelRouting.h"
+
+//==============================================================================
+/*  Packs a MidiBuffer into a SandboxTransport slot and back: for each event, its
+    sample position, its size, and then its bytes. Events that don't fit are dropped.
+*/
+struct SandboxMidi
+{
+    static int32 write (const MidiBuffer& midi, uint8* dest, int capacity) noexcept
+    {
+        int32 numBytes = 0;
+
+        for (const auto metadata : midi)
+        {
+            const auto eventSize = 6 + metadata.numBytes;
+
+            if (numBytes + eventSize > capacity)
+                break;
+
+            const auto position = (int32) metadata.samplePosition;
+            const auto size = (uint16) metadata.numBytes;
+
+            std::memcpy (dest + numBytes, &position, 4);
+            std::memcpy (dest + numBytes + 4, &size, 2);
+            std::memcpy (dest + numBytes + 6, metadata.data, (size_t) metadata.numBytes);
+            numBytes += eventSize;
+        }
+
+        return numBytes;
+    }
+
+    static void read (const uint8* src, int32 numBytes, MidiBuffer& midi) noexcept
+    {
+        midi.clear();
+
+        for (int32 pos = 0; pos + 6 <= numBytes;)
+        {
+            int32 position;
+            uint16 size;
+            std::memcpy (&position, src + pos, 4);
+            std::memcpy (&size, src + pos + 4, 2);
+
+            if (pos + 6 + size > numBytes)
+                break;
+
+            midi.addEvent (src + pos + 6, size, position);
+            pos += 6 + size;
+        }
+    }
+};
+
+//==============================================================================
+/*  Tiny processors that a sandbox worker can run without loading anything, so the
+    sandbox can be tried out and tested on any machine. "Gain" halves the level,
+    "Stall" does too but takes four blocks' worth of time over every eighth block,
+    and "Crash" aborts the worker after a couple of seconds.
+*/
+class SandboxTestProcessor : public AudioPluginInstance
+{
+public:
+    static constexpr const char* formatName = "Built-in";
+
+    static PluginDescription createDescription (const String& name)
+    {
+        PluginDescription d;
+        d.name = d.descriptiveName = name;
+        d.pluginFormatName = formatName;
+        d.fileOrIdentifier = "builtin:" + name;
+        d.manufacturerName = "DanteJUCEDemo";
+        d.numInputChannels = d.numOutputChannels = 2;
+        return d;
+    }
+
+    static StringArray getNames()                                           { return { "Gain", "Stall", "Crash" }; }
+
+    static std::unique_ptr<AudioPluginInstance> create (const PluginDescription& d)
+    {
+        if (d.pluginFormatName == formatName && getNames().contains (d.name))
+            return std::make_unique<SandboxTestProcessor> (d.name);
+
+        return {};
+    }
+
+    explicit SandboxTestProcessor (const String& nameToUse)
+        : AudioPluginInstance (BusesProperties().withInput  ("Input",  AudioChannelSet::stereo(), true)
+                                                .withOutput ("Output", AudioChannelSet::stereo(), true)),
+          name (nameToUse)
+    {
+    }
+
+    void fillInPluginDescription (PluginDescription& d) const override     { d = createDescription (name); }
+    const String getName() const override                                   { return name; }
+    bool isBusesLayoutSupported (const BusesLayout& l) const override       { return l.getMainInputChannelSet() == l.getMainOutputChannelSet(); }
+
+    void prepareToPlay (double sampleRate, int) override
+    {
+        rate = sampleRate;
+        blockCount = 0;
+    }
+
+    void releaseResources() override {}
+
+    void processBlock (AudioBuffer<float>& buffer, MidiBuffer&) override
+    {
+        buffer.applyGain (0.5f);
+
+        if (name == "Stall" && ++blockCount % 8 == 0)
+            Thread::sleep (roundToInt (4000.0 * buffer.getNumSamples() / rate));
+
+        if (name == "Crash" && (blockCount += buffer.getNumSamples()) > (int64) (2.0 * rate))
+            std::abort();
+    }
+
+    using AudioProcessor::processBlock;
+
+    double getTailLengthSeconds() const override                            { return 0.0; }
+    bool acceptsMidi() const override                                       { return false; }
+    bool producesMidi() const override                                      { return false; }
+    bool hasEditor() const override                                         { return false; }
+    AudioProcessorEditor* createEditor() override                           { return nullptr; }
+    int getNumPrograms() override                                           { return 1; }
+    int getCurrentProgram() override                                        { return 0; }
+    void setCurrentProgram (int) override                                   {}
+    const String getProgramName (int) override                              { return {}; }
+    void changeProgramName (int, const String&) override                    {}
+    void getStateInformation (MemoryBlock&) override                        {}
+    void setStateInformation (const void*, int) override                    {}
+
+private:
+    const String name;
+    double rate = 44100.0;
+    int64 blockCount = 0;
+};
+
+constexpr const char* SandboxTestProcessor::formatName;
+
+//==============================================================================
+/*  A plugin that runs in a separate worker process, so that if it crashes or hangs,
+    only that process goes down and the host carries on.
+
+    The worker is this application again, started with a special command line (see
+    PluginSandboxWorker). Loading, preparing and state go back and forth as small
+    XML messages over the ChildProcessCoordinator's pipe, but the audio and MIDI
+    never do: each block goes through a SandboxTransport in shared memory, and the
+    audio thread waits for the answer on a futex (or an event on Windows).
+
+    If the answer doesn't arrive in time, the block is let through dry or silenced
+    instead, and the worker is left to catch up. If the worker has died, every block
+    is handled like that, and onWorkerLost is called on the message thread.
+
+    The plugin's own editor can't be shown, as it lives in the other process.
+*/
+class SandboxedPlugin : public AudioPluginInstance,
+                        private ChildProcessCoordinator,
+                        private AsyncUpdater
+{
+public:
+    static constexpr const char* commandLineUID = "dantejuce-plugin-sandbox";
+
+    enum class Fallback { dry, silence };
+
+    /** Starts a worker process and loads the plugin into it. This waits for the worker,
+        so it can take as long as loading the plugin normally would.
+    */
+    static std::unique_ptr<SandboxedPlugin> launch (const File& workerExecutable, const PluginDescription& description,
+                                                    String& error)
+    {
+        std::unique_ptr<SandboxedPlugin> plugin (new SandboxedPlugin());
+
+        if (! plugin->launchWorkerProcess (workerExecutable, commandLineUID, 5000, 0))
+        {
+            error = "Couldn't start the sandbox process";
+            return {};
+        }
+
+        XmlElement load ("LOAD");
+        load.addChildElement (description.createXml().release());
+
+        const auto reply = plugin->request (load, 60000);
+
+        if (reply == nullptr || ! reply->hasTagName ("LOADED"))
+        {
+            error = reply != nullptr ? reply->getStringAttribute ("error") : "The sandbox process didn't respond";
+            return {};
+        }
+
+        if (auto* d = reply->getChildByName ("PLUGIN"))
+            plugin->description.loadFromXml (*d);
+
+        plugin->midiIn = reply->getBoolAttribute ("acceptsMidi");
+        plugin->midiOut = reply->getBoolAttribute ("producesMidi");
+        plugin->tailSeconds = reply->getDoubleAttribute ("tail");
+        plugin->setLatencySamples (reply->getIntAttribute ("latency"));
+
+        return plugin;
+    }
+
+    ~SandboxedPlugin() override
+    {
+        cancelPendingUpdate();
+        killWorkerProcess(); // (before anything the connection thread might still touch goes away)
+    }
+
+    /** What goes out when the worker misses a block's deadline, or has died. */
+    void setFallback (Fallback f) noexcept                      { fallback = f; }
+
+    /** How long the audio thread waits for each block. Zero means three quarters of the
+        block's own duration.
+    */
+    void setTimeoutMilliseconds (double ms) noexcept            { timeoutMs = jmax (0.0, ms); }
+
+    int getNumMissedDeadlines() const noexcept                  { return missedDeadlines.load(); }
+    bool isWorkerRunning() const noexcept                       { return workerRunning.load(); }
+
+    std::function<void()> onWorkerLost;
+
+    //==============================================================================
+    void fillInPluginDescription (PluginDescription& d) const override     { d = description; }
+    const String getName() const override                                   { return description.name; }
+
+    bool isBusesLayoutSupported (const BusesLayout& layouts) const override
+    {
+        return layouts.getMainInputChannelSet().isDisabled()
+            || layouts.getMainInputChannelSet() == layouts.getMainOutputChannelSet();
+    }
+
+    void prepareToPlay (double sampleRate, int blockSize) override
+    {
+        prepared = false;
+        const auto numChannels = jmax (1, getTotalNumInputChannels(), getTotalNumOutputChannels());
+
+        if (! workerRunning || ! transport.create (numChannels, jmax (1, blockSize)))
+            return;
+
+        XmlElement prepare ("PREPARE");
+        prepare.setAttribute ("memory", transport.getName());
+        prepare.setAttribute ("sampleRate", sampleRate);
+        prepare.setAttribute ("blockSize", blockSize);
+
+        const auto reply = request (prepare, 10000);
+
+        if (reply != nullptr && reply->hasTagName ("PREPARED"))
+        {
+            setLatencySamples (reply->getIntAttribute ("latency"));
+            nextSequence = 1;
+            prepared = true;
+        }
+    }
+
+    void releaseResources() override
+    {
+        prepared = false;
+
+        if (workerRunning)
+            request (XmlElement ("RELEASE"), 5000);
+
+        transport.close();
+    }
+
+    void processBlock (AudioBuffer<float>& buffer, MidiBuffer& midi) override
+    {
+        const auto numSamples = buffer.getNumSamples();
+
+        if (! prepared || ! workerRunning || numSamples > transport.getMaxBlockSize())
+        {
+            applyFallback (buffer, midi);
+            return;
+        }
+
+        auto& requestSeq = transport.getRequestSeq();
+        auto& responseSeq = transport.getResponseSeq();
+        const auto sequence = nextSequence;
+
+        // (if the worker is still busy with the block that used this slot last, this one isn't sent at all)
+        if (sequence - responseSeq.load() > (uint32) SandboxTransport::numSlots)
+        {
+            applyFallback (buffer, midi);
+            ++missedDeadlines;
+            return;
+        }
+
+        const auto slot = transport.getSlot (sequence);
+        const auto numChannels = jmin (buffer.getNumChannels(), transport.getNumChannels());
+
+        *slot.numSamples = numSamples;
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            FloatVectorOperations::copy (slot.channels[ch], buffer.getReadPointer (ch), numSamples);
+
+        *slot.numMidiBytesIn = SandboxMidi::write (midi, slot.midiIn, SandboxTransport::midiBytesPerSlot);
+
+        transport.post (requestSeq, sequence);
+        ++nextSequence;
+
+        const auto timeout = timeoutMs.load() > 0 ? timeoutMs.load()
+                                                  : 750.0 * numSamples / getSampleRate();
+
+        for (auto seen = responseSeq.load(); (int32) (seen - sequence) < 0; seen = responseSeq.load())
+        {
+            if (! transport.waitForChange (responseSeq, seen, timeout))
+            {
+                applyFallback (buffer, midi);
+                ++missedDeadlines;
+                return;
+            }
+        }
+
+        for (int ch = 0; ch < numChannels; ++ch)
+            FloatVectorOperations::copy (buffer.getWritePointer (ch), slot.channels[ch], numSamples);
+
+        SandboxMidi::read (slot.midiOut, *slot.numMidiBytesOut, midi);
+    }
+
+    using AudioProcessor::processBlock;
+
+    double getTailLengthSeconds() const override                { return tailSeconds; }
+    bool acceptsMidi() const override                           { return midiIn; }
+    bool producesMidi() const override                          { return midiOut; }
+    bool hasEditor() const override                             { return false; }
+    AudioProcessorEditor* createEditor() override               { return nullptr; }
+
+    int getNumPrograms() override                               { return 1; }
+    int getCurrentProgram() override                            { return 0; }
+    void setCurrentProgram (int) override                       {}
+    const String getProgramName (int) override                  { return {}; }
+    void changeProgramName (int, const String&) override        {}
+
+    void getStateInformation (MemoryBlock& destData) override
+    {
+        if (const auto reply = request (XmlElement ("GET_STATE"), 5000))
+            destData.fromBase64Encoding (reply->getAllSubText());
+    }
+
+    void setStateInformation (const void* data, int size) override
+    {
+        XmlElement message ("SET_STATE");
+        message.addTextElement (MemoryBlock (data, (size_t) size).toBase64Encoding());
+        request (message, 5000);
+    }
+
+private:
+    SandboxedPlugin()
+        : AudioPluginInstance (BusesProperties().withInput  ("Input",  AudioChannelSet::stereo(), true)
+                                                .withOutput ("Output", AudioChannelSet::stereo(), true))
+    {
+    }
+
+    PluginDescription description;
+    bool midiIn = false, midiOut = false;
+    double tailSeconds = 0.0;
+
+    SandboxTransport transport;
+    bool prepared = false;
+    uint32 nextSequence = 1;
+    std::atomic<Fallback> fallback { Fallback::dry };
+    std::atomic<double> timeoutMs { 0.0 };
+    std::atomic<int> missedDeadlines { 0 };
+    std::atomic<bool> workerRunning { true };
+
+    CriticalSection requestLock, replyLock;
+    WaitableEvent replyArrived;
+    std::unique_ptr<XmlElement> reply;
+    int lastRequestId = 0;
+
+    void applyFallback (AudioBuffer<float>& buffer, MidiBuffer& midi) const
+    {
+        if (fallback.load() == Fallback::silence)
+            buffer.clear();
+
+        midi.clear();
+    }
+
+    /** Sends a message to the worker and waits for the answer to it. */
+    std::unique_ptr<XmlElement> request (XmlElement message, int timeout)
+    {
+        const ScopedLock sl (requestLock);
+
+        message.setAttribute ("id", ++lastRequestId);
+        const auto text = message.toString (XmlElement::TextFormat().singleLine().withoutHeader());
+
+        replyArrived.reset();
+
+        if (! sendMessageToWorker ({ text.toRawUTF8(), text.getNumBytesAsUTF8() }))
+            return {};
+
+        for (const auto deadline = Time::getMillisecondCounter() + (uint32) timeout;;)
+        {
+            {
+                const ScopedLock rl (replyLock);
+
+                // (an answer to an earlier request that timed out is just dropped)
+                if (reply != nullptr && reply->getIntAttribute ("id") == lastRequestId)
+                    return std::move (reply);
+            }
+
+            const auto now = Time::getMillisecondCounter();
+
+            if (now >= deadline || ! workerRunning || ! replyArrived.wait ((int) (deadline - now)))
+                return {};
+        }
+    }
+
+    void handleMessageFromWorker (const MemoryBlock& mb) override
+    {
+        if (auto xml = parseXML (mb.toString()))
+        {
+            const ScopedLock rl (replyLock);
+            reply = std::move (xml);
+        }
+
+        replyArrived.signal();
+    }
+
+    void handleConnectionLost() override
+    {
+        workerRunning = false;
+        replyArrived.signal();
+        triggerAsyncUpdate();
+    }
+
+    void handleAsyncUpdate() override
+    {
+        NullCheckedInvocation::invoke (onWorkerLost);
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SandboxedPlugin)
+};
+
+constexpr const char* SandboxedPlugin::commandLineUID;
+
+//==============================================================================
+/*  The worker side of a SandboxedPlugin. When the application is started by a
+    sandbox, runIfRequested() creates one of these instead of the usual window, and
+    it quits again when the host goes away.
+
+    Messages are handled on the message thread. The audio goes through the shared
+    memory on a realtime thread of its own, which processes each block in place,
+    routed onto the plugin's channels in the same way as in the host.
+*/
+class PluginSandboxWorker : public ChildProcessWorker,
+                            public DeletedAtShutdown,
+                            private Thread
+{
+public:
+    /** Returns true if this process was started as a sandbox worker. */
+    static bool runIfRequested (const String& commandLine)
+    {
+        auto worker = std::make_unique<PluginSandboxWorker>();
+
+        if (! worker->initialiseFromCommandLine (commandLine, SandboxedPlugin::commandLineUID, 5000))
+            return false;
+
+        worker.release(); // (deleted at shutdown)
+        return true;
+    }
+
+    PluginSandboxWorker()
+        : Thread ("Sandbox audio")
+    {
+        formatManager.addDefaultFormats();
+    }
+
+    ~PluginSandboxWorker() override
+    {
+        stopThread (2000);
+    }
+
+    void handleMessageFromCoordinator (const MemoryBlock& mb) override
+    {
+        std::shared_ptr<XmlElement> message (parseXML (mb.toString()));
+
+        if (message != nullptr)
+            MessageManager::callAsync ([this, message] { handleMessage (*message); });
+    }
+
+    void handleConnectionLost() override
+    {
+        JUCEApplicationBase::quit();
+    }
+
+private:
+    AudioPluginFormatManager formatManager;
+    std::unique_ptr<AudioPluginInstance> plugin;
+    SandboxTransport transport;
+    ChannelRouting routing;
+    ChannelView<float> slotView;
+    MidiBuffer midi;
+
+    void handleMessage (const XmlElement& message)
+    {
+        XmlElement answer ("OK");
+        answer.setAttribute ("id", message.getIntAttribute ("id"));
+
+        if (message.hasTagName ("LOAD"))
+        {
+            PluginDescription description;
+
+            if (auto* d = message.getChildByName ("PLUGIN"))
+                description.loadFromXml (*d);
+
+            if (auto builtIn = SandboxTestProcessor::create (description))
+            {
+                finishLoading (answer, std::move (builtIn), {});
+                return;
+            }
+
+            formatManager.createPluginInstanceAsync (description, 44100.0, 512,
+                                                     [this, answer] (std::unique_ptr<AudioPluginInstance> instance, const String& error) mutable
+            {
+                finishLoading (answer, std::move (instance), error);
+            });
+
+            return;
+        }
+
+        if (plugin == nullptr)
+        {
+            answer.setTagName ("ERROR");
+        }
+        else if (message.hasTagName ("PREPARE"))
+        {
+            stopThread (2000);
+
+            if (transport.open (message.getStringAttribute ("memory")))
+            {
+                const auto sampleRate = message.getDoubleAttribute ("sampleRate");
+                const auto blockSize = transport.getMaxBlockSize();
+
+                // (a plugin that won't take the host's layout keeps its own, and only gets the channels it has)
+                plugin->enableAllBuses();
+                ChannelRouting::negotiateLayout (*plugin, transport.getNumChannels());
+
+                plugin->setRateAndBufferSizeDetails (sampleRate, blockSize);
+                plugin->prepareToPlay (sampleRate, blockSize);
+
+                routing.prepare (*plugin, transport.getNumChannels(), blockSize);
+                slotView.prepare (transport.getNumChannels(), blockSize);
+                midi.ensureSize ((size_t) SandboxTransport::midiBytesPerSlot);
+
+                startThread (Thread::realtimeAudioPriority);
+
+                answer.setTagName ("PREPARED");
+                answer.setAttribute ("latency", plugin->getLatencySamples());
+            }
+            else
+            {
+                answer.setTagName ("ERROR");
+            }
+        }
+        else if (message.hasTagName ("RELEASE"))
+        {
+            stopThread (2000);
+            plugin->releaseResources();
+            transport.close();
+        }
+        else if (message.hasTagName ("GET_STATE"))
+        {
+            MemoryBlock state;
+            plugin->getStateInformation (state);
+            answer.setTagName ("STATE");
+            answer.addTextElement (state.toBase64Encoding());
+        }
+        else if (message.hasTagName ("SET_STATE"))
+        {
+            MemoryBlock state;
+            state.fromBase64Encoding (message.getAllSubText());
+            plugin->setStateInformation (state.getData(), (int) state.getSize());
+        }
+
+        send (answer);
+    }
+
+    void finishLoading (XmlElement& answer, std::unique_ptr<AudioPluginInstance> instance, const String& error)
+    {
+        plugin = std::move (instance);
+
+        if (plugin == nullptr)
+        {
+            answer.setTagName ("ERROR");
+            answer.setAttribute ("error", error.isNotEmpty() ? error : "Couldn't create the plugin");
+        }
+        else
+        {
+            answer.setTagName ("LOADED");
+            answer.addChildElement (plugin->getPluginDescription().createXml().release());
+            answer.setAttribute ("acceptsMidi", plugin->acceptsMidi());
+            answer.setAttribute ("producesMidi", plugin->producesMidi());
+            answer.setAttribute ("tail", plugin->getTailLengthSeconds());
+            answer.setAttribute ("latency", plugin->getLatencySamples());
+        }
+
+        send (answer);
+    }
+
+    void send (const XmlElement& answer)
+    {
+        const auto text = answer.toString (XmlElement::TextFormat().singleLine().withoutHeader());
+        sendMessageToCoordinator ({ text.toRawUTF8(), text.getNumBytesAsUTF8() });
+    }
+
+    /** Processes every block the host has asked for, in order, in place in the shared memory. */
+    void run() override
+    {
+        auto& requestSeq = transport.getRequestSeq();
+        auto& responseSeq = transport.getResponseSeq();
+        auto done = responseSeq.load();
+
+        while (! threadShouldExit())
+        {
+            if (! transport.waitForChange (requestSeq, done, 100.0))
+                continue;
+
+            for (const auto requested = requestSeq.load(); done != requested && ! threadShouldExit();)
+            {
+                const auto slot = transport.getSlot (done + 1);
+                const auto numSamples = jlimit (0, transport.getMaxBlockSize(), (int) *slot.numSamples);
+
+                SandboxMidi::read (slot.midiIn, *slot.numMidiBytesIn, midi);
+
+                routing.process (*plugin, slotView.refer (slot.channels, transport.getNumChannels(), numSamples), midi);
+
+                *slot.numMidiBytesOut = SandboxMidi::write (midi, slot.midiOut, SandboxTransport::midiBytesPerSlot);
+                transport.post (responseSeq, ++done);
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginSandboxWorker)
+};
+
+//==============================================================================
+/*  Runs each of the built-in test processors in a real worker process. A round
+    trip through "Gain" must come back processed, and blocks that "Stall" or "Crash"
+    can't answer in time must come back dry or silent, without holding up the
+    caller for much longer than the timeout.
+
+    The worker is this executable, so this only works in the standalone app, which
+    runs it when it's started with --run-unit-tests.
+*/
+class PluginSandboxTests : public UnitTest
+{
+public:
+    PluginSandboxTests() : UnitTest ("Plugin sandbox", "HostPluginDemo") {}
+
+    void runTest() override
+    {
+        beginTest ("Gain");
+
+        if (auto plugin = launch ("Gain"))
+        {
+            plugin->setTimeoutMilliseconds (2000.0); // (so a slow machine can't turn this into a fallback)
+
+            for (int i = 0; i < 32; ++i)
+                expectWithinAbsoluteError (processBlock (*plugin).level, 0.5f * inputLevel, 1.0e-6f);
+
+            expectEquals (plugin->getNumMissedDeadlines(), 0);
+        }
+
+        beginTest ("Stall");
+
+        if (auto plugin = launch ("Stall"))
+        {
+            plugin->setFallback (SandboxedPlugin::Fallback::dry);
+
+            for (int i = 0; i < 64; ++i)
+                expectProcessedOr (processBlock (*plugin), inputLevel);
+
+            expectGreaterThan (plugin->getNumMissedDeadlines(), 0);
+            expect (plugin->isWorkerRunning());
+        }
+
+        beginTest ("Crash");
+
+        if (auto plugin = launch ("Crash"))
+        {
+            plugin->setFallback (SandboxedPlugin::Fallback::silence);
+
+            // (the worker aborts once it's been given two seconds of audio)
+            for (const auto giveUp = Time::getMillisecondCounter() + 20000;
+                 plugin->isWorkerRunning() && Time::getMillisecondCounter() < giveUp;)
+            {
+                expectProcessedOr (processBlock (*plugin), 0.0f);
+                Thread::sleep (1); // (rather than spinning while the crash is noticed)
+            }
+
+            expect (! plugin->isWorkerRunning(), "The worker didn't crash");
+
+            const auto afterCrash = processBlock (*plugin);
+            expectEquals (afterCrash.level, 0.0f);
+            expectLessThan (afterCrash.milliseconds, maxDelayMs);
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 48000.0;
+    static constexpr int blockSize = 256;
+    static constexpr float inputLevel = 0.5f;
+    static constexpr double timeoutMs = 750.0 * blockSize / sampleRate; // (SandboxedPlugin's default)
+    static constexpr double maxDelayMs = timeoutMs + 50.0;               // (allowing for the scheduler)
+
+    struct Result
+    {
+        float level;
+        double milliseconds;
+    };
+
+    std::unique_ptr<SandboxedPlugin> launch (const String& name)
+    {
+        String error;
+        auto plugin = SandboxedPlugin::launch (File::getSpecialLocation (File::currentExecutableFile),
+                                               SandboxTestProcessor::createDescription (name), error);
+
+        expect (plugin != nullptr, error);
+
+        if (plugin != nullptr)
+        {
+            plugin->setRateAndBufferSizeDetails (sampleRate, blockSize);
+            plugin->prepareToPlay (sampleRate, blockSize);
+        }
+
+        return plugin;
+    }
+
+    Result processBlock (SandboxedPlugin& plugin)
+    {
+        AudioBuffer<float> buffer (2, blockSize);
+        MidiBuffer midi;
+
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+            FloatVectorOperations::fill (buffer.getWritePointer (ch), inputLevel, blockSize);
+
+        const auto start = Time::getMillisecondCounterHiRes();
+        plugin.processBlock (buffer, midi);
+        const auto elapsed = Time::getMillisecondCounterHiRes() - start;
+
+        // (every sample of every channel should have had the same thing done to it)
+        const auto range = buffer.findMinMax (0, 0, blockSize).getUnionWith (buffer.findMinMax (1, 0, blockSize));
+        expectEquals (range.getLength(), 0.0f);
+
+        return { range.getStart(), elapsed };
+    }
+
+    /** A block that was either processed, or replaced by the fallback in time. */
+    void expectProcessedOr (const Result& result, float fallbackLevel)
+    {
+        expect (result.level == 0.5f * inputLevel || result.level == fallbackLevel,
+                "Unexpected level " + String (result.level));
+        expectLessThan (result.milliseconds, maxDelayMs);
+    }
+};
+
+constexpr double PluginSandboxTests::sampleRate;
+constexpr int PluginSandboxTests::blockSize;
+constexpr float PluginSandboxTests::inputLevel;
+constexpr double PluginSandboxTests::timeoutMs;
+constexpr double PluginSandboxTests::maxDelayMs;
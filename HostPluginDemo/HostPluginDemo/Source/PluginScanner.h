@@ -0,0 +1,558 @@
+#pragma once
+
+//==============================================================================
+/*  Remembers what scanning each plugin file found, keyed by the file's path, size
+    and modification time, so that a file that hasn't changed never has to be
+    loaded again to find out. Files that crashed or hung the scan are remembered
+    too, and stay skipped until they change.
+
+    A bundle (a directory, like most VST3s on macOS and every LV2) counts as
+    changed when the total size or the newest modification time of the files in
+    it does. Identifiers that aren't files, such as AudioUnit IDs, aren't cached.
+
+    Safe to use from any number of scanning threads at once.
+*/
+class PluginScanCache
+{
+public:
+    explicit PluginScanCache (const File& fileToUse)
+        : file (fileToUse)
+    {
+        if (auto xml = parseXMLIfTagMatches (file, cacheTag))
+        {
+            for (auto* e : xml->getChildWithTagNameIterator (fileTag))
+            {
+                Entry entry;
+                entry.signature = { e->getStringAttribute ("size").getLargeIntValue(),
+                                    e->getStringAttribute ("modified").getLargeIntValue() };
+                entry.failed = e->getBoolAttribute ("failed");
+
+                for (auto* p : e->getChildWithTagNameIterator ("PLUGIN"))
+                {
+                    PluginDescription d;
+
+                    if (d.loadFromXml (*p))
+                        entry.types.add (d);
+                }
+
+                entries[getKey (e->getStringAttribute ("format"), e->getStringAttribute ("id"))] = std::move (entry);
+            }
+        }
+    }
+
+    /** If the file hasn't changed since it was last scanned, fills in what that scan
+        found, sets failed if it crashed, and returns true.
+    */
+    bool lookUp (const String& formatName, const String& fileOrIdentifier,
+                 OwnedArray<PluginDescription>& types, bool& failed) const
+    {
+        Signature signature;
+
+        if (! getSignature (fileOrIdentifier, signature))
+            return false;
+
+        const ScopedLock sl (lock);
+        const auto it = entries.find (getKey (formatName, fileOrIdentifier));
+
+        if (it == entries.end() || ! (it->second.signature == signature))
+            return false;
+
+        for (const auto& d : it->second.types)
+            types.add (new PluginDescription (d));
+
+        failed = it->second.failed;
+        return true;
+    }
+
+    /** Returns true if the file has been scanned since it last changed. */
+    bool isUpToDate (const String& formatName, const String& fileOrIdentifier) const
+    {
+        OwnedArray<PluginDescription> types;
+        bool failed = false;
+        return lookUp (formatName, fileOrIdentifier, types, failed);
+    }
+
+    void store (const String& formatName, const String& fileOrIdentifier,
+                const OwnedArray<PluginDescription>& types, bool failed)
+    {
+        Entry entry;
+
+        if (! getSignature (fileOrIdentifier, entry.signature))
+            return;
+
+        entry.failed = failed;
+
+        for (auto* d : types)
+            entry.types.add (*d);
+
+        const ScopedLock sl (lock);
+        entries[getKey (formatName, fileOrIdentifier)] = std::move (entry);
+        dirty = true;
+    }
+
+    /** Writes the cache back to its file, if anything was added since it was last written. */
+    void saveIfNeeded()
+    {
+        XmlElement xml (cacheTag);
+
+        {
+            const ScopedLock sl (lock);
+
+            if (! dirty)
+                return;
+
+            for (const auto& pair : entries)
+            {
+                auto* e = xml.createNewChildElement (fileTag);
+                e->setAttribute ("format", pair.first.upToFirstOccurrenceOf ("|", false, false));
+                e->setAttribute ("id", pair.first.fromFirstOccurrenceOf ("|", false, false));
+                e->setAttribute ("size", String (pair.second.signature.size));
+                e->setAttribute ("modified", String (pair.second.signature.modified));
+                e->setAttribute ("failed", pair.second.failed);
+
+                for (const auto& d : pair.second.types)
+                    e->addChildElement (d.createXml().release());
+            }
+
+            dirty = false;
+        }
+
+        file.getParentDirectory().createDirectory();
+        xml.writeTo (file);
+    }
+
+private:
+    struct Signature
+    {
+        int64 size = 0, modified = 0;
+
+        bool operator== (const Signature& other) const noexcept     { return size == other.size && modified == other.modified; }
+    };
+
+    struct Entry
+    {
+        Signature signature;
+        Array<PluginDescription> types;
+        bool failed = false;
+    };
+
+    static constexpr const char* cacheTag = "PLUGIN_SCAN_CACHE";
+    static constexpr const char* fileTag = "FILE";
+
+    const File file;
+    CriticalSection lock;
+    std::map<String, Entry> entries;
+    bool dirty = false;
+
+    static String getKey (const String& formatName, const String& fileOrIdentifier)
+    {
+        return formatName + "|" + fileOrIdentifier;
+    }
+
+    static bool getSignature (const String& fileOrIdentifier, Signature& signature)
+    {
+        if (! File::isAbsolutePath (fileOrIdentifier))
+            return false;
+
+        const File f (fileOrIdentifier);
+
+        if (f.existsAsFile())
+        {
+            signature = { f.getSize(), f.getLastModificationTime().toMilliseconds() };
+            return true;
+        }
+
+        if (! f.isDirectory())
+            return false;
+
+        signature = { 0, f.getLastModificationTime().toMilliseconds() };
+
+        for (const auto& entry : RangedDirectoryIterator (f, true, "*", File::findFiles))
+        {
+            signature.size += entry.getFileSize();
+            signature.modified = jmax (signature.modified, entry.getModificationTime().toMilliseconds());
+        }
+
+        return true;
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginScanCache)
+};
+
+constexpr const char* PluginScanCache::cacheTag;
+constexpr const char* PluginScanCache::fileTag;
+
+//==============================================================================
+/*  The host's end of one scanning process. It scans one file at a time, and is
+    thrown away if a scan crashes it, hangs, or is cancelled, so a late answer can
+    never be mistaken for the next one.
+*/
+class PluginScanProcess : private ChildProcessCoordinator
+{
+public:
+    static constexpr const char* commandLineUID = "dantejuce-plugin-scanner";
+
+    enum class Result { scanned, crashed, cancelled };
+
+    bool launch (const File& workerExecutable)
+    {
+        return launchWorkerProcess (workerExecutable, commandLineUID, 10000, 0);
+    }
+
+    ~PluginScanProcess() override
+    {
+        killWorkerProcess();
+    }
+
+    bool isRunning() const noexcept      { return running.load(); }
+
+    /** Asks the process to scan the file, and waits for the answer. */
+    template <typename ShouldExit>
+    Result scan (const String& formatName, const String& fileOrIdentifier,
+                 OwnedArray<PluginDescription>& types, int timeoutMs, ShouldExit&& shouldExit)
+    {
+        XmlElement message ("SCAN");
+        message.setAttribute ("format", formatName);
+        message.setAttribute ("id", fileOrIdentifier);
+
+        const auto text = message.toString (XmlElement::TextFormat().singleLine().withoutHeader());
+
+        if (! sendMessageToWorker ({ text.toRawUTF8(), text.getNumBytesAsUTF8() }))
+            return Result::crashed;
+
+        for (int waited = 0; ! replyArrived.wait (100); waited += 100)
+        {
+            if (shouldExit())
+                return Result::cancelled;
+
+            if (! running || waited >= timeoutMs)
+                return Result::crashed;
+        }
+
+        const ScopedLock sl (replyLock);
+
+        if (reply == nullptr)
+            return Result::crashed;
+
+        for (auto* p : reply->getChildWithTagNameIterator ("PLUGIN"))
+        {
+            auto d = std::make_unique<PluginDescription>();
+
+            if (d->loadFromXml (*p))
+                types.add (d.release());
+        }
+
+        reply.reset();
+        return Result::scanned;
+    }
+
+private:
+    std::atomic<bool> running { true };
+    WaitableEvent replyArrived;
+    CriticalSection replyLock;
+    std::unique_ptr<XmlElement> reply;
+
+    void handleMessageFromWorker (const MemoryBlock& mb) override
+    {
+        {
+            const ScopedLock sl (replyLock);
+            reply = parseXML (mb.toString());
+        }
+
+        replyArrived.signal();
+    }
+
+    void handleConnectionLost() override
+    {
+        running = false;
+        replyArrived.signal();
+    }
+};
+
+constexpr const char* PluginScanProcess::commandLineUID;
+
+//==============================================================================
+/*  Scans plugin files for a KnownPluginList in child processes, so a plugin that
+    crashes or hangs while it's being loaded only takes its scanning process down,
+    and checks the PluginScanCache first so that unchanged files aren't loaded at
+    all.
+
+    Every thread that's scanning at once gets a process of its own, so giving the
+    PluginListComponent N threads fans a scan out across N processes. Processes
+    are reused from one file to the next, and shut down when the scan finishes.
+
+    Without a worker executable (i.e. in a plugin build, where there's no app to
+    launch), files are scanned in this process instead, still through the cache.
+*/
+class OutOfProcessPluginScanner : public KnownPluginList::CustomScanner
+{
+public:
+    OutOfProcessPluginScanner (PluginScanCache& cacheToUse, const File& workerExecutableToUse)
+        : cache (cacheToUse), workerExecutable (workerExecutableToUse)
+    {
+    }
+
+    bool findPluginTypesFor (AudioPluginFormat& format, OwnedArray<PluginDescription>& result,
+                             const String& fileOrIdentifier) override
+    {
+        bool failed = false;
+
+        if (cache.lookUp (format.getName(), fileOrIdentifier, result, failed))
+            return ! failed;
+
+        if (workerExecutable == File())
+        {
+            format.findAllTypesForFile (result, fileOrIdentifier);
+            cache.store (format.getName(), fileOrIdentifier, result, false);
+            return true;
+        }
+
+        auto process = acquireProcess();
+
+        if (process == nullptr)
+            return true; // (not the plugin's fault, so it isn't blacklisted or cached)
+
+        const auto outcome = process->scan (format.getName(), fileOrIdentifier, result, timeoutMs,
+                                            [this] { return shouldExit(); });
+
+        if (outcome == PluginScanProcess::Result::cancelled)
+            return true;
+
+        const auto crashed = outcome == PluginScanProcess::Result::crashed;
+        cache.store (format.getName(), fileOrIdentifier, result, crashed);
+
+        if (! crashed)
+            releaseProcess (std::move (process));
+
+        return ! crashed;
+    }
+
+    void scanFinished() override
+    {
+        {
+            const ScopedLock sl (lock);
+            idle.clear();
+        }
+
+        cache.saveIfNeeded();
+    }
+
+private:
+    static constexpr int timeoutMs = 60000;
+
+    PluginScanCache& cache;
+    const File workerExecutable;
+
+    CriticalSection lock;
+    std::vector<std::unique_ptr<PluginScanProcess>> idle;
+
+    std::unique_ptr<PluginScanProcess> acquireProcess()
+    {
+        {
+            const ScopedLock sl (lock);
+
+            if (! idle.empty())
+            {
+                auto process = std::move (idle.back());
+                idle.pop_back();
+                return process;
+            }
+        }
+
+        auto process = std::make_unique<PluginScanProcess>();
+        return process->launch (workerExecutable) ? std::move (process) : nullptr;
+    }
+
+    void releaseProcess (std::unique_ptr<PluginScanProcess> process)
+    {
+        if (! process->isRunning())
+            return;
+
+        const ScopedLock sl (lock);
+        idle.push_back (std::move (process));
+    }
+};
+
+//==============================================================================
+/*  The scanning process's side: started with the scanner's command line, it loads
+    each file it's asked about on the message thread and sends back what it found.
+    It quits when the host goes away.
+*/
+class PluginScanWorker : public ChildProcessWorker,
+                         public DeletedAtShutdown
+{
+public:
+    /** Returns true if this process was started to scan plugins. */
+    static bool runIfRequested (const String& commandLine)
+    {
+        auto worker = std::make_unique<PluginScanWorker>();
+
+        if (! worker->initialiseFromCommandLine (commandLine, PluginScanProcess::commandLineUID, 10000))
+            return false;
+
+        worker.release(); // (deleted at shutdown)
+        return true;
+    }
+
+    PluginScanWorker()
+    {
+        formatManager.addDefaultFormats();
+    }
+
+    void handleMessageFromCoordinator (const MemoryBlock& mb) override
+    {
+        std::shared_ptr<XmlElement> message (parseXML (mb.toString()));
+
+        if (message != nullptr && message->hasTagName ("SCAN"))
+            MessageManager::callAsync ([this, message] { scan (*message); });
+    }
+
+    void handleConnectionLost() override
+    {
+        JUCEApplicationBase::quit();
+    }
+
+private:
+    AudioPluginFormatManager formatManager;
+
+    void scan (const XmlElement& message)
+    {
+        XmlElement answer ("FOUND");
+        const auto formatName = message.getStringAttribute ("format");
+
+        for (auto* format : formatManager.getFormats())
+        {
+            if (format->getName() == formatName)
+            {
+                OwnedArray<PluginDescription> found;
+                format->findAllTypesForFile (found, message.getStringAttribute ("id"));
+
+                for (auto* d : found)
+                    answer.addChildElement (d->createXml().release());
+            }
+        }
+
+        const auto text = answer.toString (XmlElement::TextFormat().singleLine().withoutHeader());
+        sendMessageToCoordinator ({ text.toRawUTF8(), text.getNumBytesAsUTF8() });
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginScanWorker)
+};
+
+//==============================================================================
+/*  Brings a KnownPluginList up to date with the plugin folders in the background,
+    e.g. at startup, so that nobody has to press "Scan" after installing or
+    updating a plugin.
+
+    It first lists the files in each format's folders and checks them against the
+    cache and the list. If nothing has changed, that's all it does. Otherwise it
+    scans just the new and changed files, on several threads at once, through the
+    list's custom scanner, and each file's plugins turn up in the list as soon as
+    that file is done. Plugins whose files have gone are removed.
+*/
+class PluginListRefresher : private Thread
+{
+public:
+    /** The search paths and the blacklist are read here, so neither the properties nor the
+        list's blacklist, which KnownPluginList doesn't lock, are read on the thread.
+    */
+    PluginListRefresher (AudioPluginFormatManager& formatManagerToUse, KnownPluginList& listToUpdate,
+                         PluginScanCache& cacheToUse, PropertiesFile& properties, int numThreadsToUse)
+        : Thread ("Plugin list refresher"),
+          formatManager (formatManagerToUse), list (listToUpdate), cache (cacheToUse),
+          blacklist (listToUpdate.getBlacklistedFiles()),
+          pool (jmax (1, numThreadsToUse))
+    {
+        for (auto* format : formatManager.getFormats())
+            searchPaths.push_back (PluginListComponent::getLastSearchPath (properties, *format));
+
+        startThread (2); // (low, as nothing waits for it)
+    }
+
+    ~PluginListRefresher() override
+    {
+        pool.removeAllJobs (true, 10000);
+        stopThread (10000);
+    }
+
+    /** How many files the last refresh had to scan. Zero means nothing had changed. */
+    int getNumFilesScanned() const noexcept     { return numScanned.load(); }
+    bool isFinished() const noexcept            { return finished.load(); }
+
+private:
+    struct FileToScan
+    {
+        AudioPluginFormat* format;
+        String fileOrIdentifier;
+    };
+
+    AudioPluginFormatManager& formatManager;
+    KnownPluginList& list;
+    PluginScanCache& cache;
+    std::vector<FileSearchPath> searchPaths;
+    const StringArray blacklist;
+
+    ThreadPool pool;
+    std::vector<FileToScan> toScan;
+    std::atomic<int> next { 0 }, numScanned { 0 };
+    std::atomic<bool> finished { false };
+
+    void run() override
+    {
+        for (int i = 0; i < formatManager.getNumFormats() && ! threadShouldExit(); ++i)
+        {
+            auto* format = formatManager.getFormat (i);
+
+            if (! format->canScanForPlugins() || (size_t) i >= searchPaths.size())
+                continue;
+
+            for (const auto& id : format->searchPathsForPlugins (searchPaths[(size_t) i], true, false))
+                if (! blacklist.contains (id) && ! (list.isListingUpToDate (id, *format) && cache.isUpToDate (format->getName(), id)))
+                    toScan.push_back ({ format, id });
+
+            for (const auto& d : list.getTypesForFormat (*format))
+                if (! format->doesPluginStillExist (d))
+                    list.removeType (d);
+        }
+
+        if (toScan.empty() || threadShouldExit())
+        {
+            finished = true;
+            return;
+        }
+
+        for (int i = 0; i < pool.getNumThreads(); ++i)
+            pool.addJob ([this] { scanFiles(); });
+
+        while (pool.getNumJobs() > 0 && ! threadShouldExit())
+            wait (100);
+
+        list.scanFinished();
+        finished = true;
+    }
+
+    /** Run by each of the pool's threads, until there's nothing left to scan. */
+    void scanFiles()
+    {
+        for (auto i = next++; i < (int) toScan.size(); i = next++)
+        {
+            if (auto* job = ThreadPoolJob::getCurrentThreadPoolJob())
+                if (job->shouldExit())
+                    return;
+
+            auto& format = *toScan[(size_t) i].format;
+            const auto& id = toScan[(size_t) i].fileOrIdentifier;
+
+            // (whatever the file held before goes, in case a plugin was taken out of it or renamed)
+            for (const auto& d : list.getTypesForFormat (format))
+                if (d.fileOrIdentifier == id)
+                    list.removeType (d);
+
+            OwnedArray<PluginDescription> found;
+            list.scanAndAddFile (id, false, found, format);
+            ++numScanned;
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PluginListRefresher)
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+//==============================================================================
+/*  The binary container that the host's state is saved in.
+
+    It's a header, with a magic number and a version, followed by chunks. Each
+    chunk has a four-character ID, some flags and its size, so a reader can find
+    the ones it wants and step over any it doesn't know. The hosted plugins'
+    states go in as they are, rather than base64-encoded inside an XML document,
+    and can optionally be deflated.
+
+    PluginStateWriter writes straight into the MemoryBlock it's given, growing it
+    once per chunk, and PluginStateReader only points into the data it's given,
+    so the states are only ever copied where they have to be.
+*/
+struct PluginStateFormat
+{
+    static constexpr uint32 makeChunkId (const char (&id)[5])
+    {
+        return (uint32) (uint8) id[0] | ((uint32) (uint8) id[1] << 8) | ((uint32) (uint8) id[2] << 16) | ((uint32) (uint8) id[3] << 24);
+    }
+
+    static constexpr uint32 magic = 0x54534a44; // "DJST", as makeChunkId() would make it
+    static constexpr uint32 version = 1;
+    static constexpr int headerSize = 8;
+    static constexpr int chunkHeaderSize = 16; // (ID, flags, 64-bit size)
+
+    enum ChunkFlags : uint32 { deflated = 1 };
+
+    /** Returns true if the data starts like this format does, rather than like the XML
+        that older versions saved.
+    */
+    static bool isBinaryState (const void* data, size_t size) noexcept
+    {
+        return size >= (size_t) headerSize && ByteOrder::littleEndianInt (data) == magic;
+    }
+};
+
+//==============================================================================
+class PluginStateWriter
+{
+public:
+    /** Replaces what's in the block with a header, ready for the chunks. A compression
+        level above 0 deflates the chunks written with writeChunk(), at the cost of
+        the time that takes.
+    */
+    PluginStateWriter (MemoryBlock& destination, int compressionLevelToUse = 0)
+        : out (destination, false), compressionLevel (compressionLevelToUse)
+    {
+        out.writeInt ((int) PluginStateFormat::magic);
+        out.writeInt ((int) PluginStateFormat::version);
+    }
+
+    void writeChunk (uint32 id, const void* data, size_t size)
+    {
+        const auto headerPosition = out.getPosition();
+
+        // (the block only grows once per chunk, rather than a megabyte at a time)
+        out.preallocate (out.getDataSize() + (size_t) PluginStateFormat::chunkHeaderSize + 8 + size);
+
+        out.writeInt ((int) id);
+        out.writeInt (compressionLevel > 0 ? (int) PluginStateFormat::deflated : 0);
+        out.writeInt64 (0);
+
+        if (compressionLevel > 0)
+        {
+            out.writeInt64 ((int64) size); // (so the reader can allocate it all at once)
+
+            GZIPCompressorOutputStream deflater (out, compressionLevel);
+            deflater.write (data, size);
+        }
+        else
+        {
+            out.write (data, size);
+        }
+
+        // (the size is only known once it's written)
+        const auto end = out.getPosition();
+        out.setPosition (headerPosition + 8);
+        out.writeInt64 (end - headerPosition - PluginStateFormat::chunkHeaderSize);
+        out.setPosition (end);
+    }
+
+    void writeChunk (uint32 id, const MemoryBlock& data)      { writeChunk (id, data.getData(), data.getSize()); }
+    void writeChunk (uint32 id, const String& text)           { writeChunk (id, text.toRawUTF8(), text.getNumBytesAsUTF8()); }
+
+private:
+    MemoryOutputStream out;
+    const int compressionLevel;
+
+    JUCE_DECLARE_NON_COPYABLE (PluginStateWriter)
+};
+
+//==============================================================================
+class PluginStateReader
+{
+public:
+    struct Chunk
+    {
+        uint32 id = 0, flags = 0;
+        const uint8* data = nullptr;
+        size_t size = 0;
+
+        /** Returns the chunk's contents, inflated if they need to be. */
+        MemoryBlock getData() const
+        {
+            if ((flags & PluginStateFormat::deflated) == 0)
+                return { data, size };
+
+            if (size < 8)
+                return {};
+
+            MemoryBlock result;
+            result.ensureSize ((size_t) jmax ((int64) 0, (int64) ByteOrder::littleEndianInt64 (data)));
+
+            MemoryInputStream compressed (data + 8, size - 8, false);
+            GZIPDecompressorInputStream inflater (compressed);
+            MemoryOutputStream (result, false).writeFromInputStream (inflater, -1);
+            return result;
+        }
+
+        String getText() const
+        {
+            if ((flags & PluginStateFormat::deflated) == 0)
+                return String::fromUTF8 (reinterpret_cast<const char*> (data), (int) size);
+
+            return getData().toString();
+        }
+    };
+
+    /** The data has to outlive the reader, which only points into it. */
+    PluginStateReader (const void* data, size_t size)
+    {
+        if (! PluginStateFormat::isBinaryState (data, size)
+             || ByteOrder::littleEndianInt (static_cast<const uint8*> (data) + 4) > PluginStateFormat::version)
+            return;
+
+        const auto* bytes = static_cast<const uint8*> (data);
+        valid = true;
+
+        // (a chunk that's cut short ends the list, rather than the whole state being lost)
+        for (auto pos = (size_t) PluginStateFormat::headerSize; pos + PluginStateFormat::chunkHeaderSize <= size;)
+        {
+            Chunk chunk;
+            chunk.id = ByteOrder::littleEndianInt (bytes + pos);
+            chunk.flags = ByteOrder::littleEndianInt (bytes + pos + 4);
+
+            const auto chunkSize = (uint64) ByteOrder::littleEndianInt64 (bytes + pos + 8);
+            pos += PluginStateFormat::chunkHeaderSize;
+
+            if (chunkSize > size - pos)
+                break;
+
+            chunk.data = bytes + pos;
+            chunk.size = (size_t) chunkSize;
+            chunks.push_back (chunk);
+            pos += chunk.size;
+        }
+    }
+
+    /** False if the data isn't in this format, or was saved by a newer version. */
+    bool isValid() const noexcept                       { return valid; }
+
+    /** Returns the index'th chunk with this ID, or nullptr if there isn't one. */
+    const Chunk* findChunk (uint32 id, int index = 0) const
+    {
+        for (const auto& chunk : chunks)
+            if (chunk.id == id && index-- == 0)
+                return &chunk;
+
+        return nullptr;
+    }
+
+    std::vector<const Chunk*> findChunks (uint32 id) const
+    {
+        std::vector<const Chunk*> result;
+
+        for (const auto& chunk : chunks)
+            if (chunk.id == id)
+                result.push_back (&chunk);
+
+        return result;
+    }
+
+private:
+    std::vector<Chunk> chunks;
+    bool valid = false;
+};
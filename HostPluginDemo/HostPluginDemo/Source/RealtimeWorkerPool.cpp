@@ -0,0 +1,54 @@
+#include <JuceHeader.h>
+#include "RealtimeWorkerPool.h"
+
+#if JUCE_LINUX
+ #include <sys/syscall.h>
+ #include <linux/futex.h>
+ #include <unistd.h>
+#elif JUCE_WINDOWS
+ #include <windows.h>
+ #pragma comment (lib, "Synchronization.lib")
+#endif
+
+//==============================================================================
+void RealtimeWorkerPool::wakeWorkers (int numToWake)
+{
+   #if JUCE_LINUX
+    syscall (SYS_futex, reinterpret_cast<uint32*> (&wakeCount), FUTEX_WAKE_PRIVATE, numToWake, nullptr, nullptr, 0);
+   #elif JUCE_WINDOWS
+    if (numToWake >= getNumWorkers())
+        WakeByAddressAll (&wakeCount);
+    else
+        for (int i = 0; i < numToWake; ++i)
+            WakeByAddressSingle (&wakeCount);
+   #else
+    ignoreUnused (numToWake);
+   #endif
+}
+
+void RealtimeWorkerPool::waitForWake (uint32 lastSeen)
+{
+    // (a short spin first, as the next batch usually follows within the same callback)
+    for (int i = 0; i < 2048; ++i)
+        if (wakeCount.load() != lastSeen)
+            return;
+
+    ++numParked;
+
+    const auto deadline = Time::getMillisecondCounter() + 100;
+
+    while (wakeCount.load() == lastSeen && Time::getMillisecondCounter() < deadline)
+    {
+       #if JUCE_LINUX
+        timespec timeout { 0, 100 * 1000 * 1000 };
+        syscall (SYS_futex, reinterpret_cast<uint32*> (&wakeCount), FUTEX_WAIT_PRIVATE, lastSeen, &timeout, nullptr, 0);
+       #elif JUCE_WINDOWS
+        auto expected = lastSeen;
+        WaitOnAddress (&wakeCount, &expected, sizeof (expected), 100);
+       #else
+        Thread::sleep (1);
+       #endif
+    }
+
+    --numParked;
+}
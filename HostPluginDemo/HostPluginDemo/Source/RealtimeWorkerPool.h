@@ -0,0 +1,176 @@
+#pragma once
+
+//==============================================================================
+/*  A few realtime-priority threads that help the audio thread get through a batch
+    of independent jobs within one callback, e.g. the parallel branches of a
+    PluginRack.
+
+    perform() hands out the jobs through a single atomic cursor, wakes as many
+    workers as there are jobs to share, and then works through the batch itself
+    too, so the batch finishes even if no worker gets scheduled in time. It only
+    waits at the end, for jobs that a worker has already started.
+
+    Waking the workers never blocks the audio thread. An idle worker spins on a
+    wake counter for a little while and then parks on it, a futex on Linux or
+    WaitOnAddress() on Windows (see RealtimeWorkerPool.cpp), so perform() just
+    bumps the counter and, if anyone is parked, makes the matching wake call. Where
+    neither exists, parked workers poll the counter instead.
+
+    The cursor holds the batch number next to the index of the next job. A new
+    batch is first published closed, with no jobs to claim, while its job and size
+    are stored, and only then opened. A worker that wakes up late and holds the
+    last batch's cursor can therefore never claim a job with the next batch's job
+    and size, and the audio thread can start the next batch as soon as the last
+    one is done.
+*/
+class RealtimeWorkerPool
+{
+public:
+    struct Job
+    {
+        virtual ~Job() = default;
+
+        /** Called once for each index in the batch, on the audio thread or on a worker. */
+        virtual void perform (int index) = 0;
+    };
+
+    /** Starts one fewer worker than there are cores, so with the audio thread itself
+        every core can be busy, up to maxNumWorkers.
+    */
+    explicit RealtimeWorkerPool (int maxNumWorkers = 16)
+    {
+        const auto numWorkers = jlimit (0, maxNumWorkers, SystemStats::getNumCpus() - 1);
+
+        for (int i = 0; i < numWorkers; ++i)
+        {
+            workers.push_back (std::make_unique<Worker> (*this, i));
+            workers.back()->startThread (Thread::realtimeAudioPriority);
+        }
+    }
+
+    ~RealtimeWorkerPool()
+    {
+        for (auto& w : workers)
+            w->signalThreadShouldExit();
+
+        ++wakeCount;
+        wakeWorkers (getNumWorkers());
+
+        for (auto& w : workers)
+            w->stopThread (1000);
+    }
+
+    int getNumWorkers() const noexcept      { return (int) workers.size(); }
+
+    /** Calls job.perform() for every index up to numJobs and returns when they've all
+        finished. Only one thread at a time may call this, normally the audio thread.
+    */
+    void perform (Job& job, int numJobs)
+    {
+        if (numJobs <= 0)
+            return;
+
+        if (numJobs == 1 || workers.empty())
+        {
+            for (int i = 0; i < numJobs; ++i)
+                job.perform (i);
+
+            return;
+        }
+
+        const auto batchStart = (uint64) ++batch << 32;
+
+        numDone = 0;
+        cursor = batchStart | closed; // (so nothing can be claimed until the job and size match it)
+        currentJob = &job;
+        currentNumJobs = numJobs;
+        cursor = batchStart; // (publishes the batch)
+
+        ++wakeCount;
+
+        // (a worker counts itself as parked before it checks the wake count for the last time)
+        if (numParked.load() > 0)
+            wakeWorkers (jmin (numJobs - 1, getNumWorkers()));
+
+        help();
+
+        for (int spins = 0; numDone.load() < numJobs; ++spins)
+            if (spins > 64)
+                Thread::yield();
+    }
+
+private:
+    struct Worker : public Thread
+    {
+        Worker (RealtimeWorkerPool& p, int index)
+            : Thread ("Realtime worker " + String (index + 1)), pool (p) {}
+
+        void run() override
+        {
+            auto lastSeen = pool.wakeCount.load();
+
+            while (! threadShouldExit())
+            {
+                pool.waitForWake (lastSeen);
+                lastSeen = pool.wakeCount.load();
+                pool.help();
+            }
+        }
+
+        RealtimeWorkerPool& pool;
+    };
+
+    static constexpr uint64 closed = 0xffffffff;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint32 batch = 0;
+
+    std::atomic<Job*> currentJob { nullptr };
+    std::atomic<int> currentNumJobs { 0 };
+    std::atomic<uint64> cursor { 0 };
+    std::atomic<int> numDone { 0 };
+    std::atomic<uint32> wakeCount { 0 };
+    std::atomic<int> numParked { 0 };
+
+    /** Wakes up to numToWake parked workers. Never blocks, so it's safe on the audio thread. */
+    void wakeWorkers (int numToWake);
+
+    /** Returns once wakeCount differs from lastSeen, after at most about 100ms. */
+    void waitForWake (uint32 lastSeen);
+
+    /** Claims and performs jobs from the current batch until there are none left. */
+    void help()
+    {
+        auto c = cursor.load();
+
+        // (a batch that's still being published may not have its job and size stored yet)
+        if ((c & closed) == closed)
+            return;
+
+        auto* job = currentJob.load();
+        const auto numJobs = (uint64) currentNumJobs.load();
+        const auto batchNumber = c >> 32;
+
+        for (;;)
+        {
+            const auto index = c & closed;
+
+            if (index >= numJobs)
+                return;
+
+            // (only succeeds while the cursor is still in the batch that job and numJobs came from)
+            if (cursor.compare_exchange_weak (c, c + 1))
+            {
+                job->perform ((int) index);
+                ++numDone;
+                ++c;
+            }
+            else if ((c >> 32) != batchNumber)
+            {
+                return;
+            }
+        }
+    }
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RealtimeWorkerPool)
+};
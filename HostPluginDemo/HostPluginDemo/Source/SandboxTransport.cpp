@@ -0,0 +1,155 @@
+#include <JuceHeader.h>
+#include "SandboxTransport.h"
+
+#if JUCE_LINUX
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <sys/syscall.h>
+ #include <linux/futex.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#elif JUCE_WINDOWS
+ #include <windows.h>
+#else
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+#endif
+
+//==============================================================================
+void SandboxTransport::close()
+{
+    unmap();
+
+   #if JUCE_WINDOWS
+    for (auto* event : { requestEvent, responseEvent })
+        if (event != nullptr)
+            CloseHandle (event);
+
+    requestEvent = responseEvent = nullptr;
+   #else
+    if (owner && name.isNotEmpty())
+        shm_unlink (("/" + name).toRawUTF8());
+   #endif
+
+    name = {};
+    owner = false;
+}
+
+void SandboxTransport::post (std::atomic<uint32>& sequence, uint32 value)
+{
+    sequence.store (value);
+
+   #if JUCE_LINUX
+    syscall (SYS_futex, reinterpret_cast<uint32*> (&sequence), FUTEX_WAKE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+   #elif JUCE_WINDOWS
+    SetEvent (&sequence == &getRequestSeq() ? requestEvent : responseEvent);
+   #endif
+}
+
+bool SandboxTransport::waitForChange (std::atomic<uint32>& sequence, uint32 lastSeen, double timeoutMs)
+{
+    // (a short spin first, as a worker that's keeping up usually answers within microseconds)
+    for (int i = 0; i < 256; ++i)
+        if (sequence.load() != lastSeen)
+            return true;
+
+    const auto deadline = Time::getMillisecondCounterHiRes() + timeoutMs;
+
+    for (;;)
+    {
+        if (sequence.load() != lastSeen)
+            return true;
+
+        const auto remaining = deadline - Time::getMillisecondCounterHiRes();
+
+        if (remaining <= 0)
+            return false;
+
+       #if JUCE_LINUX
+        timespec timeout;
+        timeout.tv_sec = (time_t) (remaining / 1000.0);
+        timeout.tv_nsec = (long) (std::fmod (remaining, 1000.0) * 1.0e6);
+        syscall (SYS_futex, reinterpret_cast<uint32*> (&sequence), FUTEX_WAIT, lastSeen, &timeout, nullptr, 0);
+       #elif JUCE_WINDOWS
+        WaitForSingleObject (&sequence == &getRequestSeq() ? requestEvent : responseEvent,
+                             (DWORD) jmax (1.0, std::ceil (remaining)));
+       #else
+        Thread::yield();
+       #endif
+    }
+}
+
+bool SandboxTransport::openEvents (bool create)
+{
+   #if JUCE_WINDOWS
+    const auto open = [create] (const String& eventName)
+    {
+        return create ? CreateEventW (nullptr, FALSE, FALSE, eventName.toWideCharPointer())
+                      : OpenEventW (EVENT_MODIFY_STATE | SYNCHRONIZE, FALSE, eventName.toWideCharPointer());
+    };
+
+    requestEvent  = open ("Local\\" + name + "-req");
+    responseEvent = open ("Local\\" + name + "-resp");
+
+    return requestEvent != nullptr && responseEvent != nullptr;
+   #else
+    ignoreUnused (create);
+    return true;
+   #endif
+}
+
+bool SandboxTransport::map (size_t size, bool create)
+{
+   #if JUCE_WINDOWS
+    const auto mappingName = "Local\\" + name;
+
+    mapping = create ? CreateFileMappingW (INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                           (DWORD) ((uint64) size >> 32), (DWORD) size, mappingName.toWideCharPointer())
+                     : OpenFileMappingW (FILE_MAP_ALL_ACCESS, FALSE, mappingName.toWideCharPointer());
+
+    if (mapping == nullptr)
+        return false;
+
+    memory = MapViewOfFile (mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+   #else
+    const auto fd = shm_open (("/" + name).toRawUTF8(), create ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+
+    if (fd < 0)
+        return false;
+
+    if (create && ftruncate (fd, (off_t) size) != 0)
+    {
+        ::close (fd);
+        return false;
+    }
+
+    auto* m = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+
+    memory = m != MAP_FAILED ? m : nullptr;
+   #endif
+
+    mappedSize = size;
+    return memory != nullptr;
+}
+
+void SandboxTransport::unmap()
+{
+   #if JUCE_WINDOWS
+    if (memory != nullptr)
+        UnmapViewOfFile (memory);
+
+    if (mapping != nullptr)
+        CloseHandle (mapping);
+
+    mapping = nullptr;
+   #else
+    if (memory != nullptr)
+        munmap (memory, mappedSize);
+   #endif
+
+    memory = nullptr;
+    mappedSize = 0;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+//==============================================================================
+/*  The shared memory that a sandboxed plugin's audio and MIDI travel through
+    between the host and the worker process, and the signalling that goes with it.
+
+    The memory holds a small ring of slots. Each slot has room for a whole block of
+    audio for every channel, plus the MIDI going each way. The host writes block n
+    into slot n % numSlots and publishes n in requestSeq. The worker processes the
+    slots in order, in place, and publishes each block it finishes in responseSeq.
+    Nothing is copied apart from the host filling the slot and reading it back, and
+    no sockets or pipes are involved.
+
+    Either side can sleep until the other one's sequence number moves. On Linux
+    that's a futex on the sequence number itself. On Windows it's a pair of named
+    events. Elsewhere it's a spin that backs off to yields.
+
+    The ring is there so that a host that gave up waiting for a late block can send
+    the next one straight away, without overwriting the slot the worker is still
+    busy with.
+
+    Everything that talks to the OS is in SandboxTransport.cpp, so that no header
+    pulls in windows.h, whose global names clash with JUCE's.
+*/
+class SandboxTransport
+{
+public:
+    static constexpr int numSlots = 4;
+    static constexpr int midiBytesPerSlot = 16384; // (in each direction)
+
+    SandboxTransport() = default;
+    ~SandboxTransport()     { close(); }
+
+    //==============================================================================
+    /** Creates a new block of shared memory under a unique name, for the host's side. */
+    bool create (int numChannelsToUse, int maxBlockSizeToUse)
+    {
+        close();
+
+        name = "djs" + String::toHexString (Random().nextInt64());
+        owner = true;
+
+        const auto size = getTotalSize (numChannelsToUse, maxBlockSizeToUse);
+
+        if (! openEvents (true) || ! map (size, true))
+        {
+            close();
+            return false;
+        }
+
+        auto* header = new (memory) Header();
+        header->numChannels = numChannelsToUse;
+        header->maxBlockSize = maxBlockSizeToUse;
+        header->magic = magicNumber; // (last, so the worker never sees a half-written header)
+
+        setUpLayout();
+        return true;
+    }
+
+    /** Maps a block of shared memory that the host created, for the worker's side. */
+    bool open (const String& nameToOpen)
+    {
+        close();
+
+        name = nameToOpen;
+        owner = false;
+
+        // (the header is read first, to find out how big the whole thing is)
+        if (! openEvents (false) || ! map (sizeof (Header), false))
+        {
+            close();
+            return false;
+        }
+
+        const auto numChans = getHeader().numChannels;
+        const auto maxBlock = getHeader().maxBlockSize;
+        const auto valid = getHeader().magic == magicNumber && numChans > 0 && maxBlock > 0;
+        unmap();
+
+        if (! valid || ! map (getTotalSize (numChans, maxBlock), false))
+        {
+            close();
+            return false;
+        }
+
+        setUpLayout();
+        return true;
+    }
+
+    void close();
+
+    bool isOpen() const noexcept                    { return memory != nullptr; }
+    const String& getName() const noexcept          { return name; }
+    int getNumChannels() const noexcept             { return getHeader().numChannels; }
+    int getMaxBlockSize() const noexcept            { return getHeader().maxBlockSize; }
+
+    //==============================================================================
+    struct Slot
+    {
+        int32* numSamples;
+        float* const* channels;
+        uint8* midiIn;
+        int32* numMidiBytesIn;
+        uint8* midiOut;
+        int32* numMidiBytesOut;
+    };
+
+    Slot getSlot (uint32 sequenceNumber) const noexcept     { return slots[sequenceNumber % numSlots]; }
+
+    std::atomic<uint32>& getRequestSeq() noexcept           { return getHeader().requestSeq; }
+    std::atomic<uint32>& getResponseSeq() noexcept          { return getHeader().responseSeq; }
+
+    //==============================================================================
+    /** Publishes a new request or response and wakes the other side if it's asleep. */
+    void post (std::atomic<uint32>& sequence, uint32 value);
+
+    /** Waits until the sequence number is no longer the one given, or until the timeout
+        runs out. Returns false on a timeout.
+    */
+    bool waitForChange (std::atomic<uint32>& sequence, uint32 lastSeen, double timeoutMs);
+
+private:
+    struct Header
+    {
+        uint32 magic = 0;
+        int32 numChannels = 0;
+        int32 maxBlockSize = 0;
+        int32 reserved = 0;
+        alignas (64) std::atomic<uint32> requestSeq { 0 };  // (written by the host)
+        alignas (64) std::atomic<uint32> responseSeq { 0 }; // (written by the worker)
+    };
+
+    static_assert (sizeof (std::atomic<uint32>) == sizeof (uint32), "The sequence numbers must be plain words in shared memory");
+
+    static constexpr uint32 magicNumber = 0x44534254; // "TBSD" when written little-endian
+
+    String name;
+    bool owner = false;
+    void* memory = nullptr;
+    size_t mappedSize = 0;
+    Slot slots[numSlots];
+    std::vector<float*> channelPointers;
+
+    void* mapping = nullptr;       // (on Windows, the HANDLEs of the file mapping
+    void* requestEvent = nullptr;  // and the two events)
+    void* responseEvent = nullptr;
+
+    Header& getHeader() const noexcept      { return *static_cast<Header*> (memory); }
+
+    static size_t getSlotSize (int numChannels, int maxBlockSize) noexcept
+    {
+        const auto audio = sizeof (float) * (size_t) numChannels * (size_t) maxBlockSize;
+        return (size_t) roundUp (16 + audio + 2 * (size_t) midiBytesPerSlot);
+    }
+
+    static size_t getTotalSize (int numChannels, int maxBlockSize) noexcept
+    {
+        return roundUp (sizeof (Header)) + numSlots * getSlotSize (numChannels, maxBlockSize);
+    }
+
+    static size_t roundUp (size_t size) noexcept    { return (size + 63) & ~(size_t) 63; }
+
+    void setUpLayout()
+    {
+        const auto numChannels = getNumChannels();
+        const auto maxBlockSize = getMaxBlockSize();
+        auto* base = static_cast<uint8*> (memory) + roundUp (sizeof (Header));
+
+        channelPointers.resize ((size_t) (numSlots * numChannels));
+
+        for (int i = 0; i < numSlots; ++i)
+        {
+            auto* slot = base + (size_t) i * getSlotSize (numChannels, maxBlockSize);
+            auto* audio = reinterpret_cast<float*> (slot + 16);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                channelPointers[(size_t) (i * numChannels + ch)] = audio + (size_t) ch * (size_t) maxBlockSize;
+
+            auto* midi = reinterpret_cast<uint8*> (audio + (size_t) numChannels * (size_t) maxBlockSize);
+
+            slots[i].numSamples      = reinterpret_cast<int32*> (slot);
+            slots[i].numMidiBytesIn  = reinterpret_cast<int32*> (slot + 4);
+            slots[i].numMidiBytesOut = reinterpret_cast<int32*> (slot + 8);
+            slots[i].channels        = channelPointers.data() + i * numChannels;
+            slots[i].midiIn          = midi;
+            slots[i].midiOut         = midi + midiBytesPerSlot;
+        }
+    }
+
+    bool openEvents (bool create);
+    bool map (size_t size, bool create);
+    void unmap();
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SandboxTransport)
+};
@@ -42,6 +42,12 @@
 
 #include "my_StandaloneFilterWindow.h"
 
+// (defined next to createPluginFilter(), and true if this process is a plugin sandbox or a plugin scanner)
+bool runChildProcessWorker (const juce::String& commandLine);
+
+// (likewise, and true if the app was started just to run its unit tests, which it then quits after)
+bool runUnitTests (const juce::String& commandLine);
+
 namespace juce
 {
 
@@ -94,8 +100,11 @@ public:
     }
 
     //==============================================================================
-    void initialise (const String&) override
+    void initialise (const String& commandLine) override
     {
+        if (runChildProcessWorker (commandLine) || runUnitTests (commandLine))
+            return;
+
         mainWindow.reset (createWindow());
 
        #if JUCE_STANDALONE_FILTER_WINDOW_USE_KIOSK_MODE